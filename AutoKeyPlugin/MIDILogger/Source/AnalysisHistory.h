@@ -0,0 +1,378 @@
+/*
+  ==============================================================================
+
+    Long-session note history in a fixed memory budget.
+
+    Only what the analysis needs is kept: for each note-on/off the time since
+    the previous event (milliseconds, varint), the note number and the
+    velocity (0 = note off), usually three bytes per event. Events are packed
+    into fixed-size blocks, and each block starts with a checkpoint holding
+    the note-on counts per pitch class up to that point. So the histogram for
+    any past window takes the two checkpoints around its ends plus decoding
+    at most two blocks, however long the session has been running.
+
+    When the budget is used up the oldest block is recycled; the next block's
+    checkpoint still covers everything before it. The plugin state keeps the
+    newest blocks (save() and restore()), so the windows reach back as far
+    after a reload. Message thread only.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <array>
+#include <deque>
+
+class AnalysisHistory
+{
+public:
+    using Histogram = std::array<float, 12>;    // same layout as MidiKeyFinder::Histogram
+
+    static constexpr int blockSize = 4096;
+    static constexpr size_t defaultMemoryBudget = 4 << 20;
+
+    explicit AnalysisHistory (size_t memoryBudgetBytes = defaultMemoryBudget)
+    {
+        setMemoryBudget (memoryBudgetBytes);
+    }
+
+    /** Drops the oldest blocks straight away if the history is already bigger than this. */
+    void setMemoryBudget (size_t bytes)
+    {
+        memoryBudget = bytes;
+        maxBlocks = jmax ((size_t) 2, bytes / sizeof (Block));
+
+        while (blocks.size() > maxBlocks)
+            dropOldestBlock();
+    }
+
+    size_t getMemoryBudget() const  { return memoryBudget; }
+    size_t getMemoryUsed() const    { return blocks.size() * sizeof (Block); }
+
+    /** Records note-ons and note-offs; anything else is not needed for the analysis. */
+    void add (double timeSeconds, const MidiMessage& m)
+    {
+        if (m.isNoteOn())
+            addNote (timeSeconds, m.getNoteNumber(), m.getVelocity());
+        else if (m.isNoteOff())
+            addNote (timeSeconds, m.getNoteNumber(), 0);
+    }
+
+    void addNote (double timeSeconds, int note, int velocity)
+    {
+        auto timeMs = (int64) std::floor (timeSeconds * 1000.0);
+
+        if (blocks.empty())
+            lastTimeMs = timeMs;
+
+        // Host and device events are merged per drain, so they can be a little out of
+        // order. Keeping time monotonic is what lets lookups binary-search the blocks.
+        timeMs = jmax (timeMs, lastTimeMs);
+
+        uint8 encoded[maxEventSize];
+        auto size = writeVarint (encoded, (uint64) (timeMs - lastTimeMs));
+        encoded[size++] = (uint8) (note & 0x7f);
+        encoded[size++] = (uint8) (velocity & 0x7f);
+
+        if (blocks.empty() || blocks.back()->used + size > blockSize)
+            startBlock();
+
+        auto& block = *blocks.back();
+        std::memcpy (block.data.data() + block.used, encoded, (size_t) size);
+        block.used += size;
+        block.lastTimeMs = timeMs;
+        ++block.numEvents;
+
+        lastTimeMs = timeMs;
+        ++numEvents;
+
+        if (velocity > 0)
+            ++totals[(size_t) (note % 12)];
+    }
+
+    void clear()
+    {
+        blocks.clear();
+        totals.fill (0);
+        lastTimeMs = 0;
+        numEvents = numEventsDropped = 0;
+    }
+
+    /** Times (seconds) of the oldest retained event and the newest event. */
+    double getStartTime() const     { return blocks.empty() ? 0.0 : (double) blocks.front()->startTimeMs * 0.001; }
+    double getEndTime() const       { return blocks.empty() ? 0.0 : (double) lastTimeMs * 0.001; }
+
+    int64 getNumEvents() const          { return numEvents; }
+    int64 getNumEventsDropped() const   { return numEventsDropped; }
+
+    /** Note-on counts per pitch class between two times (seconds). Anything older than the
+        retained history is treated as if it happened at its start.
+    */
+    Histogram getHistogram (double startTime, double endTime) const
+    {
+        const auto end = countUpTo ((int64) std::floor (endTime * 1000.0));
+        const auto start = countUpTo ((int64) std::floor (startTime * 1000.0) - 1);
+
+        Histogram h;
+
+        for (size_t i = 0; i < h.size(); ++i)
+            h[i] = (float) (end[i] - jmin (start[i], end[i]));
+
+        return h;
+    }
+
+    //==============================================================================
+    using Counts = std::array<uint32, 12>;
+
+    /** The history as plain data, for the plugin state. */
+    struct Saved
+    {
+        struct Block
+        {
+            int64 startTimeMs = 0, lastTimeMs = 0;
+            Counts counts {};
+            int numEvents = 0;
+            std::vector<uint8> data;
+        };
+
+        Counts totals {};
+        int64 lastTimeMs = 0, numEvents = 0, numEventsDropped = 0;
+        std::vector<Block> blocks;      // oldest first
+    };
+
+    /** The totals and the newest maxBlocksToSave blocks. Restoring them is the same as if
+        the older ones had been recycled.
+    */
+    Saved save (size_t maxBlocksToSave) const
+    {
+        Saved saved;
+        saved.totals = totals;
+        saved.lastTimeMs = lastTimeMs;
+        saved.numEvents = numEvents;
+        saved.numEventsDropped = numEventsDropped;
+
+        const auto first = blocks.size() - jmin (blocks.size(), maxBlocksToSave);
+
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            const auto& block = *blocks[i];
+
+            if (i < first)
+            {
+                saved.numEventsDropped += block.numEvents;
+                continue;
+            }
+
+            saved.blocks.push_back ({ block.startTimeMs, block.lastTimeMs, block.counts, block.numEvents,
+                                      { block.data.begin(), block.data.begin() + block.used } });
+        }
+
+        return saved;
+    }
+
+    /** Replaces the history with a saved one. If the blocks don't decode to the times and
+        counts saved with them the history is left empty, and this returns false.
+    */
+    bool restore (const Saved& saved)
+    {
+        clear();
+
+        if (! isValid (saved))
+            return false;
+
+        for (const auto& s : saved.blocks)
+        {
+            auto block = std::make_unique<Block>();
+            block->startTimeMs = s.startTimeMs;
+            block->lastTimeMs = s.lastTimeMs;
+            block->counts = s.counts;
+            block->numEvents = s.numEvents;
+            block->used = (int) s.data.size();
+            std::copy (s.data.begin(), s.data.end(), block->data.begin());
+            blocks.push_back (std::move (block));
+        }
+
+        totals = saved.totals;
+        lastTimeMs = saved.lastTimeMs;
+        numEvents = saved.numEvents;
+        numEventsDropped = saved.numEventsDropped;
+
+        while (blocks.size() > maxBlocks)
+            dropOldestBlock();
+
+        return true;
+    }
+
+private:
+
+    static constexpr int maxEventSize = 10 + 2;
+
+    struct Block
+    {
+        // Checkpoint: the state just before the first event in the block.
+        int64 startTimeMs = 0;
+        Counts counts {};
+
+        int64 lastTimeMs = 0;
+        int used = 0, numEvents = 0;
+        std::array<uint8, blockSize> data;
+    };
+
+    void startBlock()
+    {
+        std::unique_ptr<Block> block;
+
+        if (blocks.size() >= maxBlocks)
+        {
+            block = std::move (blocks.front());
+            blocks.pop_front();
+            numEventsDropped += block->numEvents;
+        }
+        else
+        {
+            block = std::make_unique<Block>();
+        }
+
+        block->startTimeMs = block->lastTimeMs = lastTimeMs;
+        block->counts = totals;
+        block->used = block->numEvents = 0;
+        blocks.push_back (std::move (block));
+    }
+
+    void dropOldestBlock()
+    {
+        numEventsDropped += blocks.front()->numEvents;
+        blocks.pop_front();
+    }
+
+    // Each block has to decode to its own last time and to the next block's checkpoint,
+    // which is what the lookups rely on.
+    static bool isValid (const Saved& saved)
+    {
+        if (saved.numEvents < 0 || saved.numEventsDropped < 0)
+            return false;
+
+        for (size_t i = 0; i < saved.blocks.size(); ++i)
+        {
+            const auto& block = saved.blocks[i];
+
+            if (block.data.size() > (size_t) blockSize || block.startTimeMs > block.lastTimeMs
+                 || (i > 0 && block.startTimeMs < saved.blocks[i - 1].lastTimeMs))
+                return false;
+
+            auto counts = block.counts;
+            auto time = block.startTimeMs;
+            int num = 0;
+
+            for (size_t pos = 0; pos < block.data.size(); ++num)
+            {
+                uint64 delta = 0;
+
+                for (int shift = 0;; shift += 7)
+                {
+                    if (pos >= block.data.size() || shift >= 63)
+                        return false;
+
+                    const auto byte = block.data[pos++];
+                    delta |= (uint64) (byte & 0x7f) << shift;
+
+                    if ((byte & 0x80) == 0)
+                        break;
+                }
+
+                if (block.data.size() - pos < 2 || delta > (uint64) (block.lastTimeMs - time))
+                    return false;
+
+                time += (int64) delta;
+
+                if (block.data[pos + 1] > 0)
+                    ++counts[(size_t) (block.data[pos] % 12)];
+
+                pos += 2;
+            }
+
+            const auto& next = i + 1 < saved.blocks.size() ? saved.blocks[i + 1].counts : saved.totals;
+
+            if (num != block.numEvents || time != block.lastTimeMs || counts != next)
+                return false;
+        }
+
+        return saved.blocks.empty() || saved.blocks.back().lastTimeMs == saved.lastTimeMs;
+    }
+
+    // Note-on counts for everything at or before timeMs.
+    Counts countUpTo (int64 timeMs) const
+    {
+        if (blocks.empty() || timeMs >= lastTimeMs)
+            return totals;
+
+        // The first block that reaches past timeMs holds the answer.
+        const auto it = std::partition_point (blocks.begin(), blocks.end(),
+                                              [timeMs] (const std::unique_ptr<Block>& b) { return b->lastTimeMs <= timeMs; });
+
+        if (it == blocks.end())
+            return totals;
+
+        const auto& block = **it;
+        auto counts = block.counts;
+        auto time = block.startTimeMs;
+
+        for (int pos = 0; pos < block.used;)
+        {
+            uint64 delta = 0;
+            pos += readVarint (block.data.data() + pos, delta);
+            time += (int64) delta;
+
+            if (time > timeMs)
+                break;
+
+            const auto note = block.data[(size_t) pos];
+            const auto velocity = block.data[(size_t) pos + 1];
+            pos += 2;
+
+            if (velocity > 0)
+                ++counts[(size_t) (note % 12)];
+        }
+
+        return counts;
+    }
+
+    static int writeVarint (uint8* out, uint64 value)
+    {
+        int size = 0;
+
+        while (value >= 0x80)
+        {
+            out[size++] = (uint8) (value | 0x80);
+            value >>= 7;
+        }
+
+        out[size++] = (uint8) value;
+        return size;
+    }
+
+    static int readVarint (const uint8* in, uint64& value)
+    {
+        value = 0;
+        int size = 0;
+
+        for (int shift = 0;; shift += 7)
+        {
+            const auto byte = in[size++];
+            value |= (uint64) (byte & 0x7f) << shift;
+
+            if ((byte & 0x80) == 0)
+                return size;
+        }
+    }
+
+    std::deque<std::unique_ptr<Block>> blocks;
+    size_t memoryBudget = 0, maxBlocks = 2;
+
+    Counts totals {};
+    int64 lastTimeMs = 0;
+    int64 numEvents = 0, numEventsDropped = 0;
+
+    JUCE_DECLARE_NON_COPYABLE (AnalysisHistory)
+};
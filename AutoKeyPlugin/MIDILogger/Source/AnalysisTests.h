@@ -0,0 +1,441 @@
+/*
+  ==============================================================================
+
+    Unit tests for the analysis, in the "AutoKey" category. The standalone
+    app runs them with --selftest.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <numeric>
+#include <set>
+
+#include "MidiByteStreamParser.h"
+
+class ChordLearningTests  : public UnitTest
+{
+public:
+    ChordLearningTests()  : UnitTest ("Chord learning", "AutoKey") {}
+
+    void runTest() override
+    {
+        beginTest ("Letting go of a chord one note at a time learns nothing");
+        {
+            MidiKeyFinder finder;
+            double time = 0.0;
+
+            playChord (finder, { 60, 64, 67 }, time);       // C, for a key and a chord to come from
+            finder.update_progression_key();
+
+            for (auto note : { 57, 60, 64, 67 })             // Am7, held
+                finder.add_midi_message (stamped (MidiMessage::noteOn (1, note, (uint8) 90), time));
+
+            time += 1.0;
+            const auto learnedBefore = getTotalCount (finder);
+
+            for (auto note : { 57, 60, 64, 67 })             // A first leaves C, then Em, ...
+            {
+                finder.add_midi_message (stamped (MidiMessage::noteOff (1, note), time));
+                finder.update_progression_key();
+                time += 0.25;
+            }
+
+            expectEquals (finder.get_progression().size(), 2);
+            expectEquals (learnedBefore, 0);
+            expectEquals (getTotalCount (finder), 1);        // C -> Am7, and nothing on the way out
+        }
+
+        beginTest ("A rolled chord is one change");
+        {
+            MidiKeyFinder finder;
+            double time = 0.0;
+
+            playChord (finder, { 57, 60, 64 }, time);
+            finder.update_progression_key();
+
+            for (auto note : { 48, 55, 64 })                 // C5 before the E makes it C
+            {
+                finder.add_midi_message (stamped (MidiMessage::noteOn (1, note, (uint8) 90), time));
+                time += 0.03;
+            }
+
+            time += 1.0;
+
+            for (auto note : { 48, 55, 64 })
+                finder.add_midi_message (stamped (MidiMessage::noteOff (1, note), time));
+
+            const auto& progression = finder.get_progression();
+            expectEquals (progression.size(), 2);
+            expectEquals (progression.getChordName (1), String ("C"));
+            expectEquals (getTotalCount (finder), 1);
+        }
+    }
+
+private:
+    static MidiMessage stamped (MidiMessage m, double time)
+    {
+        m.setTimeStamp (time);
+        return m;
+    }
+
+    static void playChord (MidiKeyFinder& finder, std::initializer_list<int> notes, double& time)
+    {
+        for (auto note : notes)
+            finder.add_midi_message (stamped (MidiMessage::noteOn (1, note, (uint8) 90), time));
+
+        time += 1.0;
+
+        for (auto note : notes)
+            finder.add_midi_message (stamped (MidiMessage::noteOff (1, note), time));
+
+        time += 0.5;
+    }
+
+    static int getTotalCount (const MidiKeyFinder& finder)
+    {
+        int total = 0;
+        finder.get_predictor().forEachCount ([&] (int, int count) { total += count; });
+        return total;
+    }
+};
+
+static ChordLearningTests chordLearningTests;
+
+//==============================================================================
+class KeyRankingTests  : public UnitTest
+{
+public:
+    KeyRankingTests()  : UnitTest ("12-EDO key ranking", "AutoKey") {}
+
+    void runTest() override
+    {
+        beginTest ("EdoScale<12> ranks keys as the scale sets did");
+        {
+            MidiKeyFinder finder;
+            auto random = getRandom();
+
+            for (int trial = 0; trial < 10000; ++trial)
+            {
+                MidiKeyFinder::Histogram h;
+
+                // Some pitch classes left out, as in real music, so the scales get told apart.
+                for (auto& weight : h)
+                    weight = random.nextInt (3) == 0 ? 0.0f : random.nextFloat() * 10.0f;
+
+                MidiKeyFinder::RankedKey ranked[MidiKeyFinder::num_keys];
+                const auto num = finder.rank_keys (h, ranked, MidiKeyFinder::num_keys);
+                const auto expected = rankWithScaleSets (h);
+
+                expectEquals (num, (int) expected.size());
+
+                // Exactly, not within a tolerance: relative keys tie on the scale weight unless it's
+                // summed in the same order for both, and then the last bit picks the winner. Keys
+                // that tie on both weights may come in either order.
+                for (int i = 0; i < num; ++i)
+                {
+                    expectEquals (ranked[i].score, expected[(size_t) i].score);
+                    expectEquals (ranked[i].tonic_weight, expected[(size_t) i].tonic_weight);
+                }
+            }
+        }
+    }
+
+private:
+    // The ranking as it was before EdoScale: each key's notes in a std::set.
+    static std::vector<MidiKeyFinder::RankedKey> rankWithScaleSets (const MidiKeyFinder::Histogram& h)
+    {
+        const auto total = std::accumulate (h.begin(), h.end(), 0.0f);
+        std::vector<MidiKeyFinder::RankedKey> ranked;
+
+        if (total <= 0.0f)
+            return ranked;
+
+        for (int i = 0; i < MidiKeyFinder::num_keys; ++i)
+        {
+            const auto tonic = MidiKeyFinder::get_key_tonic (i);
+            const auto minor = MidiKeyFinder::is_minor_key (i);
+            static constexpr int minorDegrees[] { 0, 2, 3, 5, 7, 8, 10 };
+            static constexpr int majorDegrees[] { 0, 2, 4, 5, 7, 9, 11 };
+            std::set<int> scale;
+
+            for (auto degree : minor ? minorDegrees : majorDegrees)
+                scale.insert ((tonic + degree) % 12);
+
+            float inside = 0.0f;
+
+            for (auto note : scale)
+                inside += h[(size_t) note];
+
+            const auto third = (tonic + (minor ? 3 : 4)) % 12;
+            const auto fifth = (tonic + 7) % 12;
+            ranked.push_back ({ i, inside / total, (h[(size_t) tonic] + h[(size_t) third] + h[(size_t) fifth]) / total });
+        }
+
+        std::stable_sort (ranked.begin(), ranked.end(), [] (const MidiKeyFinder::RankedKey& a, const MidiKeyFinder::RankedKey& b)
+        {
+            return a.score != b.score ? a.score > b.score : a.tonic_weight > b.tonic_weight;
+        });
+
+        return ranked;
+    }
+};
+
+static KeyRankingTests keyRankingTests;
+
+//==============================================================================
+class AnalysisRestoreTests  : public UnitTest
+{
+public:
+    AnalysisRestoreTests()  : UnitTest ("Analysis restore", "AutoKey") {}
+
+    void runTest() override
+    {
+        MidiKeyFinder played;
+        double time = 0.0;
+
+        for (auto note : { 62, 66, 69, 64, 67, 71, 62, 66, 69 })     // D, Em, D
+        {
+            played.add_midi_message (stamped (MidiMessage::noteOn (1, note, (uint8) 90), time));
+            time += 0.5;
+            played.add_midi_message (stamped (MidiMessage::noteOff (1, note), time));
+        }
+
+        played.update_progression_key();
+
+        beginTest ("A restored analysis ranks on the saved durations");
+        {
+            MidiKeyFinder restored;
+            restored.restore (played.get_histogram(), played.get_notes_mask(), played.get_notes_seen());
+            restored.restore_evidence (played.get_evidence());
+
+            expect (restored.get_key_evidence() == played.get_evidence());
+            expectSameKey (restored, played);
+        }
+
+        beginTest ("Without saved durations the note counts stand in");
+        {
+            MidiKeyFinder restored;
+            restored.restore (played.get_histogram(), played.get_notes_mask(), played.get_notes_seen());
+
+            expect (restored.get_key_evidence() == played.get_histogram());
+            expectSameKey (restored, played);
+        }
+    }
+
+private:
+    static MidiMessage stamped (MidiMessage m, double time)
+    {
+        m.setTimeStamp (time);
+        return m;
+    }
+
+    // The same best key, and the restored progression gets labelled against it.
+    void expectSameKey (MidiKeyFinder& restored, const MidiKeyFinder& played)
+    {
+        MidiKeyFinder::RankedKey expected, best;
+        played.rank_keys (played.get_key_evidence(), &expected, 1);
+        expectEquals (restored.rank_keys (restored.get_key_evidence(), &best, 1), 1);
+        expectEquals (best.index, expected.index);
+
+        const auto& progression = played.get_progression();
+
+        for (int i = 0; i < progression.size(); ++i)
+            restored.restore_progression_step (progression.getPosition (i), progression.getChordId (i));
+
+        restored.update_progression_key();
+        expect (restored.get_progression().hasKey());
+        expectEquals (restored.get_progression().getTonic(), played.get_progression().getTonic());
+    }
+};
+
+static AnalysisRestoreTests analysisRestoreTests;
+
+//==============================================================================
+class MidiByteStreamParserTests  : public UnitTest
+{
+public:
+    MidiByteStreamParserTests()  : UnitTest ("MIDI byte stream parser", "AutoKey") {}
+
+    void runTest() override
+    {
+        beginTest ("Messages and SysEx split across pushes come out as in one push");
+        {
+            const Bytes stream { 0x90, 0x3c, 0x64, 0x40, 0x64,          // a note, then one on running status
+                                 0xf0, 0x7e, 0x01, 0x06, 0x02, 0xf7,    // SysEx, skipped whole
+                                 0xb0, 0x40, 0x7f, 0xc0, 0x05,
+                                 0xf0, 0x43, 0x10,                      // SysEx cut short by the next status
+                                 0x80, 0x3c, 0x00, 0x40, 0x00 };
+            const std::vector<Bytes> expected { { 0x90, 0x3c, 0x64 }, { 0x90, 0x40, 0x64 }, { 0xb0, 0x40, 0x7f },
+                                                { 0xc0, 0x05 }, { 0x80, 0x3c, 0x00 }, { 0x80, 0x40, 0x00 } };
+
+            // One push, a byte at a time, and every split into two.
+            for (size_t chunkSize : { stream.size(), (size_t) 1 })
+                expectParsedAs (stream, chunkSize, expected, 1, 1);
+
+            for (size_t split = 1; split < stream.size(); ++split)
+            {
+                MidiByteStreamParser parser;
+                std::vector<Bytes> messages;
+                parser.push (stream.data(), split, Collect { messages });
+                parser.push (stream.data() + split, stream.size() - split, Collect { messages });
+
+                expect (messages == expected, "split at byte " + String (split));
+                expectEquals ((int) parser.getNumSysExSkipped(), 1);
+                expectEquals ((int) parser.getNumSysExDropped(), 1);
+            }
+        }
+
+        beginTest ("A clock byte inside a running-status note comes out first");
+        {
+            const Bytes stream { 0x90, 0x3c, 0x64, 0x3e, 0xf8, 0x64, 0xf8, 0x40, 0x64 };
+            const std::vector<Bytes> expected { { 0x90, 0x3c, 0x64 }, { 0xf8 }, { 0x90, 0x3e, 0x64 },
+                                                { 0xf8 }, { 0x90, 0x40, 0x64 } };
+
+            for (size_t chunkSize : { stream.size(), (size_t) 1 })
+                expectParsedAs (stream, chunkSize, expected, 0, 0);
+        }
+
+        beginTest ("Data bytes without a status are counted and dropped");
+        {
+            // Before any status, after a system common message, and after a SysEx.
+            const Bytes stream { 0x3c, 0x64, 0x90, 0x3c, 0x64, 0xf6, 0x40, 0xf0, 0x01, 0xf7, 0x40, 0x64 };
+
+            MidiByteStreamParser parser;
+            std::vector<Bytes> messages;
+            parser.push (stream.data(), stream.size(), Collect { messages });
+
+            expect (messages == std::vector<Bytes> { { 0x90, 0x3c, 0x64 }, { 0xf6 } });
+            expectEquals ((int) parser.getNumStrayDataBytes(), 5);
+
+            parser.reset();
+            parser.push (stream.data() + 2, 3, Collect { messages });
+            expectEquals ((int) parser.getNumStrayDataBytes(), 5, "reset() keeps the counts");
+        }
+    }
+
+private:
+    using Bytes = std::vector<uint8_t>;
+
+    struct Collect
+    {
+        std::vector<Bytes>& messages;
+        void operator() (const uint8_t* data, int size) const    { messages.emplace_back (data, data + size); }
+    };
+
+    void expectParsedAs (const Bytes& stream, size_t chunkSize, const std::vector<Bytes>& expected,
+                         int numSysExSkipped, int numSysExDropped)
+    {
+        MidiByteStreamParser parser;
+        std::vector<Bytes> messages;
+
+        for (size_t i = 0; i < stream.size(); i += chunkSize)
+            parser.push (stream.data() + i, jmin (chunkSize, stream.size() - i), Collect { messages });
+
+        expect (messages == expected, "chunks of " + String ((int) chunkSize));
+        expectEquals ((int) parser.getNumSysExSkipped(), numSysExSkipped);
+        expectEquals ((int) parser.getNumSysExDropped(), numSysExDropped);
+        expectEquals ((int) parser.getNumStrayDataBytes(), 0);
+    }
+};
+
+static MidiByteStreamParserTests midiByteStreamParserTests;
+
+//==============================================================================
+class UmpDecoderTests  : public UnitTest
+{
+public:
+    UmpDecoderTests()  : UnitTest ("UMP decoding", "AutoKey") {}
+
+    void runTest() override
+    {
+        beginTest ("MIDI 1.0 velocities scale up as the translation rules say");
+        {
+            expectEquals ((int) UmpDecoder::velocityFrom7Bits[0], 0);
+            expectEquals ((int) UmpDecoder::velocityFrom7Bits[64], 0x8000);
+            expectEquals ((int) UmpDecoder::velocityFrom7Bits[127], 0xffff);
+        }
+
+        // A packet of every length, kept and skipped, so a wrong entry in the length table
+        // throws the rest of the stream out of step.
+        const std::vector<uint32> words { 0x00000000,                                 // utility: no-op
+                                          0x10f80000,                                 // system: clock
+                                          0x20903c64,                                 // MIDI 1.0 note on
+                                          0x30160102, 0x03040506,                     // SysEx
+                                          0x40913e03, 0xc0007c00,                     // MIDI 2.0 note on, Pitch 7.9
+                                          0x50000000, 0, 0, 0,                        // 128-bit data
+                                          0x40613e00, 0x90000000,                     // per-note pitch bend
+                                          0xb0000000, 0, 0,                           // reserved, 96 bits
+                                          0x40b14000, 0xfe000000,                     // sustain pedal
+                                          0xd0000000, 0, 0, 0,                        // flex data
+                                          0x40813e00, 0x00000000,                     // MIDI 2.0 note off
+                                          0x20803c00,                                 // MIDI 1.0 note off
+                                          0xf0000000, 0, 0, 0 };                      // UMP stream
+        std::vector<uint8> bytes (words.size() * 4);
+
+        for (size_t i = 0; i < words.size(); ++i)
+            ByteOrder::writeBigEndianInt (bytes.data() + 4 * i, words[i]);
+
+        beginTest ("A packet stream decodes to the same events in one read or a byte at a time");
+        {
+            Events inOneRead, byteByByte;
+            int numPackets = 0;
+
+            UmpDecoder::Reader<256> reader;
+            expectEquals (reader.push (bytes.data(), (int) bytes.size(), Collect { inOneRead }), 13);
+
+            UmpDecoder::Reader<1> byteReader;
+
+            for (auto b : bytes)
+                numPackets += byteReader.push (&b, 1, Collect { byteByByte });
+
+            expectEquals (numPackets, 13);
+            expectEquals ((int) byteByByte.size(), (int) inOneRead.size());
+
+            for (size_t i = 0; i < jmin (inOneRead.size(), byteByByte.size()); ++i)
+                expect (isSameEvent (byteByByte[i], inOneRead[i]), "event " + String ((int) i));
+
+            expectEquals ((int) inOneRead.size(), 6);
+
+            if (inOneRead.size() == 6)
+            {
+                expectEvent (inOneRead[0], UmpDecoder::noteOn, 0, 60, 60.0f);
+                expectEquals ((int) inOneRead[0].velocity, (int) UmpDecoder::velocityFrom7Bits[100]);
+                expectEvent (inOneRead[1], UmpDecoder::noteOn, 1, 62, 62.0f);
+                expectEquals ((int) inOneRead[1].velocity, 0xc000);
+                expectEvent (inOneRead[2], UmpDecoder::perNotePitch, 1, 62, 68.0f);     // an eighth of +48
+                expectEvent (inOneRead[3], UmpDecoder::controller, 1, 64, 64.0f);
+                expectEquals ((int) inOneRead[3].number, 64);
+                expectEquals ((int) inOneRead[3].value, 127);
+                expectEvent (inOneRead[4], UmpDecoder::noteOff, 1, 62, 62.0f);
+                expectEvent (inOneRead[5], UmpDecoder::noteOff, 0, 60, 60.0f);
+            }
+        }
+    }
+
+private:
+    using Events = std::vector<UmpDecoder::Event>;
+
+    struct Collect
+    {
+        Events& events;
+        void operator() (const UmpDecoder::Event& e) const    { events.push_back (e); }
+    };
+
+    static bool isSameEvent (const UmpDecoder::Event& a, const UmpDecoder::Event& b)
+    {
+        return a.kind == b.kind && a.channel == b.channel && a.note == b.note && a.pitch == b.pitch
+            && a.velocity == b.velocity && a.number == b.number && a.value == b.value;
+    }
+
+    void expectEvent (const UmpDecoder::Event& e, UmpDecoder::Kind kind, int channel, int note, float pitch)
+    {
+        expectEquals ((int) e.kind, (int) kind);
+        expectEquals ((int) e.channel, channel);
+        expectEquals ((int) e.note, note);
+        expectWithinAbsoluteError (e.pitch, pitch, 1.0e-4f);
+    }
+};
+
+static UmpDecoderTests umpDecoderTests;
@@ -0,0 +1,434 @@
+/*
+  ==============================================================================
+
+    Standalone application. Behaves like JUCE's default StandaloneFilterApp
+    unless one of the headless modes is requested on the command line:
+
+        --serve=<socket path> [--threads=N] [--keys=N]
+            Runs the key-detection service on a Unix domain socket until
+            SIGINT/SIGTERM. Linux and macOS only.
+
+        --loadgen=<socket path> [--connections=N] [--requests=N] [--depth=N]
+            Benchmarks a running service and prints throughput and latency.
+            Linux and macOS only.
+
+        --replay=<journal> [--repeat=N]
+            Feeds a recorded session journal through the processor as fast as
+            possible and prints the timing and analysis fingerprint. Fails if
+            the analysis diverges from the fingerprints recorded live, and with
+            --repeat, if any pass produces a different fingerprint.
+
+        --stress [--stall=ms] [--seconds=s]
+            Overloads the processor's MIDI queue from a simulated host thread,
+            checks overflow accounting and recovery, and reports the highest
+            lossless event rate.
+
+        --scanbench [--events=N]
+            Times MidiQueue's raw-byte scanner against the old per-MidiMessage
+            path, push and pop together, for block sizes from 32 to 4096
+            samples.
+
+        --umpbench [--events=N]
+            Times MIDI 2.0 packet decoding and analysis against the MIDI 1.0
+            path for the same events, for block sizes from 32 to 4096 samples.
+
+        --evaluate=<directory> [--labels=file] [--threads=N]
+            Runs every MIDI file under the directory through a grid of
+            analysis settings and reports accuracy, MIREX score and time per
+            file against the known keys (from the labels file, or the files'
+            key signatures).
+
+        --footprint [--instances=N]
+            Creates N processors, plays each a minute of MIDI and prints the
+            bytes each instance holds, part by part.
+
+        --stream[=<file or named pipe>] [--window=s] [--hold=N] [--ump]
+            Reads raw MIDI bytes from stdin (or the file or pipe) and writes a
+            JSON line to stdout whenever the key over the last s seconds
+            changes and has held for N note-ons. Latencies are summarised on
+            stderr when the stream ends. With --ump the bytes are Universal
+            MIDI Packets (big-endian words) rather than MIDI 1.0. Linux and
+            macOS only.
+
+        --synthstream [--seconds=s] [--ump]
+            Plays a synthetic performance to stdout as raw MIDI in real time,
+            s seconds per key, for piping into --stream. Linux and macOS only.
+
+        --selftest
+            Runs the analysis unit tests and fails if any of them do.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <csignal>
+#include <iostream>
+
+#include <juce_audio_plugin_client/Standalone/juce_StandaloneFilterWindow.h>
+
+#if JUCE_LINUX || JUCE_MAC
+ #include "KeyDetectionLoadGenerator.h"
+ #include "MidiKeyStream.h"
+#endif
+
+#include "SessionJournalReplay.h"
+#include "MidiStressHarness.h"
+#include "MidiScanBenchmark.h"
+#include "UmpBenchmark.h"
+#include "KeyEvaluationHarness.h"
+#include "InstanceFootprint.h"
+#include "AnalysisTests.h"
+
+class AutoKeyStandaloneApp  : public JUCEApplication,
+                              private Timer
+{
+public:
+    AutoKeyStandaloneApp()
+    {
+        PluginHostType::jucePlugInClientCurrentWrapperType = AudioProcessor::wrapperType_Standalone;
+
+        PropertiesFile::Options options;
+
+        options.applicationName     = getApplicationName();
+        options.filenameSuffix      = ".settings";
+        options.osxLibrarySubFolder = "Application Support";
+       #if JUCE_LINUX
+        options.folderName          = "~/.config";
+       #else
+        options.folderName          = "";
+       #endif
+
+        appProperties.setStorageParameters (options);
+    }
+
+    const String getApplicationName() override              { return JucePlugin_Name; }
+    const String getApplicationVersion() override           { return JucePlugin_VersionString; }
+    bool moreThanOneInstanceAllowed() override              { return true; }
+    void anotherInstanceStarted (const String&) override    {}
+
+    void initialise (const String& commandLine) override
+    {
+        const ArgumentList args (getApplicationName(), StringArray::fromTokens (commandLine, true));
+
+       #if JUCE_LINUX || JUCE_MAC
+        if (args.containsOption ("--serve"))
+        {
+            startServer (args);
+            return;
+        }
+
+        if (args.containsOption ("--loadgen"))
+        {
+            runLoadGenerator (args);
+            return;
+        }
+       #endif
+
+        if (args.containsOption ("--replay"))
+        {
+            runReplay (args);
+            return;
+        }
+
+        if (args.containsOption ("--stress"))
+        {
+            runStressHarness (args);
+            return;
+        }
+
+        if (args.containsOption ("--scanbench"))
+        {
+            const auto report = MidiScanBenchmark::run (jmax (1, getIntOption (args, "--events", 2000000)));
+            std::cout << report.toString() << std::endl;
+            quit();
+            return;
+        }
+
+        if (args.containsOption ("--umpbench"))
+        {
+            const auto report = UmpBenchmark::run (jmax (1, getIntOption (args, "--events", 2000000)));
+            std::cout << report.toString() << std::endl;
+            quit();
+            return;
+        }
+
+        if (args.containsOption ("--evaluate"))
+        {
+            runEvaluation (args);
+            return;
+        }
+
+        if (args.containsOption ("--footprint"))
+        {
+            InstanceFootprint::Options options;
+            options.numInstances = jmax (1, getIntOption (args, "--instances", options.numInstances));
+
+            const auto report = InstanceFootprint::run (options);
+            std::cout << report.toString() << std::endl;
+            quit();
+            return;
+        }
+
+       #if JUCE_LINUX || JUCE_MAC
+        if (args.containsOption ("--stream"))
+        {
+            runStream (args);
+            return;
+        }
+
+        if (args.containsOption ("--synthstream"))
+        {
+            catchQuitSignals();
+            MidiKeyStream::writeSyntheticStream (jmax (1, getIntOption (args, "--seconds", 20)), [] { return quitRequested != 0; },
+                                                 args.containsOption ("--ump"));
+            quit();
+            return;
+        }
+       #endif
+
+        if (args.containsOption ("--selftest"))
+        {
+            runSelfTest();
+            return;
+        }
+
+        mainWindow.reset (createWindow());
+        mainWindow->setVisible (true);
+    }
+
+    void shutdown() override
+    {
+        stopTimer();
+       #if JUCE_LINUX || JUCE_MAC
+        server = nullptr;
+       #endif
+        mainWindow = nullptr;
+        appProperties.saveIfNeeded();
+    }
+
+    void systemRequestedQuit() override
+    {
+        if (mainWindow != nullptr)
+            mainWindow->pluginHolder->savePluginState();
+
+        if (ModalComponentManager::getInstance()->cancelAllModalComponents())
+        {
+            Timer::callAfterDelay (100, []
+            {
+                if (auto app = JUCEApplicationBase::getInstance())
+                    app->systemRequestedQuit();
+            });
+        }
+        else
+        {
+            quit();
+        }
+    }
+
+private:
+    StandaloneFilterWindow* createWindow()
+    {
+       #ifdef JucePlugin_PreferredChannelConfigurations
+        StandalonePluginHolder::PluginInOuts channels[] = { JucePlugin_PreferredChannelConfigurations };
+       #endif
+
+        return new StandaloneFilterWindow (getApplicationName(),
+                                           LookAndFeel::getDefaultLookAndFeel().findColour (ResizableWindow::backgroundColourId),
+                                           appProperties.getUserSettings(),
+                                           false, {}, nullptr
+                                          #ifdef JucePlugin_PreferredChannelConfigurations
+                                           , juce::Array<StandalonePluginHolder::PluginInOuts> (channels, juce::numElementsInArray (channels))
+                                          #else
+                                           , {}
+                                          #endif
+                                          #if JUCE_DONT_AUTO_OPEN_MIDI_DEVICES_ON_MOBILE
+                                           , false
+                                          #endif
+                                           );
+    }
+
+    static int getIntOption (const ArgumentList& args, StringRef option, int defaultValue)
+    {
+        const auto value = args.getValueForOption (option);
+        return value.isNotEmpty() ? value.getIntValue() : defaultValue;
+    }
+
+   #if JUCE_LINUX || JUCE_MAC
+    void startServer (const ArgumentList& args)
+    {
+        server = std::make_unique<KeyDetectionServer> (getIntOption (args, "--threads", SystemStats::getNumCpus()),
+                                                       getIntOption (args, "--keys", 3));
+
+        const auto path = args.getValueForOption ("--serve");
+        const auto result = server->start (path);
+
+        if (result.failed())
+        {
+            std::cerr << result.getErrorMessage() << std::endl;
+            setApplicationReturnValue (1);
+            quit();
+            return;
+        }
+
+        std::cout << "Serving key detection on " << path << std::endl;
+
+        catchQuitSignals();
+        startTimer (250);
+    }
+   #endif
+
+    static void catchQuitSignals()
+    {
+        std::signal (SIGINT,  [] (int) { quitRequested = 1; });
+        std::signal (SIGTERM, [] (int) { quitRequested = 1; });
+    }
+
+   #if JUCE_LINUX || JUCE_MAC
+    void runStream (const ArgumentList& args)
+    {
+        MidiKeyStream::Options options;
+        const auto path = args.getValueForOption ("--stream");
+
+        if (path.isNotEmpty() && path != "-")
+            options.path = File::getCurrentWorkingDirectory().getChildFile (path).getFullPathName();
+
+        const auto window = args.getValueForOption ("--window");
+
+        if (window.isNotEmpty())
+            options.windowSeconds = jmax (0.0, window.getDoubleValue());
+
+        options.holdNotes = jmax (1, getIntOption (args, "--hold", options.holdNotes));
+        options.ump = args.containsOption ("--ump");
+
+        catchQuitSignals();
+        options.shouldStop = [] { return quitRequested != 0; };
+
+        const auto report = MidiKeyStream::run (options);
+        std::cerr << report.toString() << std::endl;
+
+        setApplicationReturnValue (report.failure.isEmpty() ? 0 : 1);
+        quit();
+    }
+
+    void runLoadGenerator (const ArgumentList& args)
+    {
+        KeyDetectionLoadGenerator::Options options;
+        options.socketPath            = args.getValueForOption ("--loadgen");
+        options.numConnections        = getIntOption (args, "--connections", options.numConnections);
+        options.requestsPerConnection = getIntOption (args, "--requests", options.requestsPerConnection);
+        options.pipelineDepth         = getIntOption (args, "--depth", options.pipelineDepth);
+
+        const auto report = KeyDetectionLoadGenerator::run (options);
+        std::cout << report.toString() << std::endl;
+
+        setApplicationReturnValue (report.failure.isEmpty() ? 0 : 1);
+        quit();
+    }
+   #endif
+
+    void runReplay (const ArgumentList& args)
+    {
+        SessionJournal::Reader reader (File::getCurrentWorkingDirectory().getChildFile (args.getValueForOption ("--replay")));
+        MidiLoggerPluginDemoProcessor processor;
+        int exitCode = 0;
+        uint64 firstFingerprint = 0;
+
+        for (int pass = 0; pass < jmax (1, getIntOption (args, "--repeat", 1)); ++pass)
+        {
+            const auto report = SessionJournalReplay::run (processor, reader);
+            std::cout << report.toString() << std::endl;
+
+            if (report.failure.isNotEmpty())
+            {
+                exitCode = 1;
+                break;
+            }
+
+            if (report.numDiverged > 0)
+                exitCode = 1;
+
+            if (pass == 0)
+                firstFingerprint = report.fingerprint;
+
+            if (report.fingerprint != firstFingerprint)
+            {
+                std::cerr << "Pass " << pass + 1 << " diverged from the first pass" << std::endl;
+                exitCode = 1;
+            }
+        }
+
+        setApplicationReturnValue (exitCode);
+        quit();
+    }
+
+    void runStressHarness (const ArgumentList& args)
+    {
+        MidiStressHarness::Options options;
+        options.stallMs = getIntOption (args, "--stall", options.stallMs);
+
+        const auto seconds = args.getValueForOption ("--seconds");
+
+        if (seconds.isNotEmpty())
+            options.secondsPerPhase = jmax (0.1, seconds.getDoubleValue());
+
+        const auto report = MidiStressHarness::run (options);
+        std::cout << report.toString() << std::endl;
+
+        setApplicationReturnValue (report.passed ? 0 : 1);
+        quit();
+    }
+
+    void runSelfTest()
+    {
+        UnitTestRunner runner;
+        runner.runTestsInCategory ("AutoKey");
+
+        int numFailures = 0;
+
+        for (int i = 0; i < runner.getNumResults(); ++i)
+            numFailures += runner.getResult (i)->failures;
+
+        setApplicationReturnValue (numFailures > 0 ? 1 : 0);
+        quit();
+    }
+
+    void runEvaluation (const ArgumentList& args)
+    {
+        KeyEvaluationHarness::Options options;
+        options.directory  = File::getCurrentWorkingDirectory().getChildFile (args.getValueForOption ("--evaluate"));
+        options.numThreads = getIntOption (args, "--threads", options.numThreads);
+
+        const auto labels = args.getValueForOption ("--labels");
+
+        if (labels.isNotEmpty())
+            options.labels = File::getCurrentWorkingDirectory().getChildFile (labels);
+
+        const auto report = KeyEvaluationHarness::run (options);
+        std::cout << report.toString() << std::endl;
+
+        setApplicationReturnValue (report.failure.isEmpty() ? 0 : 1);
+        quit();
+    }
+
+    void timerCallback() override
+    {
+        if (quitRequested != 0)
+        {
+           #if JUCE_LINUX || JUCE_MAC
+            std::cout << server->getNumRequestsServed() << " requests served on "
+                      << server->getNumConnectionsAccepted() << " connections" << std::endl;
+           #endif
+            quit();
+        }
+    }
+
+    static inline volatile std::sig_atomic_t quitRequested = 0;
+
+    ApplicationProperties appProperties;
+    std::unique_ptr<StandaloneFilterWindow> mainWindow;
+
+   #if JUCE_LINUX || JUCE_MAC
+    std::unique_ptr<KeyDetectionServer> server;
+   #endif
+};
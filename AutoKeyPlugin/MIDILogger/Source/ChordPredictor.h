@@ -0,0 +1,312 @@
+/*
+  ==============================================================================
+
+    Suggests the chords most likely to come next, learning from the session
+    as it's played.
+
+    A chord is reduced to a state: its root relative to the key and the
+    family of its quality (major, minor, dominant seventh, ...). Minor keys
+    are measured from their relative major, so i-iv-V-i in A minor and
+    vi-ii-III-vi in C major fall in the same cells and both modes share one
+    table. With 12 x 8 states a transition table is 96 x 96 counts, indexed
+    by (previous state, next state). There are two:
+
+      - a prior from common-practice harmony, built at compile time and
+        shared by every instance
+      - the session's own counts, 16 bits each. Each chord change is one
+        increment; a row is halved when a count would overflow, so recent
+        playing keeps its say.
+
+    suggest() scores the states that can follow the current one (session
+    count plus the prior, as priorStrength pseudo-counts) and partial-sorts
+    them in a fixed-size array. Nothing allocates. Message thread only.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <array>
+
+class ChordPredictor
+{
+public:
+    enum Family : uint8
+    {
+        majorFamily = 0,
+        minorFamily,
+        dominantFamily,
+        major7Family,
+        minor7Family,
+        diminishedFamily,
+        augmentedFamily,
+        suspendedFamily,
+        numFamilies
+    };
+
+    static constexpr int numStates = 12 * numFamilies;
+    static constexpr int numCells = numStates * numStates;
+    static constexpr float priorStrength = 4.0f;
+
+    struct Suggestion
+    {
+        int chordId;            // ChordTable id, with the family's plainest quality
+        float probability;
+    };
+
+    /** Records that toChordId followed fromChordId, in the given key. */
+    void learn (int fromChordId, int toChordId, int tonic, bool minor)
+    {
+        const auto from = toState (fromChordId, tonic, minor);
+        const auto to = toState (toChordId, tonic, minor);
+
+        if (from < 0 || to < 0 || from == to)
+            return;
+
+        if (counts[(size_t) (from * numStates + to)] == 0xffff)
+            halveRow (from);
+
+        increment (from * numStates + to, 1);
+    }
+
+    /** Writes up to maxResults likely successors of chordId into results, best first, and
+        returns how many were written.
+    */
+    int suggest (int chordId, int tonic, bool minor, Suggestion* results, int maxResults) const
+    {
+        const auto from = toState (chordId, tonic, minor);
+
+        if (from < 0 || maxResults <= 0)
+            return 0;
+
+        const auto& prior = getPrior();
+        const auto priorTotal = (float) prior.rowTotals[(size_t) from];
+        const auto total = (float) rowTotals[(size_t) from] + (priorTotal > 0.0f ? priorStrength : 0.0f);
+
+        if (total <= 0.0f)
+            return 0;
+
+        std::array<Suggestion, numStates> scored;
+        int numScored = 0;
+
+        for (int to = 0; to < numStates; ++to)
+        {
+            const auto cell = (size_t) (from * numStates + to);
+            const auto weight = (float) counts[cell]
+                              + (priorTotal > 0.0f ? priorStrength * (float) prior.counts[cell] / priorTotal : 0.0f);
+
+            if (weight > 0.0f)
+                scored[(size_t) numScored++] = { toChordId (to, tonic, minor), weight / total };
+        }
+
+        const auto num = jmin (maxResults, numScored);
+        std::partial_sort (scored.begin(), scored.begin() + num, scored.begin() + numScored,
+                           [] (const Suggestion& a, const Suggestion& b) { return a.probability > b.probability; });
+        std::copy (scored.begin(), scored.begin() + num, results);
+        return num;
+    }
+
+    void clear()
+    {
+        counts.fill (0);
+        rowTotals.fill (0);
+        numNonZero = 0;
+    }
+
+    //==============================================================================
+    /** For saving: calls fn (int cell, int count) for every learned cell, in cell order. */
+    template <typename Fn>
+    void forEachCount (Fn&& fn) const
+    {
+        for (int cell = 0; cell < numCells; ++cell)
+        {
+            if (counts[(size_t) cell] != 0)
+                fn (cell, (int) counts[(size_t) cell]);
+        }
+    }
+
+    int getNumCounts() const    { return numNonZero; }
+
+    /** For loading: sets one cell, as passed to forEachCount(). Out-of-range cells are ignored. */
+    void restore (int cell, int count)
+    {
+        if (! isPositiveAndBelow (cell, numCells))
+            return;
+
+        increment (cell, jlimit (0, 0xffff, count) - (int) counts[(size_t) cell]);
+    }
+
+    //==============================================================================
+    static Family getFamily (int quality) noexcept
+    {
+        static constexpr std::array<Family, ChordTable::numQualities> families
+        {
+            majorFamily,        // major
+            minorFamily,        // minor
+            dominantFamily,     // dominant7
+            major7Family,       // major7
+            minor7Family,       // minor7
+            diminishedFamily,   // diminished
+            augmentedFamily,    // augmented
+            diminishedFamily,   // halfDiminished7
+            diminishedFamily,   // diminished7
+            suspendedFamily,    // suspended4
+            suspendedFamily,    // suspended2
+            dominantFamily,     // dominant7sus4
+            minorFamily,        // minorMajor7
+            majorFamily,        // major6
+            minorFamily,        // minor6
+            majorFamily,        // add9
+            minorFamily,        // minorAdd9
+            dominantFamily,     // dominant9
+            major7Family,       // major9
+            minor7Family,       // minor9
+            dominantFamily,     // dominant7flat9
+            dominantFamily,     // dominant7sharp9
+            dominantFamily,     // dominant11
+            minor7Family,       // minor11
+            dominantFamily,     // dominant13
+            dominantFamily,     // dominant7no5
+            major7Family,       // major7no5
+            minor7Family,       // minor7no5
+            dominantFamily,     // dominant9no5
+            majorFamily         // power5
+        };
+
+        return families[(size_t) quality];
+    }
+
+private:
+    // Degrees are semitones above the major tonic (the relative major, in minor keys).
+    static int getReference (int tonic, bool minor) noexcept     { return (tonic + (minor ? 3 : 0)) % 12; }
+
+    static int toState (int chordId, int tonic, bool minor) noexcept
+    {
+        if (! isPositiveAndBelow (chordId, ChordTable::numChordIds) || tonic < 0)
+            return -1;
+
+        const auto root = chordId / ChordTable::numQualities;
+        const auto degree = (root + 12 - getReference (tonic, minor)) % 12;
+        return degree * numFamilies + getFamily (chordId % ChordTable::numQualities);
+    }
+
+    static int toChordId (int state, int tonic, bool minor) noexcept
+    {
+        static constexpr std::array<ChordTable::Quality, numFamilies> plainest
+        {
+            ChordTable::major, ChordTable::minor, ChordTable::dominant7, ChordTable::major7,
+            ChordTable::minor7, ChordTable::diminished, ChordTable::augmented, ChordTable::suspended4
+        };
+
+        const auto root = (state / numFamilies + getReference (tonic, minor)) % 12;
+        return root * ChordTable::numQualities + plainest[(size_t) (state % numFamilies)];
+    }
+
+    void increment (int cell, int amount)
+    {
+        auto& count = counts[(size_t) cell];
+        numNonZero += (count == 0 && amount > 0 ? 1 : 0) - (count > 0 && count + amount == 0 ? 1 : 0);
+        count = (uint16) (count + amount);
+        rowTotals[(size_t) (cell / numStates)] += (uint32) amount;
+    }
+
+    void halveRow (int from)
+    {
+        for (int to = 0; to < numStates; ++to)
+        {
+            const auto cell = from * numStates + to;
+            increment (cell, -(int) (counts[(size_t) cell] - counts[(size_t) cell] / 2));
+        }
+    }
+
+    //==============================================================================
+    struct Prior
+    {
+        std::array<uint8, numCells> counts {};
+        std::array<uint16, numStates> rowTotals {};
+    };
+
+    struct Rule
+    {
+        int fromDegree;
+        Family fromFamily;
+        int toDegree;
+        Family toFamily;
+        int weight;
+    };
+
+    static const Prior& getPrior()
+    {
+        static constexpr Prior prior = []
+        {
+            // Degrees above the major tonic; the minor key's i is at 9.
+            constexpr Rule rules[] =
+            {
+                // Major keys
+                { 0, majorFamily, 5, majorFamily, 3 },      { 0, majorFamily, 7, majorFamily, 3 },
+                { 0, majorFamily, 9, minorFamily, 2 },      { 0, majorFamily, 2, minorFamily, 2 },
+                { 0, majorFamily, 7, dominantFamily, 2 },   { 0, majorFamily, 4, minorFamily, 1 },
+                { 2, minorFamily, 7, majorFamily, 3 },      { 2, minorFamily, 7, dominantFamily, 4 },
+                { 2, minorFamily, 5, majorFamily, 1 },      { 2, minorFamily, 11, diminishedFamily, 1 },
+                { 2, minor7Family, 7, dominantFamily, 5 },  { 2, minor7Family, 7, majorFamily, 2 },
+                { 2, minor7Family, 0, major7Family, 1 },
+                { 4, minorFamily, 9, minorFamily, 3 },      { 4, minorFamily, 5, majorFamily, 2 },
+                { 4, minor7Family, 9, minor7Family, 3 },    { 4, minor7Family, 9, minorFamily, 1 },
+                { 5, majorFamily, 7, majorFamily, 3 },      { 5, majorFamily, 0, majorFamily, 3 },
+                { 5, majorFamily, 7, dominantFamily, 2 },   { 5, majorFamily, 2, minorFamily, 1 },
+                { 7, majorFamily, 0, majorFamily, 4 },      { 7, majorFamily, 9, minorFamily, 2 },
+                { 7, majorFamily, 5, majorFamily, 1 },
+                { 7, dominantFamily, 0, majorFamily, 5 },   { 7, dominantFamily, 9, minorFamily, 2 },
+                { 7, dominantFamily, 0, major7Family, 1 },
+                { 9, minorFamily, 2, minorFamily, 2 },      { 9, minorFamily, 5, majorFamily, 3 },
+                { 9, minorFamily, 7, majorFamily, 2 },      { 9, minorFamily, 4, minorFamily, 1 },
+                { 9, minor7Family, 2, minor7Family, 3 },    { 9, minor7Family, 5, major7Family, 1 },
+                { 11, diminishedFamily, 0, majorFamily, 4 },    { 11, diminishedFamily, 9, minorFamily, 1 },
+                { 0, major7Family, 2, minor7Family, 2 },    { 0, major7Family, 5, major7Family, 2 },
+                { 0, major7Family, 9, minor7Family, 2 },
+                { 5, major7Family, 4, minor7Family, 2 },    { 5, major7Family, 7, dominantFamily, 2 },
+                { 5, major7Family, 0, major7Family, 2 },
+
+                // Secondary dominants
+                { 0, dominantFamily, 5, majorFamily, 3 },   { 2, dominantFamily, 7, majorFamily, 2 },
+                { 2, dominantFamily, 7, dominantFamily, 2 },    { 9, dominantFamily, 2, minorFamily, 3 },
+                { 9, dominantFamily, 2, minor7Family, 1 },  { 11, dominantFamily, 4, minorFamily, 3 },
+
+                // Minor keys: i iv V VI VII III and the leading-tone diminished
+                { 9, minorFamily, 4, majorFamily, 3 },      { 9, minorFamily, 4, dominantFamily, 2 },
+                { 2, minorFamily, 4, majorFamily, 3 },      { 2, minorFamily, 4, dominantFamily, 3 },
+                { 2, minorFamily, 9, minorFamily, 2 },
+                { 4, majorFamily, 9, minorFamily, 5 },      { 4, majorFamily, 5, majorFamily, 2 },
+                { 4, dominantFamily, 9, minorFamily, 5 },   { 4, dominantFamily, 5, majorFamily, 1 },
+                { 5, majorFamily, 4, majorFamily, 1 },
+                { 7, majorFamily, 9, minorFamily, 1 },
+                { 11, diminishedFamily, 4, majorFamily, 2 },    { 11, diminishedFamily, 4, dominantFamily, 2 },
+                { 8, diminishedFamily, 9, minorFamily, 4 },
+
+                // Suspensions and augmented chords resolving
+                { 7, suspendedFamily, 7, majorFamily, 3 },  { 7, suspendedFamily, 7, dominantFamily, 2 },
+                { 0, suspendedFamily, 0, majorFamily, 3 },
+                { 0, augmentedFamily, 5, majorFamily, 2 },  { 0, augmentedFamily, 9, minorFamily, 1 },
+                { 7, augmentedFamily, 0, majorFamily, 3 }
+            };
+
+            Prior p;
+
+            for (const auto& rule : rules)
+            {
+                const auto from = rule.fromDegree * numFamilies + rule.fromFamily;
+                const auto to = rule.toDegree * numFamilies + rule.toFamily;
+                p.counts[(size_t) (from * numStates + to)] = (uint8) (p.counts[(size_t) (from * numStates + to)] + rule.weight);
+                p.rowTotals[(size_t) from] = (uint16) (p.rowTotals[(size_t) from] + rule.weight);
+            }
+
+            return p;
+        }();
+
+        return prior;
+    }
+
+    std::array<uint16, numCells> counts {};
+    std::array<uint32, numStates> rowTotals {};
+    int numNonZero = 0;
+};
@@ -0,0 +1,181 @@
+/*
+  ==============================================================================
+
+    The sequence of chords played so far, labelled as Roman numerals relative
+    to the detected key.
+
+    Chords are appended as (position, chord id) pairs and never rewritten
+    (only the last one can be taken back while it is still being played), so
+    when the key estimate moves the labels are rebuilt with one pass over the
+    chord ids - nothing is re-analysed. Message thread only.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "ChordTable.h"
+
+class ChordProgression
+{
+public:
+    /** Appends the chord if it differs from the last one. Invalid chords are ignored.
+        Returns true if it was appended.
+    */
+    bool add (uint32 position, const ChordTable::Chord& chord)
+    {
+        if (! chord.isValid())
+            return false;
+
+        const auto id = (uint16) chord.getId();
+
+        if (! chordIds.empty() && chordIds.back() == id)
+            return false;
+
+        positions.push_back (position);
+        chordIds.push_back (id);
+        relativeIds.push_back (toRelative (id));
+        ++version;
+        return true;
+    }
+
+    /** Takes back the last chord, for one that turned out to be part of a bigger one. */
+    void removeLast()
+    {
+        if (chordIds.empty())
+            return;
+
+        positions.pop_back();
+        chordIds.pop_back();
+        relativeIds.pop_back();
+        ++version;
+    }
+
+    /** Re-labels every chord against a new key. Does nothing if the key is unchanged. */
+    void setKey (int tonicPitchClass, bool isMinor)
+    {
+        if (tonicPitchClass == tonic && isMinor == minor)
+            return;
+
+        tonic = tonicPitchClass;
+        minor = isMinor;
+
+        for (size_t i = 0; i < chordIds.size(); ++i)
+            relativeIds[i] = toRelative (chordIds[i]);
+
+        ++version;
+    }
+
+    void clear()
+    {
+        positions.clear();
+        chordIds.clear();
+        relativeIds.clear();
+        tonic = -1;
+        ++version;
+    }
+
+    int size() const                        { return (int) chordIds.size(); }
+    bool hasKey() const                     { return tonic >= 0; }
+    int getTonic() const                    { return tonic; }
+    bool isMinorKey() const                 { return minor; }
+
+    /** Bytes allocated for the chords, outside sizeof (ChordProgression). */
+    size_t getMemoryUsed() const
+    {
+        return positions.capacity() * sizeof (uint32)
+                 + (chordIds.capacity() + relativeIds.capacity()) * sizeof (uint16);
+    }
+
+    /** Changes whenever something that is displayed changes. */
+    uint32 getVersion() const               { return version; }
+
+    /** Number of note-ons analysed before the chord started. */
+    uint32 getPosition (int index) const    { return positions[(size_t) index]; }
+    int getChordId (int index) const        { return chordIds[(size_t) index]; }
+
+    String getChordName (int index) const
+    {
+        return String (ChordTable::getName (ChordTable::fromId (chordIds[(size_t) index])));
+    }
+
+    /** e.g. "V7", "vi", "bVII", or an empty string before a key has been set. */
+    const String& getNumeral (int index) const
+    {
+        static const String none;
+        return hasKey() ? getNumeralName (relativeIds[(size_t) index], minor) : none;
+    }
+
+    /** The numeral any chord id would have in the current key. */
+    const String& getNumeralForChord (int chordId) const
+    {
+        static const String none;
+        return hasKey() && isPositiveAndBelow (chordId, ChordTable::numChordIds) ? getNumeralName (toRelative ((uint16) chordId), minor) : none;
+    }
+
+private:
+    // The chord id with the root measured from the tonic instead of from C.
+    uint16 toRelative (uint16 id) const
+    {
+        const auto root = id / ChordTable::numQualities;
+        const auto quality = id % ChordTable::numQualities;
+        return (uint16) (((root + 12 - jmax (0, tonic)) % 12) * ChordTable::numQualities + quality);
+    }
+
+    static const String& getNumeralName (int relativeId, bool minorKey)
+    {
+        static const auto names = []
+        {
+            std::array<std::array<String, ChordTable::numChordIds>, 2> n;
+
+            for (int id = 0; id < ChordTable::numChordIds; ++id)
+            {
+                n[0][(size_t) id] = makeNumeral (id / ChordTable::numQualities, id % ChordTable::numQualities, false);
+                n[1][(size_t) id] = makeNumeral (id / ChordTable::numQualities, id % ChordTable::numQualities, true);
+            }
+
+            return n;
+        }();
+
+        return names[minorKey ? 1 : 0][(size_t) relativeId];
+    }
+
+    static String makeNumeral (int degree, int quality, bool minorKey)
+    {
+        // Accidentals are relative to the key's own scale (natural minor for minor keys).
+        static const char* const majorDegrees[] = { "I", "bII", "II", "bIII", "III", "IV", "#IV", "V", "bVI", "VI", "bVII", "VII" };
+        static const char* const minorDegrees[] = { "I", "bII", "II", "III", "#III", "IV", "#IV", "V", "VI", "#VI", "VII", "#VII" };
+
+        const auto& t = ChordTable::getTemplate ((ChordTable::Quality) quality);
+        const auto hasMinorThird = (t.intervals & (1 << 3)) != 0 && (t.intervals & (1 << 4)) == 0;
+
+        String numeral ((minorKey ? minorDegrees : majorDegrees)[degree]);
+
+        if (hasMinorThird)
+            numeral = numeral.toLowerCase();
+
+        switch (quality)
+        {
+            case ChordTable::augmented:         return numeral + "+";
+            case ChordTable::diminished:        return numeral + String (CharPointer_UTF8 ("\xc2\xb0"));
+            case ChordTable::diminished7:       return numeral + String (CharPointer_UTF8 ("\xc2\xb0" "7"));
+            case ChordTable::halfDiminished7:   return numeral + String (CharPointer_UTF8 ("\xc3\xb8" "7"));
+            default:                            break;
+        }
+
+        // The case of the numeral already says minor: vi7, not vim7.
+        String suffix (t.suffix);
+
+        if (hasMinorThird && suffix.startsWith ("m") && ! suffix.startsWith ("maj"))
+            suffix = suffix.substring (1);
+
+        return numeral + suffix;
+    }
+
+    std::vector<uint32> positions;
+    std::vector<uint16> chordIds;
+    std::vector<uint16> relativeIds;    // parallel to chordIds, rebuilt by setKey()
+    int tonic = -1;
+    bool minor = false;
+    uint32 version = 0;
+};
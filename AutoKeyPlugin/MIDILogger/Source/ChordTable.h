@@ -0,0 +1,236 @@
+/*
+  ==============================================================================
+
+    Chord recognition by table lookup.
+
+    Every possible set of held pitch classes is a 12-bit mask, so all 4096 of
+    them are matched against the chord templates once, up front. Recognising
+    the chord under the fingers is then one table lookup plus a check of which
+    candidate root (if any) is in the bass.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+
+namespace ChordTable
+{
+    // In order of preference: when one pitch-class set spells several chords
+    // (C6 = Am7, any dim7, any aug) the earlier quality wins unless the bass
+    // note picks out another candidate's root.
+    enum Quality : uint8_t
+    {
+        major, minor, dominant7, major7, minor7, diminished, augmented, halfDiminished7,
+        diminished7, suspended4, suspended2, dominant7sus4, minorMajor7, major6, minor6,
+        add9, minorAdd9, dominant9, major9, minor9, dominant7flat9, dominant7sharp9,
+        dominant11, minor11, dominant13, dominant7no5, major7no5, minor7no5, dominant9no5,
+        power5,
+        numQualities
+    };
+
+    struct Template
+    {
+        uint16_t intervals;     // bit n set = n semitones above the root
+        const char* suffix;
+    };
+
+    constexpr uint16_t bits (std::initializer_list<int> intervals)
+    {
+        uint16_t mask = 0;
+
+        for (auto i : intervals)
+            mask = (uint16_t) (mask | (1u << i));
+
+        return mask;
+    }
+
+    inline const Template& getTemplate (Quality q)
+    {
+        static const Template templates[numQualities] =
+        {
+            { bits ({ 0, 4, 7 }),               "" },
+            { bits ({ 0, 3, 7 }),               "m" },
+            { bits ({ 0, 4, 7, 10 }),           "7" },
+            { bits ({ 0, 4, 7, 11 }),           "maj7" },
+            { bits ({ 0, 3, 7, 10 }),           "m7" },
+            { bits ({ 0, 3, 6 }),               "dim" },
+            { bits ({ 0, 4, 8 }),               "aug" },
+            { bits ({ 0, 3, 6, 10 }),           "m7b5" },
+            { bits ({ 0, 3, 6, 9 }),            "dim7" },
+            { bits ({ 0, 5, 7 }),               "sus4" },
+            { bits ({ 0, 2, 7 }),               "sus2" },
+            { bits ({ 0, 5, 7, 10 }),           "7sus4" },
+            { bits ({ 0, 3, 7, 11 }),           "mMaj7" },
+            { bits ({ 0, 4, 7, 9 }),            "6" },
+            { bits ({ 0, 3, 7, 9 }),            "m6" },
+            { bits ({ 0, 2, 4, 7 }),            "add9" },
+            { bits ({ 0, 2, 3, 7 }),            "madd9" },
+            { bits ({ 0, 2, 4, 7, 10 }),        "9" },
+            { bits ({ 0, 2, 4, 7, 11 }),        "maj9" },
+            { bits ({ 0, 2, 3, 7, 10 }),        "m9" },
+            { bits ({ 0, 1, 4, 7, 10 }),        "7b9" },
+            { bits ({ 0, 3, 4, 7, 10 }),        "7#9" },
+            { bits ({ 0, 2, 4, 5, 7, 10 }),     "11" },
+            { bits ({ 0, 2, 3, 5, 7, 10 }),     "m11" },
+            { bits ({ 0, 2, 4, 7, 9, 10 }),     "13" },
+            { bits ({ 0, 4, 10 }),              "7(no5)" },
+            { bits ({ 0, 4, 11 }),              "maj7(no5)" },
+            { bits ({ 0, 3, 10 }),              "m7(no5)" },
+            { bits ({ 0, 2, 4, 10 }),           "9(no5)" },
+            { bits ({ 0, 7 }),                  "5" },
+        };
+
+        return templates[q];
+    }
+
+    /** A recognised chord. root and bass are pitch classes (0 = C). */
+    struct Chord
+    {
+        static constexpr uint8_t none = 0xff;
+
+        uint8_t root = none, quality = 0, bass = none;
+
+        bool isValid() const noexcept       { return root != none; }
+
+        /** Identifies root + quality (not the voicing) in [0, numChordIds). */
+        int getId() const noexcept          { return isValid() ? root * numQualities + quality : -1; }
+
+        /** 0 = root position, 1 = third in the bass, ... -1 = bass is not a chord tone. */
+        int getInversion() const noexcept
+        {
+            if (! isValid())
+                return -1;
+
+            const auto intervals = getTemplate ((Quality) quality).intervals;
+            const auto bassInterval = (bass + 12 - root) % 12;
+
+            if ((intervals & (1u << bassInterval)) == 0)
+                return -1;
+
+            int inversion = 0;
+
+            for (int i = 0; i < bassInterval; ++i)
+                inversion += (intervals >> i) & 1;
+
+            return inversion;
+        }
+
+        bool operator== (const Chord& other) const noexcept
+        {
+            return root == other.root && quality == other.quality && bass == other.bass;
+        }
+
+        bool operator!= (const Chord& other) const noexcept    { return ! operator== (other); }
+    };
+
+    static constexpr int numChordIds = 12 * numQualities;
+
+    /** The chord (in root position, with no bass) for an id from Chord::getId(). */
+    inline Chord fromId (int id) noexcept
+    {
+        Chord chord;
+
+        if (id >= 0 && id < numChordIds)
+        {
+            chord.root = (uint8_t) (id / numQualities);
+            chord.quality = (uint8_t) (id % numQualities);
+        }
+
+        return chord;
+    }
+
+    //==============================================================================
+    struct Entry
+    {
+        static constexpr int maxCandidates = 4;
+
+        // Best interpretation first; unused slots have root == Chord::none.
+        struct Candidate { uint8_t root, quality; } candidates[maxCandidates];
+    };
+
+    inline const std::array<Entry, 4096>& getTable()
+    {
+        static const auto table = []
+        {
+            std::array<Entry, 4096> t;
+
+            for (int mask = 0; mask < 4096; ++mask)
+            {
+                auto& entry = t[(size_t) mask];
+                int numFound = 0;
+
+                for (auto& c : entry.candidates)
+                    c = { Chord::none, 0 };
+
+                for (int q = 0; q < numQualities && numFound < Entry::maxCandidates; ++q)
+                {
+                    for (int root = 0; root < 12 && numFound < Entry::maxCandidates; ++root)
+                    {
+                        if ((mask & (1 << root)) == 0)
+                            continue;
+
+                        const auto relative = ((mask >> root) | (mask << (12 - root))) & 0xfff;
+
+                        if (relative == getTemplate ((Quality) q).intervals)
+                            entry.candidates[numFound++] = { (uint8_t) root, (uint8_t) q };
+                    }
+                }
+            }
+
+            return t;
+        }();
+
+        return table;
+    }
+
+    /** Names the chord for a set of held pitch classes with the given bass pitch class. */
+    inline Chord recognise (uint16_t pitchClassMask, int bassPitchClass) noexcept
+    {
+        const auto& entry = getTable()[pitchClassMask & 0xfff];
+        Chord chord;
+        chord.bass = (uint8_t) bassPitchClass;
+
+        for (const auto& c : entry.candidates)
+        {
+            if (c.root == bassPitchClass)
+            {
+                chord.root = c.root;
+                chord.quality = c.quality;
+                return chord;
+            }
+        }
+
+        chord.root = entry.candidates[0].root;
+        chord.quality = entry.candidates[0].quality;
+        return chord;
+    }
+
+    inline const char* getPitchClassName (int pitchClass)
+    {
+        static const char* const names[] = { "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B" };
+        return names[pitchClass % 12];
+    }
+
+    /** e.g. "Cmaj7", "Am/C", "G7/F" */
+    inline std::string getName (const Chord& chord)
+    {
+        if (! chord.isValid())
+            return {};
+
+        std::string name = getPitchClassName (chord.root);
+        name += getTemplate ((Quality) chord.quality).suffix;
+
+        if (chord.bass != Chord::none && chord.bass != chord.root)
+        {
+            name += '/';
+            name += getPitchClassName (chord.bass);
+        }
+
+        return name;
+    }
+}
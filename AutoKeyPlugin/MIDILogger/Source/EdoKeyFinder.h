@@ -0,0 +1,344 @@
+/*
+  ==============================================================================
+
+    Key detection in any equal division of the octave (EDO).
+
+    EdoScale<N> builds the major and minor scales of N-EDO at compile time
+    from the steps nearest to the 12-tone degrees (for 19, 31 and 53 that is
+    the usual meantone / Pythagorean diatonic), so scoring a key is a fixed
+    walk over seven rotated histogram entries with no tables to look up at
+    run time. MidiKeyFinder scores its 12-tone keys through EdoScale<12>.
+
+    EdoKeyFinder<N> maps each note-on to its nearest step, taking into
+    account the channel's pitch bend (per channel, so MPE works), pitch bend
+    ranges set with RPN 0 or an MPE configuration message, and MIDI Tuning
+    Standard retuning (single note, bulk dump and scale/octave messages).
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <variant>
+
+template <int Divisions>
+struct EdoScale
+{
+    static_assert (Divisions >= 5 && Divisions <= 64, "unsupported division of the octave");
+
+    static constexpr int divisions = Divisions;
+    static constexpr int numDegrees = 7;
+
+    /** The step nearest to a number of 12-tone semitones. */
+    static constexpr int stepForSemitones (int semitones)   { return (semitones * Divisions * 2 + 12) / 24; }
+
+    static constexpr std::array<int, numDegrees> makeDegrees (bool minor)
+    {
+        constexpr int majorSemitones[] = { 0, 2, 4, 5, 7, 9, 11 };
+        constexpr int minorSemitones[] = { 0, 2, 3, 5, 7, 8, 10 };
+
+        std::array<int, numDegrees> degrees {};
+
+        for (int i = 0; i < numDegrees; ++i)
+            degrees[(size_t) i] = stepForSemitones (minor ? minorSemitones[i] : majorSemitones[i]);
+
+        return degrees;
+    }
+
+    static constexpr std::array<int, numDegrees> majorDegrees = makeDegrees (false);
+    static constexpr std::array<int, numDegrees> minorDegrees = makeDegrees (true);
+    static constexpr int majorThird = stepForSemitones (4);
+    static constexpr int minorThird = stepForSemitones (3);
+    static constexpr int fifth = stepForSemitones (7);
+
+    /** Histogram weight on the scale of the key with this tonic (a step).
+
+        Summed from the lowest step up, whatever the tonic, so keys on the same steps
+        (a relative major and minor) get exactly the same weight and the tonic triad
+        decides between them. The steps past the octave come first.
+    */
+    template <typename Histogram>
+    static float getInScaleWeight (const Histogram& h, int tonic, bool minor) noexcept
+    {
+        const auto& degrees = minor ? minorDegrees : majorDegrees;
+        int firstWrapped = 0;
+
+        while (firstWrapped < numDegrees && tonic + degrees[(size_t) firstWrapped] < Divisions)
+            ++firstWrapped;
+
+        float weight = 0.0f;
+
+        for (int i = firstWrapped; i < numDegrees; ++i)
+            weight += h[(size_t) (tonic + degrees[(size_t) i] - Divisions)];
+
+        for (int i = 0; i < firstWrapped; ++i)
+            weight += h[(size_t) (tonic + degrees[(size_t) i])];
+
+        return weight;
+    }
+
+    /** Histogram weight on the tonic triad, which separates relative majors and minors. */
+    template <typename Histogram>
+    static float getTonicTriadWeight (const Histogram& h, int tonic, bool minor) noexcept
+    {
+        return h[(size_t) tonic]
+             + h[(size_t) wrap (tonic + (minor ? minorThird : majorThird))]
+             + h[(size_t) wrap (tonic + fifth)];
+    }
+
+    static constexpr int wrap (int step) noexcept     { return step >= Divisions ? step - Divisions : step; }
+};
+
+//==============================================================================
+template <int Divisions>
+class EdoKeyFinder
+{
+public:
+    using Scale = EdoScale<Divisions>;
+    using Histogram = std::array<float, Divisions>;
+
+    static constexpr int numKeys = 2 * Divisions;
+
+    struct RankedKey
+    {
+        int tonic;              // step above C
+        bool minor;
+        float score;            // fraction of the note weight inside the scale
+        float tonicWeight;      // fraction on the tonic triad
+    };
+
+    EdoKeyFinder()
+    {
+        reset();
+        resetTuning();
+    }
+
+    void reset()        { histogram.fill (0.0f); }
+
+    /** Back to 12-tone equal temperament, no bend, +/-2 semitone bend range. */
+    void resetTuning()
+    {
+        for (int note = 0; note < 128; ++note)
+            noteCents[(size_t) note] = 100.0f * (float) note;
+
+        bend.fill (0.0f);
+        bendRangeCents.fill (200.0f);
+        rpn.fill (nullRpn);
+    }
+
+    void setPitchBendRange (int channel, float semitones)
+    {
+        if (isPositiveAndBelow (channel - 1, 16))
+            bendRangeCents[(size_t) channel - 1] = 100.0f * semitones;
+    }
+
+    void addMidiMessage (const MidiMessage& m)
+    {
+        const auto channel = jlimit (0, 15, m.getChannel() - 1);
+
+        if (m.isNoteOn())
+            histogram[(size_t) getStep (channel, m.getNoteNumber())] += 1.0f;
+        else if (m.isPitchWheel())
+            bend[(size_t) channel] = (float) (m.getPitchWheelValue() - 8192) / 8192.0f;
+        else if (m.isController())
+            handleController (channel, m.getControllerNumber(), m.getControllerValue());
+        else if (m.isSysEx())
+            handleTuningMessage (m.getSysExData(), m.getSysExDataSize());
+    }
+
+    /** The step a note on a channel (0-15) sounds at right now. */
+    int getStep (int channel, int note) const noexcept
+    {
+        const auto cents = noteCents[(size_t) (note & 0x7f)] + bend[(size_t) channel] * bendRangeCents[(size_t) channel];
+        const auto step = (int) std::lround (cents * (float) Divisions / 1200.0f) % Divisions;
+        return step < 0 ? step + Divisions : step;
+    }
+
+    const Histogram& getHistogram() const     { return histogram; }
+
+    /** Same ranking as MidiKeyFinder::rank_keys(): in-scale weight first, tonic triad to break ties. */
+    static int rankKeys (const Histogram& h, RankedKey* results, int maxResults)
+    {
+        float total = 0.0f;
+
+        for (auto w : h)
+            total += w;
+
+        if (total <= 0.0f || maxResults <= 0)
+            return 0;
+
+        std::array<RankedKey, numKeys> ranked;
+
+        for (int tonic = 0; tonic < Divisions; ++tonic)
+        {
+            for (const auto minor : { false, true })
+                ranked[(size_t) (tonic * 2 + (minor ? 1 : 0))] = { tonic, minor,
+                                                                  Scale::getInScaleWeight (h, tonic, minor) / total,
+                                                                  Scale::getTonicTriadWeight (h, tonic, minor) / total };
+        }
+
+        const auto num = jmin (maxResults, numKeys);
+        std::partial_sort (ranked.begin(), ranked.begin() + num, ranked.end(),
+                           [] (const RankedKey& a, const RankedKey& b)
+                           {
+                               return a.score != b.score ? a.score > b.score : a.tonicWeight > b.tonicWeight;
+                           });
+        std::copy (ranked.begin(), ranked.begin() + num, results);
+        return num;
+    }
+
+    /** "E minor" in 12-EDO, "11\31 major" (step 11 of 31) otherwise. */
+    static String getKeyName (const RankedKey& key)
+    {
+        static const char* const names[] = { "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B" };
+
+        const auto tonic = Divisions == 12 ? String (names[key.tonic % 12])
+                                           : String (key.tonic) + "\\" + String (Divisions);
+        return tonic + (key.minor ? " minor" : " major");
+    }
+
+private:
+    static constexpr int nullRpn = 0x3fff;
+
+    void handleController (int channel, int controller, int value)
+    {
+        auto& selected = rpn[(size_t) channel];
+
+        switch (controller)
+        {
+            case 101:   selected = (value << 7) | (selected & 0x7f); break;
+            case 100:   selected = (selected & ~0x7f) | value; break;
+            case 98:
+            case 99:    selected = nullRpn; break;     // an NRPN, whose data entry isn't ours
+
+            case 6:
+                if (selected == 0)          // pitch bend sensitivity, in semitones
+                {
+                    bendRangeCents[(size_t) channel] = 100.0f * (float) value;
+                }
+                else if (selected == 6)     // MPE configuration: the zone's member channels bend +/-48
+                {
+                    if (channel == 0)
+                        for (int c = 1; c <= value && c < 16; ++c)
+                            bendRangeCents[(size_t) c] = 4800.0f;
+                    else if (channel == 15)
+                        for (int c = 14; c >= 15 - value && c >= 0; --c)
+                            bendRangeCents[(size_t) c] = 4800.0f;
+                }
+
+                break;
+
+            case 38:
+                if (selected == 0)
+                    bendRangeCents[(size_t) channel] = 100.0f * std::floor (bendRangeCents[(size_t) channel] / 100.0f) + (float) value;
+
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    // MIDI Tuning Standard messages (data without the F0/F7).
+    void handleTuningMessage (const uint8* data, int size)
+    {
+        if (size < 5 || (data[0] != 0x7e && data[0] != 0x7f) || data[2] != 0x08)
+            return;
+
+        const auto realtime = data[0] == 0x7f;
+        const auto subId = data[3];
+
+        auto setNote = [this] (int note, const uint8* xyz)
+        {
+            if (xyz[0] == 0x7f && xyz[1] == 0x7f && xyz[2] == 0x7f)    // "no change"
+                return;
+
+            noteCents[(size_t) note] = 100.0f * ((float) xyz[0] + (float) ((xyz[1] << 7) | xyz[2]) / 16384.0f);
+        };
+
+        if (subId == 0x02 && realtime)                      // single note tuning change
+        {
+            const auto count = size >= 6 ? data[5] : 0;
+
+            for (int i = 0; i < count && 6 + i * 4 + 4 <= size; ++i)
+            {
+                const auto* entry = data + 6 + i * 4;
+                setNote (entry[0] & 0x7f, entry + 1);
+            }
+        }
+        else if (subId == 0x01 && ! realtime)               // bulk tuning dump
+        {
+            constexpr int firstNote = 5 + 16;               // after the program number and name
+
+            for (int note = 0; note < 128 && firstNote + note * 3 + 3 <= size; ++note)
+                setNote (note, data + firstNote + note * 3);
+        }
+        else if (subId == 0x08 && size >= 4 + 3 + 12)       // scale/octave tuning, 1 byte per pitch class
+        {
+            const auto* offsets = data + 4 + 3;             // after the channel mask
+
+            for (int note = 0; note < 128; ++note)
+                noteCents[(size_t) note] = 100.0f * (float) note + (float) (offsets[note % 12] - 64);
+        }
+    }
+
+    Histogram histogram;
+    std::array<float, 128> noteCents;
+    std::array<float, 16> bend, bendRangeCents;     // bend is -1..1 of the range
+    std::array<int, 16> rpn;
+};
+
+//==============================================================================
+/** An EdoKeyFinder for a division of the octave chosen at run time. Each supported
+    division is its own instantiation; this only picks which one receives the messages.
+*/
+class MicrotonalKeyFinder
+{
+public:
+    static constexpr std::array<int, 5> supportedDivisions { 12, 19, 24, 31, 53 };
+
+    int getDivisions() const
+    {
+        return std::visit ([] (const auto& f) { return std::decay_t<decltype (f)>::Scale::divisions; }, finder);
+    }
+
+    /** Switches to another division of the octave, starting from scratch. Unsupported values are ignored. */
+    void setDivisions (int divisions)
+    {
+        switch (divisions)
+        {
+            case 12: finder.emplace<EdoKeyFinder<12>>(); break;
+            case 19: finder.emplace<EdoKeyFinder<19>>(); break;
+            case 24: finder.emplace<EdoKeyFinder<24>>(); break;
+            case 31: finder.emplace<EdoKeyFinder<31>>(); break;
+            case 53: finder.emplace<EdoKeyFinder<53>>(); break;
+            default: break;
+        }
+    }
+
+    void addMidiMessage (const MidiMessage& m)      { std::visit ([&m] (auto& f) { f.addMidiMessage (m); }, finder); }
+    void reset()                                    { std::visit ([] (auto& f) { f.reset(); }, finder); }
+
+    /** The best few keys, one per line. */
+    String getBestKeys (int maxResults) const
+    {
+        return std::visit ([maxResults] (const auto& f)
+        {
+            using Finder = std::decay_t<decltype (f)>;
+            typename Finder::RankedKey ranked[Finder::numKeys];
+            const auto num = Finder::rankKeys (f.getHistogram(), ranked, maxResults);
+
+            String s;
+
+            for (int i = 0; i < num; ++i)
+                s += Finder::getKeyName (ranked[i]) + " (" + String (ranked[i].score * 100.0f, 0) + "%)\n";
+
+            return s;
+        }, finder);
+    }
+
+private:
+    std::variant<EdoKeyFinder<12>, EdoKeyFinder<19>, EdoKeyFinder<24>, EdoKeyFinder<31>, EdoKeyFinder<53>> finder;
+};
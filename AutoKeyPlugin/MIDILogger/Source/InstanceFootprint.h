@@ -0,0 +1,152 @@
+/*
+  ==============================================================================
+
+    Creates a number of processors side by side, as a large project would,
+    plays each one a minute of a busy session, and reports what an instance
+    holds on to - freshly created and after playing - part by part.
+
+    The counts are the processors' own (getMemoryFootprint()): the object
+    itself plus the heap it owns. Editors aren't opened. The devices row is
+    only the device manager object, not what it allocates, so it's a lower
+    bound.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+class InstanceFootprint
+{
+public:
+    struct Options
+    {
+        int numInstances = 100;
+        double secondsPlayed = 60.0;
+    };
+
+    using Footprint = MidiLoggerPluginDemoProcessor::MemoryFootprint;
+
+    struct Report
+    {
+        int numInstances = 0;
+        Footprint fresh, played;    // averages per instance
+
+        String toString() const
+        {
+            String s ("part             fresh     played   (bytes per instance, " + String (numInstances) + " instances)\n");
+
+            auto row = [&] (const char* name, size_t a, size_t b)
+            {
+                s += String (name).paddedRight (' ', 12) + String ((int64) a).paddedLeft (' ', 10)
+                   + String ((int64) b).paddedLeft (' ', 11) + "\n";
+            };
+
+            row ("instance",    fresh.instance,    played.instance);
+            row ("queue",       fresh.queue,       played.queue);
+            row ("history",     fresh.history,     played.history);
+            row ("progression", fresh.progression, played.progression);
+            row ("offline",     fresh.offline,     played.offline);
+            row ("display",     fresh.display,     played.display);
+            row ("devices >=",  fresh.devices,     played.devices);
+            row ("total",       fresh.getTotal(),  played.getTotal());
+            return s;
+        }
+    };
+
+    static Report run (const Options& options)
+    {
+        Report report;
+        report.numInstances = jmax (1, options.numInstances);
+
+        std::vector<std::unique_ptr<MidiLoggerPluginDemoProcessor>> instances;
+
+        for (int i = 0; i < report.numInstances; ++i)
+            instances.push_back (std::make_unique<MidiLoggerPluginDemoProcessor>());
+
+        for (auto& p : instances)
+            add (report.fresh, p->getMemoryFootprint());
+
+        for (size_t i = 0; i < instances.size(); ++i)
+        {
+            play (*instances[i], options.secondsPlayed, (int64) i);
+            add (report.played, instances[i]->getMemoryFootprint());
+        }
+
+        divide (report.fresh, (size_t) report.numInstances);
+        divide (report.played, (size_t) report.numInstances);
+        return report;
+    }
+
+private:
+    static constexpr double sampleRate = 44100.0;
+    static constexpr int blockSize = 512;
+
+    // Chords and a melody at about ten notes a second, drained every few blocks like the 60 Hz timer.
+    static void play (MidiLoggerPluginDemoProcessor& processor, double seconds, int64 seed)
+    {
+        processor.prepareToPlay (sampleRate, blockSize);
+
+        Random random (seed);
+        AudioBuffer<float> audio (2, blockSize);
+        MidiBuffer midi;
+        std::array<int, 128> noteOffBlock;
+        noteOffBlock.fill (-1);
+
+        const auto numBlocks = (int) (seconds * sampleRate / blockSize);
+
+        for (int block = 0; block < numBlocks; ++block)
+        {
+            midi.clear();
+
+            for (int note = 0; note < 128; ++note)
+            {
+                if (noteOffBlock[(size_t) note] == block)
+                {
+                    midi.addEvent (MidiMessage::noteOff (1, note), 0);
+                    noteOffBlock[(size_t) note] = -1;
+                }
+            }
+
+            if (random.nextInt (8) < 7)
+            {
+                const auto note = 48 + random.nextInt (36);
+
+                if (noteOffBlock[(size_t) note] < 0)
+                {
+                    midi.addEvent (MidiMessage::noteOn (1, note, (uint8) (40 + random.nextInt (80))), random.nextInt (blockSize));
+                    noteOffBlock[(size_t) note] = block + 1 + random.nextInt (40);
+                }
+            }
+
+            processor.processBlock (audio, midi);
+
+            if (block % 4 == 3)
+                processor.drainPendingMidi();
+        }
+
+        processor.drainPendingMidi();
+        processor.releaseResources();
+    }
+
+    static void add (Footprint& total, const Footprint& f)
+    {
+        total.instance += f.instance;
+        total.queue += f.queue;
+        total.history += f.history;
+        total.progression += f.progression;
+        total.offline += f.offline;
+        total.display += f.display;
+        total.devices += f.devices;
+    }
+
+    static void divide (Footprint& f, size_t n)
+    {
+        f.instance /= n;
+        f.queue /= n;
+        f.history /= n;
+        f.progression /= n;
+        f.offline /= n;
+        f.display /= n;
+        f.devices /= n;
+    }
+};
@@ -0,0 +1,343 @@
+/*
+  ==============================================================================
+
+    Follows the key on the audio thread and reports each change at the
+    sample where it happened, so other plugins and host automation can react
+    within the block rather than at the editor's refresh rate:
+
+      - as a MIDI controller or SysEx message added to the block's output
+      - through three read-only parameters (root, mode, confidence), which
+        are atomics set by the audio thread; the host's listeners are told
+        from the message thread, by notifyParameterListeners()
+
+    The main analysis runs on the message thread at the timer rate, too late
+    for this, so the block is also scanned here (MidiBufferScanner) into a
+    VoiceTable of its own. It's followed as the editor's key is found: the
+    same evidence (everything since the last reset, or since the analysis
+    a loaded state put back, see restore()) ranked by KeyFollower, which
+    also makes a new key stay best for holdNotes note-ons before it's
+    reported, as in MidiKeyStream, and puts the editor's locked key in its
+    place while there is one.
+
+    On the audio thread nothing locks, and the only allocation is
+    MidiBuffer::addEvent growing the host's buffer if it has no room left
+    for a change; a SpinLock guards restore(), and the audio thread only
+    ever tries it.
+
+    Only the host's MIDI reaches it: MIDI devices and the on-screen keyboard
+    feed the editor's analysis alone. And when one timer tick brings the
+    editor more than 1000 events it analyses only the newest, where this
+    sees them all. In either case the two can disagree.
+
+    Nothing goes out as MIDI until a format is chosen. Keys go out numbered
+    as in OfflineKeyAnalyser: C..B major are 0-11, C..B minor 12-23. The
+    controller's value is that number. The SysEx uses the non-commercial
+    manufacturer ID:
+
+        F0 7D 41 4B <root 0-11> <mode: 0 major, 1 minor> <confidence 0-127> F7
+
+  ==============================================================================
+*/
+
+#pragma once
+
+class KeyChangeOutput
+{
+public:
+    enum Format : int
+    {
+        off = 0,
+        controller,
+        sysEx
+    };
+
+    static constexpr int holdNotes = 4;
+    static constexpr int maxChangesPerBlock = 16;
+
+    /** A parameter the host can read but not set. The meter category is what marks it as
+        read-only to the plugin formats.
+    */
+    class Parameter  : public AudioProcessorParameterWithID
+    {
+    public:
+        Parameter (const String& parameterID, const String& parameterName, const StringArray& valueNamesIn = {})
+            : AudioProcessorParameterWithID (parameterID, parameterName, {}, analysisMeter),
+              valueNames (valueNamesIn)
+        {
+        }
+
+        float getValue() const override                 { return value.load(); }
+        void setValue (float) override                  {}
+        float getDefaultValue() const override          { return 0.0f; }
+        bool isDiscrete() const override                { return ! valueNames.isEmpty(); }
+        StringArray getAllValueStrings() const override { return valueNames; }
+
+        int getNumSteps() const override
+        {
+            return valueNames.isEmpty() ? AudioProcessor::getDefaultNumParameterSteps() : valueNames.size();
+        }
+
+        String getText (float normalised, int) const override
+        {
+            if (valueNames.isEmpty())
+                return String (roundToInt (normalised * 100.0f)) + "%";
+
+            return valueNames[roundToInt (normalised * (float) (valueNames.size() - 1))];
+        }
+
+        float getValueForText (const String& text) const override
+        {
+            if (valueNames.isEmpty())
+                return jlimit (0.0f, 1.0f, text.getFloatValue() / 100.0f);
+
+            return jmax (0, valueNames.indexOf (text)) / (float) (valueNames.size() - 1);
+        }
+
+        /** The normalised value of the index'th value name. */
+        float getValueForIndex (int index) const    { return index / (float) jmax (1, valueNames.size() - 1); }
+
+        /** Audio thread. The host reads the new value at once; listeners hear of it from
+            notifyListeners().
+        */
+        void update (float newValue)        { value = newValue; }
+
+        /** Message thread. */
+        void notifyListeners()
+        {
+            const auto current = value.load();
+
+            if (current != notifiedValue)
+                sendValueChangedMessageToListeners (notifiedValue = current);
+        }
+
+    private:
+        const StringArray valueNames;
+        std::atomic<float> value { 0.0f };
+        float notifiedValue = 0.0f;         // message thread only
+    };
+
+    /** Creates the host parameters and hands them to the processor, which owns them. */
+    void addParameters (AudioProcessor& processor)
+    {
+        processor.addParameter (root = new Parameter ("keyRoot", "Key root",
+                                                      { "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B" }));
+        processor.addParameter (mode = new Parameter ("keyMode", "Key mode", { "Major", "Minor" }));
+        processor.addParameter (confidence = new Parameter ("keyConfidence", "Key confidence"));
+    }
+
+    //==============================================================================
+    /** Any thread; takes effect from the next block. */
+    void setFormat (Format newFormat)       { format = newFormat; }
+    Format getFormat() const                { return format; }
+
+    /** Any thread. channel is 1-16. */
+    void setController (int channel, int number)
+    {
+        outputChannel = jlimit (1, 16, channel);
+        controllerNumber = jlimit (0, 127, number);
+    }
+
+    int getChannel() const                  { return outputChannel; }
+    int getControllerNumber() const         { return controllerNumber; }
+
+    /** Any thread: a MidiKeyFinder key index to report instead of the detected key, or -1.
+        Takes effect at the start of the next block.
+    */
+    void setLockedKey (int key)             { lockedKey = key; }
+
+    /** Any thread: forgets everything heard, at the start of the next block. */
+    void reset()
+    {
+        const SpinLock::ScopedLockType sl (restoreLock);
+        restorePending = false;
+        resetPending = true;
+    }
+
+    /** Message thread: starts again from an analysis put back from a saved state, the
+        durations and note counts MidiKeyFinder was restored with, at the start of the next
+        block. The best key (or the locked one) goes out there straight away, without
+        waiting for the hold.
+    */
+    void restore (const VoiceTable::Evidence& evidence, const VoiceTable::Evidence& noteCounts)
+    {
+        const SpinLock::ScopedLockType sl (restoreLock);
+        restoredEvidence = evidence;
+        restoredCounts = noteCounts;
+        restorePending = true;
+    }
+
+    /** Message thread, from a timer: tells the parameters' listeners (the host among them)
+        about the values the audio thread has set since the last call.
+    */
+    void notifyParameterListeners()
+    {
+        for (auto* parameter : { root, mode, confidence })
+            if (parameter != nullptr)
+                parameter->notifyListeners();
+    }
+
+    /** Message thread, before processing starts. */
+    void prepare (double newSampleRate)
+    {
+        sampleRate = newSampleRate > 0.0 ? newSampleRate : 44100.0;
+    }
+
+    //==============================================================================
+    /** Audio thread. Follows the block's MIDI and adds an event at each key change. */
+    void process (MidiBuffer& midi, int numSamples)
+    {
+        if (resetPending.exchange (false))
+            restart();
+
+        bool restored = false;
+
+        {
+            // If the message thread is in the middle of a restore, it's picked up next block.
+            const SpinLock::ScopedTryLockType tl (restoreLock);
+
+            if (tl.isLocked() && std::exchange (restorePending, false))
+            {
+                restart();
+                voices.restore (restoredEvidence);
+                counts = restoredCounts;
+                restored = true;
+            }
+        }
+
+        Change changes[maxChangesPerBlock];
+        int numChanges = 0;
+
+        auto update = [&] (double time, bool isNoteOn, int samplePosition)
+        {
+            if (follower.update (getEvidence (time), isNoteOn) && numChanges < maxChangesPerBlock)
+                changes[numChanges++] = { follower.getKey(), follower.getScore(), samplePosition };
+        };
+
+        // A lock set since the last block, or a restored key, goes out at its start, notes or not.
+        follower.setLockedKey (lockedKey.load());
+        const auto blockTime = (double) samplesPlayed / sampleRate;
+
+        if (restored)
+        {
+            if (follower.settle (getEvidence (blockTime)))
+                changes[numChanges++] = { follower.getKey(), follower.getScore(), 0 };
+        }
+        else if (follower.getLockedKey() >= 0 && follower.getKey() != follower.getLockedKey())
+        {
+            update (blockTime, false, 0);
+        }
+
+        MidiBufferScanner::scan (midi, [&] (const MidiBufferScanner::Event* events, int num)
+        {
+            for (int i = 0; i < num; ++i)
+            {
+                const auto& e = events[i];
+
+                if (e.size < 3 || ! (e.kind == MidiBufferScanner::noteOn || e.kind == MidiBufferScanner::noteOff
+                                       || e.kind == MidiBufferScanner::controller))
+                    continue;
+
+                const auto time = (double) (samplesPlayed + e.samplePosition) / sampleRate;
+                const auto channelIndex = e.data[0] & 0xf;
+                const auto isNoteOn = e.kind == MidiBufferScanner::noteOn && e.data[2] > 0;
+
+                if (isNoteOn)
+                {
+                    voices.noteOn (channelIndex, e.data[1], time);
+                    counts[(size_t) (e.data[1] % 12)] += 1.0f;
+                }
+                else if (e.kind == MidiBufferScanner::controller)
+                {
+                    voices.controller (channelIndex, e.data[1], e.data[2], time);
+                }
+                else
+                {
+                    voices.noteOff (channelIndex, e.data[1], time);
+                }
+
+                update (time, isNoteOn, e.samplePosition);
+            }
+        });
+
+        samplesPlayed += numSamples;
+
+        for (int i = 0; i < numChanges; ++i)
+            report (changes[i], midi);
+    }
+
+private:
+    struct Change
+    {
+        int key;                // a MidiKeyFinder key index
+        float score;
+        int samplePosition;
+    };
+
+    // What MidiKeyFinder::get_key_evidence() ranks on, from this thread's own voices.
+    VoiceTable::Evidence getEvidence (double time) const
+    {
+        const auto durations = voices.getEvidence (time);
+        return KeyFollower::getEvidenceToRank (durations, counts);
+    }
+
+    void report (const Change& change, MidiBuffer& midi)
+    {
+        const auto tonic = KeyFollower::tonics[(size_t) change.key];
+        const auto minor = KeyFollower::isMinor (change.key);
+
+        if (root != nullptr)
+        {
+            root->update (root->getValueForIndex (tonic));
+            mode->update (mode->getValueForIndex (minor ? 1 : 0));
+            confidence->update (change.score);
+        }
+
+        switch (format.load())
+        {
+            case controller:
+                midi.addEvent (MidiMessage::controllerEvent (outputChannel, controllerNumber, tonic + (minor ? 12 : 0)), change.samplePosition);
+                break;
+
+            case sysEx:
+            {
+                const uint8 data[] = { 0xf0, 0x7d, 0x41, 0x4b, (uint8) tonic, (uint8) (minor ? 1 : 0),
+                                       (uint8) roundToInt (jlimit (0.0f, 1.0f, change.score) * 127.0f), 0xf7 };
+                midi.addEvent (data, (int) sizeof (data), change.samplePosition);
+                break;
+            }
+
+            case off:
+            default:
+                break;
+        }
+    }
+
+    void restart()
+    {
+        voices.reset();
+        counts.fill (0.0f);
+        samplesPlayed = 0;
+        follower.reset();
+    }
+
+    // Set from any thread.
+    std::atomic<Format> format { off };
+    std::atomic<int> outputChannel { 16 }, controllerNumber { 20 };
+    std::atomic<int> lockedKey { -1 };
+    std::atomic<bool> resetPending { false };
+
+    SpinLock restoreLock;               // the audio thread only ever tries it
+    VoiceTable::Evidence restoredEvidence {}, restoredCounts {};
+    bool restorePending = false;
+
+    // Audio thread from here down.
+    VoiceTable voices;
+    VoiceTable::Evidence counts {};
+    KeyFollower follower { holdNotes };
+    double sampleRate = 44100.0;
+    int64 samplesPlayed = 0;
+
+    Parameter* root = nullptr;          // owned by the processor
+    Parameter* mode = nullptr;
+    Parameter* confidence = nullptr;
+};
@@ -0,0 +1,245 @@
+/*
+  ==============================================================================
+
+    Load generator for KeyDetectionServer.
+
+    Opens a number of persistent connections, keeps a fixed number of
+    requests in flight on each one and measures the time from sending each
+    request until its response line arrives.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "KeyDetectionServer.h"
+
+class KeyDetectionLoadGenerator
+{
+public:
+    struct Options
+    {
+        String socketPath;
+        int numConnections = 4;
+        int requestsPerConnection = 20000;
+        int pipelineDepth = 32;
+    };
+
+    struct Report
+    {
+        int64 numResponses = 0, numErrors = 0;
+        double seconds = 0.0;
+        double p50 = 0.0, p90 = 0.0, p99 = 0.0, p999 = 0.0, max = 0.0;   // microseconds
+        String failure;
+
+        String toString() const
+        {
+            if (failure.isNotEmpty())
+                return "Load test failed: " + failure;
+
+            return String (numResponses) + " responses (" + String (numErrors) + " errors) in "
+                 + String (seconds, 3) + " s = " + String ((double) numResponses / jmax (seconds, 1.0e-9), 0) + " req/s\n"
+                 + "latency us: p50 " + String (p50, 1) + "  p90 " + String (p90, 1)
+                 + "  p99 " + String (p99, 1) + "  p99.9 " + String (p999, 1) + "  max " + String (max, 1);
+        }
+    };
+
+    static Report run (const Options& options)
+    {
+        OwnedArray<Client> clients;
+        std::signal (SIGPIPE, SIG_IGN);    // a server that goes away fails the send instead
+
+        for (int i = 0; i < jmax (1, options.numConnections); ++i)
+            clients.add (new Client (options, (uint32) i));
+
+        const auto startTicks = Time::getHighResolutionTicks();
+
+        for (auto* c : clients)
+            c->startThread();
+
+        for (auto* c : clients)
+            c->waitForThreadToExit (-1);
+
+        Report report;
+        report.seconds = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - startTicks);
+
+        std::vector<float> latencies;
+
+        for (auto* c : clients)
+        {
+            if (c->failure.isNotEmpty())
+                report.failure = c->failure;
+
+            report.numErrors += c->numErrors;
+            latencies.insert (latencies.end(), c->latencies.begin(), c->latencies.end());
+        }
+
+        report.numResponses = (int64) latencies.size();
+
+        if (! latencies.empty())
+        {
+            std::sort (latencies.begin(), latencies.end());
+
+            auto percentile = [&latencies] (double p)
+            {
+                return (double) latencies[jmin (latencies.size() - 1, (size_t) (p * (double) latencies.size()))];
+            };
+
+            report.p50  = percentile (0.5);
+            report.p90  = percentile (0.9);
+            report.p99  = percentile (0.99);
+            report.p999 = percentile (0.999);
+            report.max  = (double) latencies.back();
+        }
+
+        return report;
+    }
+
+private:
+    class Client  : public Thread
+    {
+    public:
+        Client (const Options& o, uint32 seed)
+            : Thread ("KeyDetectionLoadClient"), options (o), random ((int64) seed + 1)
+        {
+            latencies.reserve ((size_t) jmax (0, options.requestsPerConnection));
+        }
+
+        ~Client() override
+        {
+            stopThread (1000);
+
+            if (fd >= 0)
+                ::close (fd);
+        }
+
+        void run() override
+        {
+            sockaddr_un address {};
+            address.sun_family = AF_UNIX;
+            options.socketPath.copyToUTF8 (address.sun_path, sizeof (address.sun_path));
+
+            fd = ::socket (AF_UNIX, SOCK_STREAM, 0);
+
+            if (fd < 0 || ::connect (fd, (const sockaddr*) &address, sizeof (address)) != 0)
+            {
+                failure = "connect: " + String (std::strerror (errno));
+                return;
+            }
+
+            const auto total = options.requestsPerConnection;
+            const auto depth = jmax (1, options.pipelineDepth);
+            std::vector<int64> sendTicks ((size_t) depth);
+            std::string outgoing, incoming;
+            char buffer[16384];
+            int numSent = 0, numReceived = 0;
+
+            while (numReceived < total && ! threadShouldExit())
+            {
+                outgoing.clear();
+
+                while (numSent < total && numSent - numReceived < depth)
+                {
+                    appendRequest (outgoing);
+                    sendTicks[(size_t) (numSent++ % depth)] = Time::getHighResolutionTicks();
+                }
+
+                if (! outgoing.empty() && ! sendAll (outgoing))
+                    return;
+
+                const auto numRead = ::recv (fd, buffer, sizeof (buffer), 0);
+
+                if (numRead <= 0)
+                {
+                    if (numRead < 0 && errno == EINTR)
+                        continue;
+
+                    failure = "connection closed after " + String (numReceived) + " responses";
+                    return;
+                }
+
+                incoming.append (buffer, (size_t) numRead);
+                const auto now = Time::getHighResolutionTicks();
+                size_t start = 0;
+
+                for (auto newline = incoming.find ('\n'); newline != std::string::npos;
+                     newline = incoming.find ('\n', start))
+                {
+                    if (incoming.compare (start, 3, "OK ") != 0)
+                        ++numErrors;
+
+                    const auto sent = sendTicks[(size_t) (numReceived++ % depth)];
+                    latencies.push_back ((float) (Time::highResolutionTicksToSeconds (now - sent) * 1.0e6));
+                    start = newline + 1;
+                }
+
+                incoming.erase (0, start);
+            }
+        }
+
+        std::vector<float> latencies;
+        int64 numErrors = 0;
+        String failure;
+
+    private:
+        // Alternates raw MIDI streams of a random scale (with running status) and histograms.
+        void appendRequest (std::string& out)
+        {
+            static const int majorSteps[] = { 0, 2, 4, 5, 7, 9, 11 };
+            const auto tonic = random.nextInt (12);
+            char text[32];
+
+            if ((requestCounter++ & 1) == 0)
+            {
+                out += "MIDI 90";
+
+                for (int i = 0; i < 16; ++i)
+                {
+                    const auto note = 48 + tonic + majorSteps[random.nextInt (7)];
+                    std::snprintf (text, sizeof (text), " %02x %02x", note, 1 + random.nextInt (127));
+                    out += text;
+                }
+            }
+            else
+            {
+                out += "HIST";
+
+                for (int pc = 0; pc < 12; ++pc)
+                {
+                    const auto inScale = std::find (std::begin (majorSteps), std::end (majorSteps), (pc - tonic + 12) % 12)
+                                            != std::end (majorSteps);
+                    std::snprintf (text, sizeof (text), " %d", inScale ? random.nextInt (20) : random.nextInt (2));
+                    out += text;
+                }
+            }
+
+            out += '\n';
+        }
+
+        bool sendAll (const std::string& data)
+        {
+            for (size_t written = 0; written < data.size();)
+            {
+                const auto n = ::send (fd, data.data() + written, data.size() - written, 0);
+
+                if (n < 0 && errno == EINTR)
+                    continue;
+
+                if (n <= 0)
+                {
+                    failure = "send: " + String (std::strerror (errno));
+                    return false;
+                }
+
+                written += (size_t) n;
+            }
+
+            return true;
+        }
+
+        const Options& options;
+        Random random;
+        int fd = -1;
+        uint32 requestCounter = 0;
+    };
+};
@@ -0,0 +1,466 @@
+/*
+  ==============================================================================
+
+    Headless key-detection service on a Unix domain socket.
+
+    Protocol: newline-terminated text requests, answered in order, one line
+    per request. Clients can pipeline as many requests as they like on a
+    connection and keep it open between batches.
+
+        MIDI <hex bytes>        raw MIDI 1.0 stream, e.g. "MIDI 90 3c 64 40 64"
+        HIST <12 weights>       pitch-class histogram starting at C
+
+    Responses:
+
+        OK <key>=<score>/<tonic weight>;...   best keys first
+        ERR <reason>
+
+    A single I/O thread polls idle connections; as soon as one has data it is
+    handed to a ThreadPool job, which answers every complete request in the
+    buffer with one write and then gives the connection back.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "MidiByteStreamParser.h"
+
+class KeyDetectionServer  : private Thread
+{
+public:
+    explicit KeyDetectionServer (int numWorkerThreads = SystemStats::getNumCpus(), int maxKeysPerResponse = 3)
+        : Thread ("KeyDetectionServer"),
+          pool (jmax (1, numWorkerThreads)),
+          maxResults (jlimit (1, MidiKeyFinder::num_keys, maxKeysPerResponse))
+    {
+    }
+
+    ~KeyDetectionServer() override    { stop(); }
+
+    /** Binds the socket and starts serving. Returns an error message on failure. */
+    Result start (const String& path)
+    {
+        stop();
+
+        // A client hanging up mid-response must fail the send rather than kill the process,
+        // and not every platform has MSG_NOSIGNAL, so as in MidiKeyStream SIGPIPE is ignored.
+        std::signal (SIGPIPE, SIG_IGN);
+
+        sockaddr_un address {};
+        address.sun_family = AF_UNIX;
+
+        if (path.isEmpty() || (size_t) path.getNumBytesAsUTF8() >= sizeof (address.sun_path))
+            return Result::fail ("Invalid socket path: " + path);
+
+        path.copyToUTF8 (address.sun_path, sizeof (address.sun_path));
+        ::unlink (address.sun_path);
+
+        listenFd = ::socket (AF_UNIX, SOCK_STREAM, 0);
+
+        if (listenFd < 0)
+            return failWithErrno ("socket");
+
+        if (::bind (listenFd, (const sockaddr*) &address, sizeof (address)) != 0)
+            return failWithErrno ("bind");
+
+        if (::listen (listenFd, SOMAXCONN) != 0)
+            return failWithErrno ("listen");
+
+        if (::pipe (wakePipe) != 0)
+            return failWithErrno ("pipe");
+
+        setNonBlocking (listenFd);
+        setNonBlocking (wakePipe[0]);
+        setNonBlocking (wakePipe[1]);
+
+        socketPath = path;
+        startThread();
+        return Result::ok();
+    }
+
+    void stop()
+    {
+        if (isThreadRunning())
+        {
+            signalThreadShouldExit();
+            wake();
+            stopThread (2000);
+        }
+
+        pool.removeAllJobs (true, 2000);
+
+        idle.clear();
+
+        {
+            const ScopedLock sl (returnedLock);
+            returned.clear();
+        }
+
+        for (auto* fd : { &listenFd, &wakePipe[0], &wakePipe[1] })
+        {
+            if (*fd >= 0)
+                ::close (*fd);
+
+            *fd = -1;
+        }
+
+        if (socketPath.isNotEmpty())
+            ::unlink (socketPath.toRawUTF8());
+
+        socketPath = {};
+    }
+
+    int64 getNumRequestsServed() const noexcept     { return numRequests.get(); }
+    int64 getNumConnectionsAccepted() const noexcept { return numConnections.get(); }
+
+    //==============================================================================
+    /** Answers one request line (without the newline), appending the response line to out.
+        Exposed so the protocol can be exercised without a socket.
+    */
+    void handleRequest (const char* line, const char* end, std::string& out) const
+    {
+        MidiKeyFinder::Histogram histogram {};
+
+        if (startsWith (line, end, "MIDI "))
+        {
+            MidiByteStreamParser parser;
+            uint8_t bytes[256];
+            size_t numBytes = 0;
+            int nibbles = 0;
+            bool badDigit = false;
+
+            auto flush = [&]
+            {
+                parser.push (bytes, numBytes, [&histogram] (const uint8_t* data, int size)
+                {
+                    if (size == 3 && (data[0] & 0xf0) == 0x90 && data[2] != 0)
+                        histogram[(size_t) (data[1] % 12)] += 1.0f;
+                });
+
+                numBytes = 0;
+            };
+
+            for (auto* p = line + 5; p < end; ++p)
+            {
+                const auto digit = CharacterFunctions::getHexDigitValue ((juce_wchar) (uint8_t) *p);
+
+                if (digit < 0)
+                {
+                    if (*p != ' ' && *p != '\t')
+                        badDigit = true;
+
+                    continue;
+                }
+
+                if ((nibbles++ & 1) == 0)
+                {
+                    bytes[numBytes] = (uint8_t) (digit << 4);
+                }
+                else
+                {
+                    bytes[numBytes++] |= (uint8_t) digit;
+
+                    if (numBytes == sizeof (bytes))
+                        flush();
+                }
+            }
+
+            if (badDigit || (nibbles & 1) != 0)
+            {
+                out += "ERR malformed hex\n";
+                return;
+            }
+
+            flush();
+        }
+        else if (startsWith (line, end, "HIST "))
+        {
+            const std::string text (line + 5, end);
+            const char* p = text.c_str();
+
+            for (auto& weight : histogram)
+            {
+                char* next = nullptr;
+                weight = std::strtof (p, &next);
+
+                if (next == p || ! (weight >= 0.0f))
+                {
+                    out += "ERR expected 12 non-negative weights\n";
+                    return;
+                }
+
+                p = next;
+            }
+        }
+        else
+        {
+            out += "ERR unknown request\n";
+            return;
+        }
+
+        MidiKeyFinder::RankedKey ranked[MidiKeyFinder::num_keys];
+        const auto numRanked = keyFinder.rank_keys (histogram, ranked, maxResults);
+
+        out += "OK";
+
+        for (int i = 0; i < numRanked; ++i)
+        {
+            char entry[64];
+            std::snprintf (entry, sizeof (entry), "%c%s=%.3f/%.3f", i == 0 ? ' ' : ';',
+                           MidiKeyFinder::get_key_name (ranked[i].index),
+                           (double) ranked[i].score, (double) ranked[i].tonic_weight);
+            out += entry;
+        }
+
+        out += '\n';
+    }
+
+private:
+    struct Connection
+    {
+        explicit Connection (int f) : fd (f) {}
+        ~Connection()    { ::close (fd); }
+
+        const int fd;
+        std::string input, output;
+    };
+
+    using ConnectionPtr = std::unique_ptr<Connection>;
+
+    class ConnectionJob  : public ThreadPoolJob
+    {
+    public:
+        ConnectionJob (KeyDetectionServer& s, ConnectionPtr c)
+            : ThreadPoolJob ("KeyDetectionConnection"), server (s), connection (std::move (c)) {}
+
+        JobStatus runJob() override
+        {
+            if (server.serve (*connection))
+                server.giveBack (std::move (connection));
+
+            return jobHasFinished;
+        }
+
+    private:
+        KeyDetectionServer& server;
+        ConnectionPtr connection;
+    };
+
+    //==============================================================================
+    void run() override
+    {
+        std::vector<pollfd> fds;
+
+        while (! threadShouldExit())
+        {
+            {
+                const ScopedLock sl (returnedLock);
+
+                for (auto& c : returned)
+                    idle.push_back (std::move (c));
+
+                returned.clear();
+            }
+
+            fds.clear();
+            fds.push_back ({ listenFd, POLLIN, 0 });
+            fds.push_back ({ wakePipe[0], POLLIN, 0 });
+
+            for (auto& c : idle)
+                fds.push_back ({ c->fd, POLLIN, 0 });
+
+            if (::poll (fds.data(), (nfds_t) fds.size(), 500) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                break;
+            }
+
+            if (fds[1].revents != 0)
+            {
+                char drain[64];
+                while (::read (wakePipe[0], drain, sizeof (drain)) > 0) {}
+            }
+
+            // Connections are handed to the pool from the back so indices into fds stay valid.
+            for (auto i = idle.size(); i-- > 0;)
+            {
+                if (fds[i + 2].revents == 0)
+                    continue;
+
+                auto connection = std::move (idle[i]);
+                idle.erase (idle.begin() + (std::ptrdiff_t) i);
+                pool.addJob (new ConnectionJob (*this, std::move (connection)), true);
+            }
+
+            if (fds[0].revents & POLLIN)
+            {
+                for (;;)
+                {
+                    const auto fd = ::accept (listenFd, nullptr, nullptr);
+
+                    if (fd < 0)
+                        break;
+
+                    setNonBlocking (fd);
+                    idle.push_back (std::make_unique<Connection> (fd));
+                    ++numConnections;
+                }
+            }
+        }
+    }
+
+    // Reads everything available, answers all complete requests and flushes the replies.
+    // Returns false once the peer has gone away.
+    bool serve (Connection& c)
+    {
+        char buffer[16384];
+        bool open = true;
+
+        for (;;)
+        {
+            const auto numRead = ::read (c.fd, buffer, sizeof (buffer));
+
+            if (numRead > 0)
+            {
+                c.input.append (buffer, (size_t) numRead);
+
+                if ((size_t) numRead < sizeof (buffer))
+                    break;
+
+                continue;
+            }
+
+            if (numRead < 0 && errno == EINTR)
+                continue;
+
+            if (numRead == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                open = false;
+
+            break;
+        }
+
+        size_t start = 0;
+
+        for (;;)
+        {
+            const auto newline = c.input.find ('\n', start);
+
+            if (newline == std::string::npos)
+                break;
+
+            auto lineEnd = newline;
+
+            if (lineEnd > start && c.input[lineEnd - 1] == '\r')
+                --lineEnd;
+
+            handleRequest (c.input.data() + start, c.input.data() + lineEnd, c.output);
+            ++numRequests;
+            start = newline + 1;
+        }
+
+        c.input.erase (0, start);
+
+        if (c.input.size() > maxRequestLength)
+        {
+            c.output += "ERR request too long\n";
+            open = false;
+        }
+
+        return writeAll (c) && open;
+    }
+
+    static bool writeAll (Connection& c)
+    {
+        size_t written = 0;
+
+        while (written < c.output.size())
+        {
+            const auto n = ::send (c.fd, c.output.data() + written, c.output.size() - written, 0);
+
+            if (n > 0)
+            {
+                written += (size_t) n;
+            }
+            else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                pollfd pfd { c.fd, POLLOUT, 0 };
+
+                if (::poll (&pfd, 1, 5000) <= 0)
+                    return false;
+            }
+            else if (! (n < 0 && errno == EINTR))
+            {
+                return false;
+            }
+        }
+
+        c.output.clear();
+        return true;
+    }
+
+    void giveBack (ConnectionPtr c)
+    {
+        {
+            const ScopedLock sl (returnedLock);
+            returned.push_back (std::move (c));
+        }
+
+        wake();
+    }
+
+    void wake()
+    {
+        const char byte = 0;
+
+        if (wakePipe[1] >= 0)
+            (void) ::write (wakePipe[1], &byte, 1);
+    }
+
+    static bool startsWith (const char* line, const char* end, const char* prefix)
+    {
+        const auto len = std::strlen (prefix);
+        return (size_t) (end - line) >= len && std::memcmp (line, prefix, len) == 0;
+    }
+
+    static void setNonBlocking (int fd)
+    {
+        ::fcntl (fd, F_SETFL, ::fcntl (fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    static Result failWithErrno (const char* call)
+    {
+        return Result::fail (String (call) + ": " + String (std::strerror (errno)));
+    }
+
+    static constexpr size_t maxRequestLength = 1 << 20;
+
+    ThreadPool pool;
+    const MidiKeyFinder keyFinder;
+    const int maxResults;
+
+    String socketPath;
+    int listenFd = -1;
+    int wakePipe[2] = { -1, -1 };
+
+    std::vector<ConnectionPtr> idle;        // only touched by the I/O thread
+    std::vector<ConnectionPtr> returned;
+    CriticalSection returnedLock;
+
+    Atomic<int64> numRequests { 0 }, numConnections { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE (KeyDetectionServer)
+};
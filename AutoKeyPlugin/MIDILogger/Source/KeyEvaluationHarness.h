@@ -0,0 +1,401 @@
+/*
+  ==============================================================================
+
+    Measures key-detection accuracy on a directory of MIDI files whose keys
+    are known, for a grid of analysis settings, so the settings can be
+    chosen on evidence: how much of each file is heard, how quickly old
+    notes fade, whether notes count once or by how long they sound, and
+    which key templates they are scored against (MidiKeyFinder's scale sets,
+    or the Krumhansl-Kessler / Temperley profiles of the offline tier).
+
+    The ground truth comes from a labels file ("<file name>,<key>" or
+    tab-separated, one per line) or else from each file's key signature.
+    Files are spread over a thread pool. Each setting is reported with its
+    accuracy, its MIREX weighted score (1 for the right key, 0.5 a fifth
+    away, 0.3 relative, 0.2 parallel) and the analysis time per file.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <map>
+
+class KeyEvaluationHarness
+{
+public:
+    enum class Evidence { noteCounts, durations };
+    enum class Method { scaleSets, krumhanslKessler, temperley };
+
+    struct Config
+    {
+        double windowSeconds;   // heard from the start of the file; 0 = all of it
+        double halfLife;        // seconds for old evidence to fade to half; 0 = never
+        Evidence evidence;
+        Method method;
+    };
+
+    struct Options
+    {
+        File directory, labels;         // labels is optional
+        int numThreads = SystemStats::getNumCpus();
+    };
+
+    struct Result
+    {
+        Config config;
+        int numCorrect = 0;
+        double mirexTotal = 0.0, seconds = 0.0;
+    };
+
+    struct Report
+    {
+        std::vector<Result> results;    // best MIREX score first
+        int numFiles = 0;
+        StringArray skipped;            // unreadable, or no key to compare with
+        String failure;
+
+        String toString() const
+        {
+            if (failure.isNotEmpty())
+                return "Evaluation failed: " + failure;
+
+            String s (String (numFiles) + " files");
+
+            if (! skipped.isEmpty())
+                s += " (" + String (skipped.size()) + " skipped: " + skipped.joinIntoString (", ") + ")";
+
+            s += "\nwindow  half-life  evidence   method            accuracy   MIREX   us/file\n";
+
+            for (const auto& r : results)
+            {
+                const auto& c = r.config;
+                const auto n = (double) jmax (1, numFiles);
+
+                s += String (isOnFrontier (r) ? "* " : "  ")
+                   + (c.windowSeconds > 0.0 ? String ((int) c.windowSeconds) + " s" : String ("all")).paddedLeft (' ', 4)
+                   + (c.halfLife > 0.0 ? String ((int) c.halfLife) + " s" : String ("none")).paddedLeft (' ', 11) + "   "
+                   + String (c.evidence == Evidence::durations ? "durations" : "counts").paddedRight (' ', 11)
+                   + String (getMethodName (c.method)).paddedRight (' ', 16)
+                   + (String (100.0 * r.numCorrect / n, 1) + "%").paddedLeft (' ', 9)
+                   + String (r.mirexTotal / n, 3).paddedLeft (' ', 8)
+                   + String (r.seconds * 1.0e6 / n, 1).paddedLeft (' ', 10) + "\n";
+            }
+
+            return s + "* nothing else is both faster and at least as accurate";
+        }
+
+        /** True if no other setting scores at least as well in less time. */
+        bool isOnFrontier (const Result& r) const
+        {
+            for (const auto& other : results)
+                if (&other != &r && other.mirexTotal >= r.mirexTotal && other.seconds < r.seconds)
+                    return false;
+
+            return true;
+        }
+    };
+
+    static std::vector<Config> makeGrid()
+    {
+        std::vector<Config> grid;
+
+        for (auto window : { 15.0, 30.0, 60.0, 0.0 })
+            for (auto halfLife : { 0.0, 30.0, 10.0 })
+                for (auto evidence : { Evidence::noteCounts, Evidence::durations })
+                    for (auto method : { Method::scaleSets, Method::krumhanslKessler, Method::temperley })
+                        grid.push_back ({ window, halfLife, evidence, method });
+
+        return grid;
+    }
+
+    static Report run (const Options& options)
+    {
+        Report report;
+        const auto grid = makeGrid();
+
+        auto files = options.directory.findChildFiles (File::findFiles, true, "*.mid;*.midi;*.smf");
+        files.sort();
+
+        if (files.isEmpty())
+        {
+            report.failure = "no MIDI files in " + options.directory.getFullPathName();
+            return report;
+        }
+
+        const auto labels = readLabels (options.labels);
+
+        struct FileResult
+        {
+            int truth = -1;
+            std::vector<int> detected;
+            std::vector<double> seconds;
+        };
+
+        std::vector<FileResult> fileResults ((size_t) files.size());
+
+        {
+            ThreadPool pool (jmax (1, options.numThreads));
+
+            for (int i = 0; i < files.size(); ++i)
+            {
+                pool.addJob ([&, i]
+                {
+                    auto& result = fileResults[(size_t) i];
+                    std::vector<MidiMessage> events;
+                    double length = 0.0;
+                    int keySignature = -1;
+
+                    if (! readFile (files.getReference (i), events, length, keySignature))
+                        return;
+
+                    const auto label = labels.find (files.getReference (i).getFileName().toLowerCase());
+                    result.truth = label != labels.end() ? label->second : keySignature;
+
+                    if (result.truth < 0)
+                        return;
+
+                    const MidiKeyFinder finder;
+
+                    for (const auto& config : grid)
+                    {
+                        const auto start = Time::getHighResolutionTicks();
+                        result.detected.push_back (detect (events, length, config, finder));
+                        result.seconds.push_back (Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - start));
+                    }
+                });
+            }
+
+            while (pool.getNumJobs() > 0)
+                Thread::sleep (10);
+        }
+
+        for (const auto& config : grid)
+            report.results.push_back ({ config });
+
+        for (int i = 0; i < files.size(); ++i)
+        {
+            const auto& f = fileResults[(size_t) i];
+
+            if (f.truth < 0 || f.detected.size() != grid.size())
+            {
+                report.skipped.add (files.getReference (i).getFileName());
+                continue;
+            }
+
+            ++report.numFiles;
+
+            for (size_t c = 0; c < grid.size(); ++c)
+            {
+                auto& r = report.results[c];
+                r.numCorrect += f.detected[c] == f.truth ? 1 : 0;
+                r.mirexTotal += getMirexScore (f.detected[c], f.truth);
+                r.seconds += f.seconds[c];
+            }
+        }
+
+        std::stable_sort (report.results.begin(), report.results.end(),
+                          [] (const Result& a, const Result& b) { return a.mirexTotal > b.mirexTotal; });
+
+        return report;
+    }
+
+    //==============================================================================
+    // Keys are numbered as in OfflineKeyAnalyser: 0-11 C..B major, 12-23 C..B minor.
+
+    /** "A minor", "Bb major", "F#m", "Eb", "c:min"... or -1. */
+    static int parseKey (const String& text)
+    {
+        const auto t = text.trim().removeCharacters (" :_-");
+
+        if (t.isEmpty())
+            return -1;
+
+        const auto letter = CharacterFunctions::toUpperCase (t[0]);
+        const auto letterIndex = String ("CDEFGAB").indexOfChar (letter);
+
+        if (letterIndex < 0)
+            return -1;
+
+        constexpr int naturals[] = { 0, 2, 4, 5, 7, 9, 11 };
+        auto tonic = naturals[letterIndex];
+        auto rest = t.substring (1);
+
+        if (rest.startsWith ("#"))          { ++tonic; rest = rest.substring (1); }
+        else if (rest.startsWith ("b"))     { --tonic; rest = rest.substring (1); }
+
+        tonic = (tonic + 12) % 12;
+
+        if (rest.isEmpty() || rest == "M" || rest.equalsIgnoreCase ("maj") || rest.equalsIgnoreCase ("major"))
+            return tonic;
+
+        if (rest == "m" || rest.equalsIgnoreCase ("min") || rest.equalsIgnoreCase ("minor"))
+            return tonic + 12;
+
+        return -1;
+    }
+
+    /** The MIREX key-finding score: how much credit a detected key gets against the true one. */
+    static double getMirexScore (int detected, int truth)
+    {
+        if (detected < 0 || truth < 0)
+            return 0.0;
+
+        if (detected == truth)
+            return 1.0;
+
+        const auto detectedTonic = detected % 12, truthTonic = truth % 12;
+        const auto sameMode = (detected < 12) == (truth < 12);
+
+        if (sameMode && (detectedTonic == (truthTonic + 7) % 12 || truthTonic == (detectedTonic + 7) % 12))
+            return 0.5;
+
+        // Relative: the minor tonic is three semitones below the major one.
+        const auto majorTonic = truth < 12 ? truthTonic : detectedTonic;
+        const auto minorTonic = truth < 12 ? detectedTonic : truthTonic;
+
+        if (! sameMode && (majorTonic + 9) % 12 == minorTonic)
+            return 0.3;
+
+        if (! sameMode && detectedTonic == truthTonic)
+            return 0.2;
+
+        return 0.0;
+    }
+
+    /** The key one setting finds in a file's events (time stamps in seconds), or -1. */
+    static int detect (const std::vector<MidiMessage>& events, double length, const Config& config, const MidiKeyFinder& finder)
+    {
+        constexpr double frameSeconds = 0.5;
+
+        const auto end = config.windowSeconds > 0.0 ? jmin (length, config.windowSeconds) : length;
+        const auto decay = config.halfLife > 0.0 ? (float) std::exp2 (-frameSeconds / config.halfLife) : 1.0f;
+
+        VoiceTable voices;
+        MidiKeyFinder::Histogram counts {}, totalsAtLastFrame {}, profile {};
+
+        // Old evidence fades a frame at a time.
+        auto closeFrame = [&] (double time)
+        {
+            const auto totals = config.evidence == Evidence::durations ? voices.getEvidence (time) : counts;
+
+            for (size_t pc = 0; pc < 12; ++pc)
+                profile[pc] = profile[pc] * decay + jmax (0.0f, totals[pc] - totalsAtLastFrame[pc]);
+
+            totalsAtLastFrame = totals;
+        };
+
+        auto frameEnd = frameSeconds;
+
+        for (const auto& m : events)
+        {
+            const auto time = m.getTimeStamp();
+
+            if (time >= end)
+                break;
+
+            for (; frameEnd <= time; frameEnd += frameSeconds)
+                closeFrame (frameEnd);
+
+            if (config.evidence == Evidence::durations)
+                voices.handle (m, time);
+            else if (m.isNoteOn())
+                counts[(size_t) (m.getNoteNumber() % 12)] += 1.0f;
+        }
+
+        for (; frameEnd < end; frameEnd += frameSeconds)
+            closeFrame (frameEnd);
+
+        closeFrame (end);
+
+        if (config.method == Method::scaleSets)
+        {
+            MidiKeyFinder::RankedKey best;
+
+            if (finder.rank_keys (profile, &best, 1) != 1)
+                return -1;
+
+            return MidiKeyFinder::get_key_tonic (best.index) + (MidiKeyFinder::is_minor_key (best.index) ? 12 : 0);
+        }
+
+        const auto correlations = OfflineKeyAnalyser::correlate (profile, config.method == Method::temperley
+                                                                              ? OfflineKeyAnalyser::Profiles::temperley
+                                                                              : OfflineKeyAnalyser::Profiles::krumhanslKessler);
+
+        const auto best = std::max_element (correlations.begin(), correlations.end());
+        return *best > 0.0f ? (int) std::distance (correlations.begin(), best) : -1;
+    }
+
+private:
+    static const char* getMethodName (Method method)
+    {
+        switch (method)
+        {
+            case Method::scaleSets:         return "scale sets";
+            case Method::krumhanslKessler:  return "Krumhansl";
+            case Method::temperley:         return "Temperley";
+        }
+
+        return "";
+    }
+
+    // Lower-cased file name -> key.
+    static std::map<String, int> readLabels (const File& file)
+    {
+        std::map<String, int> labels;
+
+        if (! file.existsAsFile())
+            return labels;
+
+        StringArray lines;
+        file.readLines (lines);
+
+        for (const auto& line : lines)
+        {
+            if (line.trim().isEmpty() || line.trimStart().startsWithChar ('#'))
+                continue;
+
+            const auto separator = line.containsChar ('\t') ? "\t" : ",";
+            const auto key = parseKey (line.fromLastOccurrenceOf (separator, false, false));
+
+            if (key >= 0)
+                labels[line.upToLastOccurrenceOf (separator, false, false).trim().toLowerCase()] = key;
+        }
+
+        return labels;
+    }
+
+    // Every channel message in time order (seconds), the length, and the first key signature.
+    static bool readFile (const File& file, std::vector<MidiMessage>& events, double& length, int& keySignature)
+    {
+        FileInputStream stream (file);
+        MidiFile midiFile;
+
+        if (! stream.openedOk() || ! midiFile.readFrom (stream))
+            return false;
+
+        midiFile.convertTimestampTicksToSeconds();
+
+        MidiMessageSequence all;
+
+        for (int t = 0; t < midiFile.getNumTracks(); ++t)
+            all.addSequence (*midiFile.getTrack (t), 0.0);
+
+        for (const auto* holder : all)
+        {
+            const auto& m = holder->message;
+
+            if (keySignature < 0 && m.isKeySignatureMetaEvent())
+            {
+                const auto major = ((m.getKeySignatureNumberOfSharpsOrFlats() * 7) % 12 + 12) % 12;
+                keySignature = m.isKeySignatureMajorKey() ? major : (major + 9) % 12 + 12;
+            }
+
+            if (m.getChannel() > 0)
+                events.push_back (m);
+        }
+
+        length = all.getEndTime();
+        return true;
+    }
+};
@@ -0,0 +1,192 @@
+/*
+  ==============================================================================
+
+    The one rule for which key a performance is in, shared by the editor's
+    analysis (MidiKeyFinder), the headless stream (MidiKeyStream) and the
+    key output to the host (KeyChangeOutput), so they can't drift apart:
+
+      - rankKeys() scores the 24 keys on a pitch-class histogram: the
+        fraction of the weight inside the scale, then the weight on the
+        tonic triad to split relative majors and minors
+      - getEvidenceToRank() picks what to rank on: how long each pitch
+        class has sounded, or the note counts until anything has sounded
+        for any time
+      - a KeyFollower only moves to a new best key once it has stayed best
+        for holdNotes note-ons in a row, so a near-tie doesn't flip the key
+        on every note, and a locked key overrides the ranking altogether
+
+    Keys are numbered as in MidiKeyFinder: 0-11 are the minor keys from A
+    up in semitones, 12-23 the major keys round the circle of fifths from C.
+    Nothing allocates or locks.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+
+class KeyFollower
+{
+public:
+    using Histogram = std::array<float, 12>;    // per pitch class, 0 = C
+
+    static constexpr int numKeys = 24;
+
+    /** The tonic pitch class of each key. */
+    static constexpr std::array<int, numKeys> tonics { 9, 10, 11, 0, 1, 2, 3, 4, 5, 6, 7, 8,
+                                                       0, 7, 2, 9, 4, 11, 5, 10, 3, 8, 1, 6 };
+
+    static constexpr bool isMinor (int key) noexcept    { return key < 12; }
+
+    struct RankedKey
+    {
+        int key;
+        float score;            // fraction of the weight inside the scale
+        float tonicWeight;      // fraction of the weight on the tonic triad
+    };
+
+    /** Ranks every key and writes the best maxResults into results, best first. Returns the
+        number written, 0 if the histogram is empty.
+    */
+    static int rankKeys (const Histogram& h, RankedKey* results, int maxResults) noexcept
+    {
+        using Scale = EdoScale<12>;
+        float total = 0.0f;
+
+        for (auto w : h)
+            total += w;
+
+        if (total <= 0.0f || maxResults <= 0)
+            return 0;
+
+        std::array<RankedKey, numKeys> ranked;
+
+        for (int key = 0; key < numKeys; ++key)
+        {
+            const auto tonic = tonics[(size_t) key];
+            const auto minor = isMinor (key);
+            ranked[(size_t) key] = { key, Scale::getInScaleWeight (h, tonic, minor) / total,
+                                     Scale::getTonicTriadWeight (h, tonic, minor) / total };
+        }
+
+        const auto num = jmin (maxResults, numKeys);
+        std::partial_sort (ranked.begin(), ranked.begin() + num, ranked.end(), [] (const RankedKey& a, const RankedKey& b)
+        {
+            return a.score != b.score ? a.score > b.score : a.tonicWeight > b.tonicWeight;
+        });
+
+        std::copy (ranked.begin(), ranked.begin() + num, results);
+        return num;
+    }
+
+    /** The durations, unless nothing has sounded for any time yet (the first notes, or
+        everything arriving at once), in which case the note counts.
+    */
+    static const Histogram& getEvidenceToRank (const Histogram& durations, const Histogram& counts) noexcept
+    {
+        return std::any_of (durations.begin(), durations.end(), [] (float w) { return w > 0.0f; }) ? durations : counts;
+    }
+
+    //==============================================================================
+    explicit KeyFollower (int holdNotesToUse = 4)    { setHoldNotes (holdNotesToUse); }
+
+    void setHoldNotes (int numNoteOns)              { holdNotes = jmax (1, numNoteOns); }
+
+    /** A key (as above) to report instead of following the ranking, or -1 to follow it
+        again. Takes effect at the next update().
+    */
+    void setLockedKey (int key)                     { lockedKey = isPositiveAndBelow (key, numKeys) ? key : -1; }
+    int getLockedKey() const noexcept               { return lockedKey; }
+
+    /** Call after each event. Returns true if the key followed has changed, which getKey()
+        and getScore() then describe.
+    */
+    bool update (const Histogram& evidence, bool isNoteOn) noexcept
+    {
+        if (lockedKey >= 0)
+        {
+            candidateKey = -1;
+
+            if (lockedKey == currentKey)
+                return false;
+
+            currentKey = lockedKey;
+            currentScore = getScore (evidence, lockedKey);
+            return true;
+        }
+
+        RankedKey best;
+
+        if (rankKeys (evidence, &best, 1) != 1 || best.key == currentKey)
+        {
+            candidateKey = -1;
+            return false;
+        }
+
+        if (best.key != candidateKey)
+        {
+            candidateKey = best.key;
+            candidateNotes = 0;
+        }
+
+        candidateNotes += isNoteOn ? 1 : 0;
+
+        if (candidateNotes < holdNotes)
+            return false;
+
+        currentKey = best.key;
+        currentScore = best.score;
+        candidateKey = -1;
+        return true;
+    }
+
+    /** Takes the best key (or the locked one) at once, without the hold: for evidence put
+        back from a saved state rather than played. Returns true if the key followed has changed.
+    */
+    bool settle (const Histogram& evidence) noexcept
+    {
+        if (lockedKey >= 0)
+            return update (evidence, false);
+
+        const auto before = currentKey;
+        RankedKey best;
+        candidateKey = -1;
+
+        if (rankKeys (evidence, &best, 1) == 1)
+        {
+            currentKey = best.key;
+            currentScore = best.score;
+        }
+
+        return currentKey != before;
+    }
+
+    /** The key followed, -1 before the first one. */
+    int getKey() const noexcept                     { return currentKey; }
+    float getScore() const noexcept                 { return currentScore; }
+
+    /** Forgets the key followed; the lock stays. */
+    void reset() noexcept
+    {
+        currentKey = candidateKey = -1;
+        candidateNotes = 0;
+        currentScore = 0.0f;
+    }
+
+private:
+    static float getScore (const Histogram& h, int key) noexcept
+    {
+        float total = 0.0f;
+
+        for (auto w : h)
+            total += w;
+
+        return total > 0.0f ? EdoScale<12>::getInScaleWeight (h, tonics[(size_t) key], isMinor (key)) / total : 0.0f;
+    }
+
+    int holdNotes = 4, lockedKey = -1;
+    int currentKey = -1, candidateKey = -1, candidateNotes = 0;
+    float currentScore = 0.0f;
+};
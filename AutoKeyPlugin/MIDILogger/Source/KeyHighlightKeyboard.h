@@ -0,0 +1,175 @@
+/*
+  ==============================================================================
+
+    The on-screen keyboard, with the detected key shown on it: notes in the
+    scale tinted, the others shaded, and the tonic marked.
+
+    The overlay for a key is rendered once into an image, at the screen's
+    pixel scale, and cached per key until the keyboard's size or scroll
+    position changes. paint() composites it over the normal keyboard, so the
+    cost of a frame stays that of the clip region being repainted. Key
+    presses keep MidiKeyboardComponent's own note-by-note repaints, and a
+    change of key repaints only the notes whose tint changed - never the
+    whole keyboard for a note.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+class KeyHighlightKeyboard  : public MidiKeyboardComponent
+{
+public:
+    KeyHighlightKeyboard (MidiKeyboardState& state, Orientation orientation)
+        : MidiKeyboardComponent (state, orientation)
+    {
+    }
+
+    /** tonic is a pitch class (0 = C); a negative tonic takes the highlighting off. */
+    void setKey (int tonic, bool minor)
+    {
+        const auto newKey = tonic < 0 ? -1 : tonic % 12 + (minor ? 12 : 0);
+
+        if (newKey == key)
+            return;
+
+        const auto before = getTints (key);
+        const auto after = getTints (newKey);
+        key = newKey;
+
+        for (int note = getRangeStart(); note <= getRangeEnd(); ++note)
+        {
+            if (before[(size_t) (note % 12)] != after[(size_t) (note % 12)])
+                repaint (getRectangleForKey (note).getSmallestIntegerContainer());
+        }
+    }
+
+    void paint (Graphics& g) override
+    {
+        MidiKeyboardComponent::paint (g);
+
+        if (key < 0)
+            return;
+
+        const auto scale = (float) g.getInternalContext().getPhysicalPixelScaleFactor();
+        g.drawImageTransformed (getOverlay (key, scale), AffineTransform::scale (1.0f / scale));
+    }
+
+private:
+    enum Tint : uint8
+    {
+        none = 0,
+        outOfScale,
+        inScale,
+        tonic
+    };
+
+    using Tints = std::array<Tint, 12>;
+
+    static Tints getTints (int keyIndex)
+    {
+        Tints tints {};
+
+        if (keyIndex < 0)
+            return tints;
+
+        const auto tonicClass = keyIndex % 12;
+        const auto& degrees = keyIndex >= 12 ? EdoScale<12>::minorDegrees : EdoScale<12>::majorDegrees;
+        tints.fill (outOfScale);
+
+        for (auto degree : degrees)
+            tints[(size_t) ((tonicClass + degree) % 12)] = inScale;
+
+        tints[(size_t) tonicClass] = tonic;
+        return tints;
+    }
+
+    // Where the overlays were drawn for; they're thrown away when any of it changes.
+    struct Layout
+    {
+        int width = 0, height = 0, lowestKey = 0;
+        float keyWidth = 0.0f, scale = 0.0f;
+
+        bool operator== (const Layout& other) const
+        {
+            return width == other.width && height == other.height && lowestKey == other.lowestKey
+                && keyWidth == other.keyWidth && scale == other.scale;
+        }
+    };
+
+    const Image& getOverlay (int keyIndex, float scale)
+    {
+        const Layout layout { getWidth(), getHeight(), getLowestVisibleKey(), getKeyWidth(), scale };
+
+        if (! (layout == overlayLayout))
+        {
+            overlays = {};
+            overlayLayout = layout;
+        }
+
+        auto& overlay = overlays[(size_t) keyIndex];
+
+        if (overlay.isNull())
+            overlay = renderOverlay (keyIndex, scale);
+
+        return overlay;
+    }
+
+    Image renderOverlay (int keyIndex, float scale) const
+    {
+        Image image (Image::ARGB, jmax (1, roundToInt ((float) getWidth() * scale)),
+                     jmax (1, roundToInt ((float) getHeight() * scale)), true);
+        Graphics g (image);
+        g.addTransform (AffineTransform::scale (scale));
+
+        const auto tints = getTints (keyIndex);
+
+        for (int note = getRangeStart(); note <= getRangeEnd(); ++note)
+        {
+            const auto area = getRectangleForKey (note);
+            const auto tint = tints[(size_t) (note % 12)];
+            Graphics::ScopedSaveState state (g);
+
+            // A white key's rectangle runs under its black neighbours, which get their own tint.
+            if (! MidiMessage::isMidiNoteBlack (note))
+            {
+                for (auto neighbour : { note - 1, note + 1 })
+                {
+                    if (isPositiveAndBelow (neighbour, 128) && MidiMessage::isMidiNoteBlack (neighbour))
+                        g.excludeClipRegion (getRectangleForKey (neighbour).getSmallestIntegerContainer());
+                }
+            }
+
+            g.setColour (tint == outOfScale ? Colours::black.withAlpha (0.18f) : Colours::limegreen.withAlpha (0.22f));
+            g.fillRect (area);
+
+            if (tint == tonic)
+            {
+                g.setColour (Colours::darkorange);
+                g.fillEllipse (getTonicMarkArea (area));
+            }
+        }
+
+        return image;
+    }
+
+    // A dot towards the playing end of the key.
+    Rectangle<float> getTonicMarkArea (Rectangle<float> key) const
+    {
+        const auto size = jmin (key.getWidth(), key.getHeight()) * 0.5f;
+        const auto inset = size * 0.5f;
+        const auto dot = Rectangle<float> (size, size);
+
+        switch (getOrientation())
+        {
+            case verticalKeyboardFacingRight:   return dot.withCentre ({ key.getRight() - inset - size * 0.5f, key.getCentreY() });
+            case verticalKeyboardFacingLeft:    return dot.withCentre ({ key.getX() + inset + size * 0.5f, key.getCentreY() });
+            case horizontalKeyboard:
+            default:                            return dot.withCentre ({ key.getCentreX(), key.getBottom() - inset - size * 0.5f });
+        }
+    }
+
+    int key = -1;                           // tonic + 12 for minor, -1 for none
+    std::array<Image, 24> overlays;         // rendered on first use, per key
+    Layout overlayLayout;
+};
@@ -0,0 +1,188 @@
+/*
+  ==============================================================================
+
+    Key evidence over several window lengths at once - the last bar, the
+    last eight bars, the whole song - from the one analysis pass.
+
+    The VoiceTable already keeps running totals (seconds sounded per pitch
+    class since the last reset), which are prefix sums. This keeps a ring of
+    checkpoints of those totals, so the evidence for any window ending now
+    is the current totals minus the totals at the window's start,
+    interpolated between the two checkpoints around it. Each window costs a
+    binary search and a few 12-element vector operations, not another
+    analyser.
+
+    Windows are measured in bars, at the host's tempo. The ring has a fixed
+    number of checkpoints, spaced to cover the longest window. Message thread
+    only.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <vector>
+
+class KeyWindows
+{
+public:
+    using Evidence = VoiceTable::Evidence;
+
+    static constexpr int maxWindows = 8;
+    static constexpr int numCheckpoints = 256;
+    static constexpr double minCheckpointInterval = 0.25;  // seconds
+
+    /** Window lengths in bars, in any order. 0 means everything since the reset. */
+    void setLengths (const std::vector<float>& bars)
+    {
+        lengths.clear();
+
+        for (auto length : bars)
+        {
+            if (std::isfinite (length) && length >= 0.0f && (int) lengths.size() < maxWindows)
+                lengths.push_back (length);
+        }
+
+        updateInterval();
+    }
+
+    const std::vector<float>& getLengths() const    { return lengths; }
+    int getNumWindows() const                       { return (int) lengths.size(); }
+
+    void setSecondsPerBar (double seconds)
+    {
+        if (seconds > 0.0 && seconds != secondsPerBar)
+        {
+            secondsPerBar = seconds;
+            updateInterval();
+        }
+    }
+
+    double getSeconds (int index) const     { return lengths[(size_t) index] * secondsPerBar; }
+
+    /** e.g. "Last bar", "Last 8 bars", "Whole song". */
+    String getName (int index) const
+    {
+        const auto bars = lengths[(size_t) index];
+
+        if (bars <= 0.0f)
+            return "Whole song";
+
+        if (bars == 1.0f)
+            return "Last bar";
+
+        return "Last " + String (bars, bars == std::floor (bars) ? 0 : 1) + " bars";
+    }
+
+    /** Call as time moves on (e.g. for every event) with a function returning the running
+        totals as of 'time'. It's only called when a checkpoint is due.
+    */
+    template <typename GetTotals>
+    void advance (double time, GetTotals&& getTotals)
+    {
+        if (! needsCheckpoints || (numStored > 0 && time < newest().time + interval))
+            return;
+
+        if (ring.empty())
+            ring.resize (numCheckpoints);
+
+        const auto slot = (first + numStored) % numCheckpoints;
+        ring[(size_t) slot] = { time, getTotals() };
+
+        if (numStored < numCheckpoints)
+            ++numStored;
+        else
+            first = (first + 1) % numCheckpoints;
+
+        hasWrapped |= first != 0;
+    }
+
+    /** The evidence inside window 'index', given the running totals as of 'time'. */
+    Evidence getEvidence (int index, const Evidence& totals, double time) const
+    {
+        const auto seconds = getSeconds (index);
+
+        if (seconds <= 0.0 || numStored == 0)
+            return totals;
+
+        const auto base = getTotalsAt (time - seconds);
+        Evidence e;
+
+        for (size_t pc = 0; pc < e.size(); ++pc)
+            e[pc] = jmax (0.0f, totals[pc] - base[pc]);
+
+        return e;
+    }
+
+    /** Forgets the checkpoints, for when the running totals start again from zero. */
+    void reset()
+    {
+        first = numStored = 0;
+        hasWrapped = false;
+    }
+
+    size_t getMemoryUsed() const    { return ring.capacity() * sizeof (Checkpoint) + lengths.capacity() * sizeof (float); }
+
+private:
+    struct Checkpoint
+    {
+        double time;
+        Evidence totals;
+    };
+
+    const Checkpoint& at (int i) const      { return ring[(size_t) ((first + i) % numCheckpoints)]; }
+    const Checkpoint& newest() const        { return at (numStored - 1); }
+
+    // The running totals at a past time, interpolated between checkpoints. Before the
+    // first checkpoint they're zero; once the ring has wrapped, the oldest one is as far
+    // back as it goes.
+    Evidence getTotalsAt (double time) const
+    {
+        // First checkpoint after 'time'.
+        int lo = 0, hi = numStored;
+
+        while (lo < hi)
+        {
+            const auto mid = (lo + hi) / 2;
+
+            if (at (mid).time <= time)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        if (lo == 0)
+            return hasWrapped ? at (0).totals : Evidence {};
+
+        const auto& a = at (lo - 1);
+
+        if (lo == numStored)
+            return a.totals;
+
+        const auto& b = at (lo);
+        const auto t = (float) ((time - a.time) / jmax (b.time - a.time, 1.0e-9));
+        Evidence e;
+
+        for (size_t pc = 0; pc < e.size(); ++pc)
+            e[pc] = a.totals[pc] + (b.totals[pc] - a.totals[pc]) * t;
+
+        return e;
+    }
+
+    // Spaced so the ring reaches back at least as far as the longest window.
+    void updateInterval()
+    {
+        const auto longest = lengths.empty() ? 0.0f : *std::max_element (lengths.begin(), lengths.end());
+        interval = jmax (minCheckpointInterval, longest * secondsPerBar / (numCheckpoints - 2));
+        needsCheckpoints = longest > 0.0f;
+    }
+
+    std::vector<float> lengths;
+    double secondsPerBar = 2.0;             // 4/4 at 120 bpm until the host says otherwise
+    double interval = minCheckpointInterval;
+    bool needsCheckpoints = false;          // only whole-song windows don't need any
+
+    std::vector<Checkpoint> ring;           // allocated by the first checkpoint
+    int first = 0, numStored = 0;
+    bool hasWrapped = false;
+};
@@ -9,8 +9,19 @@
 #include <JuceHeader.h>
 #include "MidiLoggerPluginDemo.h"
 
+#if JucePlugin_Build_Standalone && JUCE_USE_CUSTOM_PLUGIN_STANDALONE_APP
+ #include "AutoKeyStandaloneApp.h"
+#endif
+
 //==============================================================================
 juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
 {
     return new MidiLoggerPluginDemoProcessor();
 }
+
+#if JucePlugin_Build_Standalone && JUCE_USE_CUSTOM_PLUGIN_STANDALONE_APP
+juce::JUCEApplicationBase* juce_CreateApplication()
+{
+    return new AutoKeyStandaloneApp();
+}
+#endif
@@ -0,0 +1,228 @@
+/*
+  ==============================================================================
+
+    Listens to any number of MIDI input devices at once and merges them into
+    a single timestamp-ordered stream.
+
+    Each device gets its own slot with a single-producer/single-consumer
+    AbstractFifo, so device callback threads never contend with each other or
+    with the consumer. Devices can be added and removed while the others keep
+    streaming. setInputs() and popMerged() must be called from the same
+    thread (the message thread in the plugin).
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+
+class MergedMidiInput
+{
+public:
+    /** A short MIDI message with its device timestamp (seconds). SysEx is not carried. */
+    struct Event
+    {
+        double timeStamp;
+        uint8 data[3];
+        uint8 size;
+        uint8 slot;
+    };
+
+    static constexpr int maxInputs = 32;
+
+    explicit MergedMidiInput (AudioDeviceManager& dm) : deviceManager (dm) {}
+
+    ~MergedMidiInput()      { setInputs ({}); }
+
+    /** Listens to exactly these devices, enabling them if necessary. Devices that were
+        already open keep their slot and are not interrupted.
+    */
+    void setInputs (const Array<MidiDeviceInfo>& devices)
+    {
+        for (auto& slot : slots)
+        {
+            if (slot == nullptr || slot->identifier.isEmpty())
+                continue;
+
+            const auto stillWanted = std::any_of (devices.begin(), devices.end(),
+                                                  [&] (const MidiDeviceInfo& d) { return d.identifier == slot->identifier; });
+
+            if (! stillWanted)
+            {
+                // Once this returns the device thread can no longer be inside the slot's callback.
+                deviceManager.removeMidiInputDeviceCallback (slot->identifier, slot.get());
+                slot->identifier = {};
+                slot->name = {};
+                slot->fifo.reset();
+            }
+        }
+
+        for (const auto& device : devices)
+        {
+            if (findSlot (device.identifier) != nullptr)
+                continue;
+
+            auto* slot = claimSlot();
+
+            if (slot == nullptr)
+                break;
+
+            slot->identifier = device.identifier;
+            slot->name = device.name;
+
+            if (! deviceManager.isMidiInputDeviceEnabled (device.identifier))
+                deviceManager.setMidiInputDeviceEnabled (device.identifier, true);
+
+            deviceManager.addMidiInputDeviceCallback (device.identifier, slot);
+        }
+    }
+
+    /** Calls onEvent (const Event&) for everything received since the last call, oldest first
+        across all devices.
+    */
+    template <typename Callback>
+    void popMerged (Callback&& onEvent)
+    {
+        struct Cursor { Slot* slot; int start1, size1, start2, size2, taken; };
+        Cursor cursors[maxInputs];
+        int numCursors = 0;
+
+        for (auto& slot : slots)
+        {
+            if (slot == nullptr)
+                continue;
+
+            Cursor c { slot.get(), 0, 0, 0, 0, 0 };
+            slot->fifo.prepareToRead (slot->fifo.getNumReady(), c.start1, c.size1, c.start2, c.size2);
+
+            if (c.size1 + c.size2 > 0)
+                cursors[numCursors++] = c;
+        }
+
+        auto eventAt = [] (const Cursor& c) -> const Event&
+        {
+            const auto index = c.taken < c.size1 ? c.start1 + c.taken : c.start2 + (c.taken - c.size1);
+            return c.slot->events[(size_t) index];
+        };
+
+        for (;;)
+        {
+            Cursor* next = nullptr;
+
+            for (int i = 0; i < numCursors; ++i)
+            {
+                auto& c = cursors[i];
+
+                if (c.taken < c.size1 + c.size2
+                     && (next == nullptr || eventAt (c).timeStamp < eventAt (*next).timeStamp))
+                    next = &c;
+            }
+
+            if (next == nullptr)
+                break;
+
+            onEvent (eventAt (*next));
+            ++next->taken;
+        }
+
+        for (int i = 0; i < numCursors; ++i)
+            cursors[i].slot->fifo.finishedRead (cursors[i].taken);
+    }
+
+    /** Name of the device that produced an event from the given slot. */
+    String getSlotName (int slot) const
+    {
+        return isPositiveAndBelow (slot, maxInputs) && slots[(size_t) slot] != nullptr ? slots[(size_t) slot]->name : String();
+    }
+
+    int getNumOpenInputs() const
+    {
+        return (int) std::count_if (slots.begin(), slots.end(),
+                                    [] (const std::unique_ptr<Slot>& s) { return s != nullptr && s->identifier.isNotEmpty(); });
+    }
+
+    /** Events lost because a device's queue was full, and SysEx messages that were not queued. */
+    uint64 getNumDropped() const    { return sumCounters (&Slot::numDropped); }
+    uint64 getNumSysExSkipped() const  { return sumCounters (&Slot::numSysExSkipped); }
+
+private:
+    struct Slot  : public MidiInputCallback
+    {
+        explicit Slot (uint8 i) : index (i) {}
+
+        void handleIncomingMidiMessage (MidiInput*, const MidiMessage& m) override
+        {
+            const auto size = m.getRawDataSize();
+
+            if (size > 3)
+            {
+                numSysExSkipped.fetch_add (1, std::memory_order_relaxed);
+                return;
+            }
+
+            if (fifo.getFreeSpace() == 0)
+            {
+                numDropped.fetch_add (1, std::memory_order_relaxed);
+                return;
+            }
+
+            fifo.write (1).forEach ([&] (int dest)
+            {
+                auto& e = events[(size_t) dest];
+                e.timeStamp = m.getTimeStamp();
+                std::memcpy (e.data, m.getRawData(), (size_t) size);
+                e.size = (uint8) size;
+                e.slot = index;
+            });
+        }
+
+        static constexpr int capacity = 1 << 12;
+
+        const uint8 index;
+        String identifier, name;        // only touched by the consumer thread
+        AbstractFifo fifo { capacity };
+        std::vector<Event> events = std::vector<Event> (capacity);
+        std::atomic<uint64> numDropped { 0 }, numSysExSkipped { 0 };
+    };
+
+    Slot* findSlot (const String& identifier) const
+    {
+        for (auto& slot : slots)
+            if (slot != nullptr && slot->identifier == identifier)
+                return slot.get();
+
+        return nullptr;
+    }
+
+    Slot* claimSlot()
+    {
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            if (slots[i] == nullptr)
+                slots[i] = std::make_unique<Slot> ((uint8) i);
+
+            if (slots[i]->identifier.isEmpty())
+                return slots[i].get();
+        }
+
+        return nullptr;
+    }
+
+    uint64 sumCounters (std::atomic<uint64> Slot::* counter) const
+    {
+        uint64 total = 0;
+
+        for (auto& slot : slots)
+            if (slot != nullptr)
+                total += ((*slot).*counter).load (std::memory_order_relaxed);
+
+        return total;
+    }
+
+    AudioDeviceManager& deviceManager;
+    std::array<std::unique_ptr<Slot>, maxInputs> slots;
+
+    JUCE_DECLARE_NON_COPYABLE (MergedMidiInput)
+};
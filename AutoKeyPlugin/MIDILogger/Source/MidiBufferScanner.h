@@ -0,0 +1,105 @@
+/*
+  ==============================================================================
+
+    Walks a MidiBuffer's raw events without building a MidiMessage for each
+    one, keeping only what the analysis can use: notes, controllers (the
+    pedals, RPNs, all-notes-off), pitch bend and MIDI Tuning Standard SysEx.
+    Clock, active sensing, aftertouch, program changes and other SysEx are
+    counted and skipped, or passed on marked as ignored when the caller
+    needs the stream as it came (the session journal does).
+
+    Classification is a table lookup on the status nibble, and the kept
+    events are compacted into fixed-size batches without a branch per event,
+    so the caller can move a whole batch at once.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <array>
+
+namespace MidiBufferScanner
+{
+    enum Kind : uint8
+    {
+        ignored = 0,
+        noteOff,
+        noteOn,
+        controller,
+        pitchBend,
+        tuningSysEx
+    };
+
+    static constexpr std::array<uint8, 16> kindForStatusNibble
+    {
+        ignored, ignored, ignored, ignored, ignored, ignored, ignored, ignored,
+        noteOff,        // 8x
+        noteOn,         // 9x (velocity 0 is still a note-off to whoever reads it)
+        ignored,        // Ax polyphonic aftertouch
+        controller,     // Bx
+        ignored,        // Cx program change
+        ignored,        // Dx channel pressure
+        pitchBend,      // Ex
+        tuningSysEx     // Fx, narrowed down below
+    };
+
+    // Bulk tuning dumps are the largest MTS messages, at 408 bytes.
+    static constexpr int maxTuningSysExSize = 1024;
+
+    inline Kind classify (const uint8* data, int size) noexcept
+    {
+        const auto kind = (Kind) kindForStatusNibble[data[0] >> 4];
+
+        if (kind != tuningSysEx)
+            return kind;
+
+        // The only system message kept: F0 7E/7F <device> 08 ...
+        const auto isTuning = data[0] == 0xf0 && size > 4 && size <= maxTuningSysExSize
+                               && (data[1] & 0xfe) == 0x7e && data[3] == 0x08;
+        return isTuning ? tuningSysEx : ignored;
+    }
+
+    /** A kept event. data points into the MidiBuffer and is only valid during the callback. */
+    struct Event
+    {
+        const uint8* data;
+        int32 samplePosition;
+        int32 size;
+        Kind kind;
+    };
+
+    static constexpr int batchSize = 128;
+
+    /** Calls onBatch (const Event* events, int numEvents) for the kept events, in order, up to
+        batchSize at a time. With keepIgnored every event is passed on, the ones the analysis
+        has no use for with kind == ignored. Returns the number of those, passed on or not.
+    */
+    template <typename Callback>
+    int scan (const MidiBuffer& buffer, Callback&& onBatch, bool keepIgnored = false)
+    {
+        // Skipped events are written too and then overwritten by the next one.
+        Event batch[batchSize];
+        int numInBatch = 0, numIgnored = 0;
+
+        for (const auto metadata : buffer)
+        {
+            const auto kind = metadata.numBytes > 0 ? classify (metadata.data, metadata.numBytes) : ignored;
+
+            batch[numInBatch] = { metadata.data, (int32) metadata.samplePosition, (int32) metadata.numBytes, kind };
+            numInBatch += kind != ignored || keepIgnored ? 1 : 0;
+            numIgnored += kind != ignored ? 0 : 1;
+
+            if (numInBatch == batchSize)
+            {
+                onBatch ((const Event*) batch, numInBatch);
+                numInBatch = 0;
+            }
+        }
+
+        if (numInBatch > 0)
+            onBatch ((const Event*) batch, numInBatch);
+
+        return numIgnored;
+    }
+}
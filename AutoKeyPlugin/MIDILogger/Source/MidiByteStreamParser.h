@@ -0,0 +1,149 @@
+/*
+  ==============================================================================
+
+    Incremental parser for raw MIDI 1.0 byte streams.
+
+    Bytes can arrive in arbitrarily sized chunks (socket reads, pipe reads,
+    hex payloads). Running status, interleaved realtime bytes and SysEx are
+    handled; every complete short message is handed to a callback as
+    (data, size) without building a MidiMessage.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class MidiByteStreamParser
+{
+public:
+    void reset()
+    {
+        runningStatus = 0;
+        numPending = 0;
+        numExpected = 0;
+        inSysEx = false;
+    }
+
+    /** Feeds the next chunk of the stream. onMessage is called as
+        onMessage (const uint8_t* data, int size) for every complete message.
+    */
+    template <typename Callback>
+    void push (const uint8_t* data, size_t numBytes, Callback&& onMessage)
+    {
+        for (size_t i = 0; i < numBytes; ++i)
+        {
+            const auto byte = data[i];
+
+            if (byte >= 0xf8)
+            {
+                // Realtime messages can appear anywhere, even inside another message.
+                onMessage (&byte, 1);
+                continue;
+            }
+
+            if (byte & 0x80)
+            {
+                const auto endsSysEx = inSysEx;
+                inSysEx = false;
+
+                if (byte == 0xf7)
+                {
+                    if (endsSysEx)
+                        ++numSysExSkipped;
+
+                    runningStatus = 0;
+                    numPending = 0;
+                    continue;
+                }
+
+                // Any other status byte cuts a SysEx short.
+                if (endsSysEx)
+                    ++numSysExDropped;
+
+                if (byte == 0xf0)
+                {
+                    inSysEx = true;
+                    runningStatus = 0;
+                    numPending = 0;
+                    continue;
+                }
+
+                numExpected = getNumDataBytes (byte);
+
+                if (numExpected < 0)
+                {
+                    runningStatus = 0;
+                    numPending = 0;
+                    continue;
+                }
+
+                // System common messages cancel running status.
+                runningStatus = byte < 0xf0 ? byte : 0;
+                pending[0] = byte;
+                numPending = 1;
+
+                if (numExpected == 0)
+                {
+                    onMessage (pending, 1);
+                    numPending = 0;
+                }
+
+                continue;
+            }
+
+            if (inSysEx)
+                continue;
+
+            if (numPending == 0)
+            {
+                if (runningStatus == 0)
+                {
+                    ++numStrayDataBytes;
+                    continue;
+                }
+
+                pending[0] = runningStatus;
+                numPending = 1;
+                numExpected = getNumDataBytes (runningStatus);
+            }
+
+            pending[numPending++] = byte;
+
+            if (numPending == numExpected + 1)
+            {
+                onMessage (pending, numPending);
+                numPending = 0;
+            }
+        }
+    }
+
+    /** Number of data bytes that follow a status byte, or -1 for undefined statuses. */
+    static int getNumDataBytes (uint8_t status) noexcept
+    {
+        if (status < 0xf0)
+            return (status & 0xe0) == 0xc0 ? 1 : 2;
+
+        switch (status)
+        {
+            case 0xf1: case 0xf3:   return 1;
+            case 0xf2:              return 2;
+            case 0xf6:              return 0;
+            default:                return -1;
+        }
+    }
+
+    uint64_t getNumStrayDataBytes() const noexcept   { return numStrayDataBytes; }
+    uint64_t getNumSysExSkipped() const noexcept     { return numSysExSkipped; }
+    uint64_t getNumSysExDropped() const noexcept     { return numSysExDropped; }
+
+private:
+    uint8_t pending[3] = {};
+    uint8_t runningStatus = 0;
+    int numPending = 0, numExpected = 0;
+    bool inSysEx = false;
+
+    uint64_t numStrayDataBytes = 0, numSysExSkipped = 0, numSysExDropped = 0;
+};
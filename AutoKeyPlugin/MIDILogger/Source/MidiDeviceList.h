@@ -0,0 +1,112 @@
+/*
+  ==============================================================================
+
+    Cached list of MIDI input devices.
+
+    Enumerating devices can block for a long time on systems with many
+    virtual ports, so it happens on a background thread. Everybody else reads
+    the cached copy and gets a change message (on the message thread) when
+    the set of devices differs from the previous scan. Hold it through a
+    SharedResourcePointer so all plugin instances share one scanner.
+
+    The scanning thread is detached and shares only the cache with the list.
+    Destroying the list lets go of it and returns at once; a scan still in
+    progress finishes on its own and the thread exits without reporting it.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+class MidiDeviceList  : public ChangeBroadcaster
+{
+public:
+    MidiDeviceList()
+        : scanner (std::make_shared<Scanner> (*this))
+    {
+        Thread::launch ([s = scanner] { s->run(); });
+    }
+
+    ~MidiDeviceList() override
+    {
+        scanner->release();
+    }
+
+    /** The devices found by the last completed scan (empty until the first one finishes). */
+    Array<MidiDeviceInfo> getDevices() const
+    {
+        const ScopedLock sl (scanner->lock);
+        return scanner->devices;
+    }
+
+    bool hasScanned() const
+    {
+        const ScopedLock sl (scanner->lock);
+        return scanner->scanned;
+    }
+
+    /** Asks for a scan now instead of waiting for the next periodic one. */
+    void rescan()    { scanner->wakeUp.signal(); }
+
+private:
+    // Owned jointly by the list and the thread, so whichever finishes last frees it.
+    struct Scanner
+    {
+        explicit Scanner (MidiDeviceList& listToNotify)  : owner (&listToNotify) {}
+
+        void run()
+        {
+            Thread::setCurrentThreadPriority (3);
+
+            while (isWanted())
+            {
+                auto found = MidiInput::getAvailableDevices();
+
+                {
+                    const ScopedLock sl (lock);
+
+                    if (owner == nullptr)
+                        return;
+
+                    const auto changed = ! scanned || found != devices;
+                    devices = std::move (found);
+                    scanned = true;
+
+                    // Only posts a message, so it's safe under the lock release() takes.
+                    if (changed)
+                        owner->sendChangeMessage();
+                }
+
+                wakeUp.wait (rescanIntervalMs);
+            }
+        }
+
+        bool isWanted() const
+        {
+            const ScopedLock sl (lock);
+            return owner != nullptr;
+        }
+
+        void release()
+        {
+            {
+                const ScopedLock sl (lock);
+                owner = nullptr;
+            }
+
+            wakeUp.signal();
+        }
+
+        CriticalSection lock;
+        MidiDeviceList* owner;      // null once the list has gone
+        Array<MidiDeviceInfo> devices;
+        bool scanned = false;
+        WaitableEvent wakeUp;
+    };
+
+    static constexpr int rescanIntervalMs = 2000;
+
+    std::shared_ptr<Scanner> scanner;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MidiDeviceList)
+};
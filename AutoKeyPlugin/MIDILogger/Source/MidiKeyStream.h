@@ -0,0 +1,300 @@
+/*
+  ==============================================================================
+
+    Headless key tagging of a raw MIDI 1.0 byte stream: stdin, a named pipe
+    or a file, with no editor, audio device or MIDI device.
+
+    Bytes are parsed incrementally (running status, realtime bytes, SysEx)
+    and every message goes straight into a MidiKeyFinder, timed by when its
+    bytes arrived. Keys are ranked on the last windowSeconds of evidence
+    (KeyWindows, over the finder's running totals) and followed by a
+    KeyFollower, so a new key has to stay best for holdNotes note-ons in a
+    row before it counts, as for the plugin's key output. Whenever the key
+    changes a JSON line is written to stdout:
+
+        {"time":12.402,"key":"E Major","index":16,"score":0.981,"latencyUs":38}
+
+    time is seconds since the stream opened, and latencyUs is from read()
+    returning the bytes that completed the message to the line being
+    written. Reads are at most readSize bytes and are processed completely
+    before the next one, so the work behind any line is bounded. The
+    latencies are summarised on stderr at the end of the stream.
+
+    When the bytes arrive all at once (a file, or a pipe from a generator)
+    nothing has sounded for any time yet, so keys are ranked by note counts
+    until there are durations to go on (KeyFollower::getEvidenceToRank). Only the key is wanted here, so the
+    finder keeps no chord progression, and memory stays flat however long
+    the stream runs.
+
+    SIGPIPE is ignored, so a reader that goes away ends the stream (or the
+    synthetic one) with a failed write instead of killing the process.
+    Linux and macOS only.
+
+    With ump set the stream is Universal MIDI Packets instead (MIDI 2.0,
+    big-endian 32-bit words, as they go over the wire). Each read is turned
+    into aligned words by UmpDecoder::Reader and decoded a batch at a time, so
+    velocities and per-note pitch weigh in at full resolution.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+class MidiKeyStream
+{
+public:
+    static constexpr int readSize = 4096;
+
+    struct Options
+    {
+        String path = "-";          // "-" for stdin
+        double windowSeconds = 16.0;  // 0 = everything since the stream opened
+        int holdNotes = 4;
+        bool ump = false;
+        std::function<bool()> shouldStop;
+    };
+
+    struct Report
+    {
+        uint64 numBytes = 0, numMessages = 0, numKeyChanges = 0, numStrayDataBytes = 0;  // stray bytes are MIDI 1.0 only
+        std::vector<double> latenciesUs;    // one per line written
+        String failure;
+
+        String toString() const
+        {
+            if (failure.isNotEmpty())
+                return "FAILED: " + failure;
+
+            auto sorted = latenciesUs;
+            std::sort (sorted.begin(), sorted.end());
+
+            auto percentile = [&] (double p)
+            {
+                return sorted.empty() ? 0.0 : sorted[(size_t) std::floor (p * (double) (sorted.size() - 1))];
+            };
+
+            return String ((int64) numBytes) + " bytes, " + String ((int64) numMessages) + " messages, "
+                 + String ((int64) numKeyChanges) + " key changes, " + String ((int64) numStrayDataBytes) + " stray data bytes\n"
+                 + "latency us: p50 " + String (percentile (0.5), 1) + "  p99 " + String (percentile (0.99), 1)
+                 + "  max " + String (sorted.empty() ? 0.0 : sorted.back(), 1);
+        }
+    };
+
+    static Report run (const Options& options)
+    {
+        Report report;
+        const auto fromStdin = options.path == "-";
+        std::signal (SIGPIPE, SIG_IGN);
+
+        // A named pipe blocks here until something opens it for writing.
+        const auto fd = fromStdin ? STDIN_FILENO : ::open (options.path.toRawUTF8(), O_RDONLY);
+
+        if (fd < 0)
+        {
+            report.failure = "Can't open " + options.path + ": " + String (std::strerror (errno));
+            return report;
+        }
+
+        MidiByteStreamParser parser;
+        MidiKeyFinder finder;
+        finder.set_progression_enabled (false);
+        KeyWindows window;
+        window.setSecondsPerBar (1.0);      // so the window's length is in seconds
+        window.setLengths ({ (float) jmax (0.0, options.windowSeconds) });
+
+        KeyFollower follower (options.holdNotes);
+        const auto startTicks = Time::getHighResolutionTicks();
+        uint8 buffer[readSize];
+        UmpDecoder::Reader<readSize> umpReader;
+
+        // After each event the analysis can use.
+        auto update = [&] (double arrivalTime, int64 arrivalTicks, bool isNoteOn)
+        {
+            window.advance (arrivalTime, [&] { return finder.get_evidence(); });
+
+            if (follower.update (getEvidenceToRank (finder, window), isNoteOn))
+            {
+                ++report.numKeyChanges;
+
+                if (! writeLine (arrivalTime, follower.getKey(), follower.getScore(), arrivalTicks, report))
+                    report.failure = "Write failed: " + String (std::strerror (errno));
+            }
+        };
+
+        while (report.failure.isEmpty())
+        {
+            if (options.shouldStop != nullptr && options.shouldStop())
+                break;
+
+            pollfd p { fd, POLLIN, 0 };
+
+            if (::poll (&p, 1, 100) == 0)
+                continue;
+
+            const auto numRead = ::read (fd, buffer, sizeof (buffer));
+
+            if (numRead < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+
+            if (numRead < 0)
+            {
+                report.failure = "Read failed: " + String (std::strerror (errno));
+                break;
+            }
+
+            if (numRead == 0)
+                break;
+
+            const auto arrivalTicks = Time::getHighResolutionTicks();
+            const auto arrivalTime = Time::highResolutionTicksToSeconds (arrivalTicks - startTicks);
+            report.numBytes += (uint64) numRead;
+
+            if (options.ump)
+            {
+                report.numMessages += (uint64) umpReader.push (buffer, (int) numRead, [&] (const UmpDecoder::Event& e)
+                {
+                    finder.add_ump_event (e, arrivalTime);
+                    update (arrivalTime, arrivalTicks, e.kind == UmpDecoder::noteOn);
+                });
+
+                continue;
+            }
+
+            parser.push (buffer, (size_t) numRead, [&] (const uint8_t* data, int size)
+            {
+                ++report.numMessages;
+                const MidiMessage m (data, size, arrivalTime);
+
+                if (! (m.isNoteOnOrOff() || m.isController()))
+                    return;
+
+                finder.add_midi_message (m);
+                update (arrivalTime, arrivalTicks, m.isNoteOn());
+            });
+        }
+
+        report.numStrayDataBytes = parser.getNumStrayDataBytes();
+
+        if (! fromStdin)
+            ::close (fd);
+
+        return report;
+    }
+
+    /** Writes raw MIDI to stdout in real time: a melody over a held fifth in C major, then
+        E major, then A minor. For piping into --stream. With ump set it's MIDI 2.0 packets,
+        with 16-bit velocities and a few cents of Pitch 7.9 on the melody. Stops early if
+        stdout stops taking bytes, e.g. because the reader has gone.
+    */
+    static void writeSyntheticStream (double secondsPerKey, const std::function<bool()>& shouldStop, bool ump = false)
+    {
+        static constexpr int keys[][7] = { { 0, 2, 4, 5, 7, 9, 11 }, { 4, 6, 8, 9, 11, 1, 3 }, { 9, 11, 0, 2, 4, 5, 7 } };
+        Random random (1);
+        uint8 runningStatus = 0;
+        std::signal (SIGPIPE, SIG_IGN);
+
+        auto send = [&] (uint8 status, uint8 a, uint8 b)
+        {
+            if (ump)
+            {
+                // Note on/off with a 16-bit velocity (velocity 0 becomes a note-off) and, on
+                // the melody, a pitch attribute within 20 cents of the note.
+                const auto on = b > 0;
+                const auto hasPitch = on && a >= 60;
+                const auto pitch = (uint32) (a * 512 + (hasPitch ? random.nextInt (205) - 102 : 0));
+                const uint32 words[2] = { 0x40000000u | (uint32) (on ? 0x9 : 0x8) << 20 | (uint32) (status & 0xf) << 16
+                                            | (uint32) a << 8 | (hasPitch ? 3u : 0u),
+                                          (on ? (uint32) (b * 516) << 16 : 0u) | (hasPitch ? pitch : 0u) };
+                uint8 bytes[8];
+
+                for (int i = 0; i < 2; ++i)
+                    ByteOrder::writeBigEndianInt (bytes + 4 * i, words[i]);
+
+                return writeAll (STDOUT_FILENO, bytes, sizeof (bytes));
+            }
+
+            // Running status, as most hardware sends it.
+            uint8 bytes[3] = { status, a, b };
+            const auto skip = status == runningStatus ? 1 : 0;
+            runningStatus = status;
+            return writeAll (STDOUT_FILENO, bytes + skip, (size_t) (3 - skip));
+        };
+
+        for (const auto& scale : keys)
+        {
+            const auto root = 48 + scale[0];
+
+            if (! (send (0x90, (uint8) root, 80) && send (0x90, (uint8) (root + 7), 80)))
+                return;
+
+            for (double t = 0.0; t < secondsPerKey; t += 0.25)
+            {
+                if (shouldStop != nullptr && shouldStop())
+                    return;
+
+                const auto note = (uint8) (60 + scale[random.nextInt (7)]);
+
+                if (! send (0x90, note, 90))
+                    return;
+
+                Thread::sleep (200);
+
+                if (! send (0x90, note, 0))     // note-on with velocity 0, so the status keeps running
+                    return;
+
+                Thread::sleep (50);
+            }
+
+            if (! (send (0x90, (uint8) root, 0) && send (0x90, (uint8) (root + 7), 0)))
+                return;
+        }
+    }
+
+private:
+    // write() can take less than it's given (a pipe that's nearly full, a signal), so this
+    // goes on until everything is out or there's an error.
+    static bool writeAll (int fd, const uint8* data, size_t size)
+    {
+        while (size > 0)
+        {
+            const auto numWritten = ::write (fd, data, size);
+
+            if (numWritten < 0 && errno == EINTR)
+                continue;
+
+            if (numWritten <= 0)
+                return false;
+
+            data += numWritten;
+            size -= (size_t) numWritten;
+        }
+
+        return true;
+    }
+
+    static MidiKeyFinder::Histogram getEvidenceToRank (const MidiKeyFinder& finder, const KeyWindows& window)
+    {
+        const auto evidence = window.getEvidence (0, finder.get_evidence(), finder.get_last_event_time());
+        return KeyFollower::getEvidenceToRank (evidence, finder.get_histogram());
+    }
+
+    static bool writeLine (double time, int key, float score, int64 arrivalTicks, Report& report)
+    {
+        char line[160];
+        const auto length = std::snprintf (line, sizeof (line), "{\"time\":%.3f,\"key\":\"%s\",\"index\":%d,\"score\":%.3f,\"latencyUs\":",
+                                           time, MidiKeyFinder::get_key_name (key), key, (double) score);
+
+        // The latency goes in the line itself, so it's measured just before the write.
+        const auto latencyUs = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - arrivalTicks) * 1.0e6;
+        const auto total = length + std::snprintf (line + length, sizeof (line) - (size_t) length, "%.0f}\n", latencyUs);
+
+        report.latenciesUs.push_back (latencyUs);
+        return std::fwrite (line, 1, (size_t) total, stdout) == (size_t) total && std::fflush (stdout) == 0;
+    }
+};
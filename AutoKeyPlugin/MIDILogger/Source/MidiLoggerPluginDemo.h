@@ -50,44 +50,111 @@
 
 #pragma once
 
+#include <array>
 #include <iterator>
+#include <optional>
 #include <set>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+
+#include "MidiDeviceList.h"
+#include "MergedMidiInput.h"
+#include "SessionJournal.h"
+#include "ChordProgression.h"
+#include "ChordPredictor.h"
+#include "ProgressionView.h"
+#include "AnalysisHistory.h"
+#include "PluginState.h"
+#include "EdoKeyFinder.h"
+#include "VoiceTable.h"
+#include "UmpDecoder.h"
+#include "KeyWindows.h"
+#include "MidiBufferScanner.h"
+#include "OfflineKeyAnalyser.h"
+#include "KeyFollower.h"
+#include "KeyChangeOutput.h"
+#include "KeyHighlightKeyboard.h"
 
 #define MACRO_VARIABLE_TO_STRING(Variable) (void(Variable),#Variable)
 
 class MidiKeyFinder {
 public:
   MidiKeyFinder() {
-
+    ChordTable::getTable(); // build it now rather than on the first note
    }
 
+  // One entry per scale below, ranked by how well it covers a pitch-class histogram.
+  struct RankedKey {
+    int index;          // into scale_masks / get_key_name()
+    float score;        // fraction of the note weight that falls inside the scale
+    float tonic_weight; // fraction of the note weight on the tonic triad, splits relative major/minor
+  };
+
+  static constexpr int num_keys = 24;
+  using Histogram = std::array<float, 12>;
+
   void reset() {
-    Notes_Input.clear();
+    notes_input = 0;
+    histogram.fill(0.0f);
+    release_all();
+    progression.clear();
+    predictor.clear();
+    held_gesture.fill(0);
+    gesture = 0;
+    last_note_on_time = 0.0;
+    notes_seen = 0;
+    voices.reset();
   }
 
+  // The message's time stamp is taken as its time in seconds, for weighting notes
+  // by how long they sound.
   void add_midi_message(const juce::MidiMessage& m) {
-    String s;
-
-    if (m.isNoteOn())
-      s = juce::MidiMessage::getMidiNoteName(m.getNoteNumber(), true, false, 3);
-    else
-      s = "";
-    if (s == "A") { Notes_Input.insert(A); }
-    else if (s == "A#") { Notes_Input.insert(AS);}
-    else if (s == "B")  { Notes_Input.insert(B);}
-    else if (s == "C")  { Notes_Input.insert(C);}
-    else if (s == "C#") { Notes_Input.insert(CS);}
-    else if (s == "D")  { Notes_Input.insert(D);}
-    else if (s == "D#") { Notes_Input.insert(DS);}
-    else if (s == "E")  { Notes_Input.insert(E);}
-    else if (s == "F")  { Notes_Input.insert(F);}
-    else if (s == "F#") { Notes_Input.insert(FS);}
-    else if (s == "G")  { Notes_Input.insert(G);}
-    else if (s == "G#") { Notes_Input.insert(GS);}
-
+    voices.handle(m, m.getTimeStamp());
+
+    if (m.isNoteOn()) {
+      const auto pitch_class = m.getNoteNumber() % 12;
+      histogram[(size_t) pitch_class] += 1.0f;
+      notes_input = (uint16_t) (notes_input | (1 << pitch_class));
+      ++notes_seen;
+      note_on(m.getNoteNumber(), m.getTimeStamp());
+    }
+    else if (m.isNoteOff())
+      note_off(m.getNoteNumber());
+    else if (m.isAllNotesOff() || m.isAllSoundOff())
+      release_all();
+  }
 
+  // A decoded MIDI 2.0 event, at 'time' seconds. Notes are weighted by their 16-bit
+  // velocity and credited to the pitch class of their own pitch, which per-note pitch
+  // can move while they sound. Chords are still named from the note numbers.
+  void add_ump_event(const UmpDecoder::Event& e, double time) {
+    switch (e.kind) {
+      case UmpDecoder::noteOn: {
+        const auto pitch_class = UmpDecoder::getPitchClass(e.pitch);
+        const auto weight = e.velocity / 65535.0f;
+        voices.noteOn(e.channel, e.note, time, pitch_class, weight);
+        histogram[(size_t) pitch_class] += weight;
+        notes_input = (uint16_t) (notes_input | (1 << pitch_class));
+        ++notes_seen;
+        note_on(e.note, time);
+        break;
+      }
+      case UmpDecoder::noteOff:
+        voices.noteOff(e.channel, e.note, time);
+        note_off(e.note);
+        break;
+      case UmpDecoder::perNotePitch:
+        voices.setPitchClass(e.channel, e.note, UmpDecoder::getPitchClass(e.pitch), time);
+        break;
+      case UmpDecoder::controller:
+        voices.controller(e.channel, e.number, e.value, time);
+        if (e.number == 120 || e.number == 123)
+          release_all();
+        break;
+      default:
+        break;
+    }
   }
 
   String testfunction(const juce::MidiMessage& m) {
@@ -97,37 +164,11 @@ public:
   String get_keys() {
     String s = "Possible keys:\n";
     bool no_matches = true;
-    for (int i = 0; i < scales.size(); i++) {
-
-      if (std::includes(scales[i].begin(), scales[i].end(),
-                        Notes_Input.begin(), Notes_Input.end()))
-      {
+    for (int i = 0; i < num_keys; i++) {
+      // Every note played so far is in the scale.
+      if ((notes_input & ~scale_masks[(size_t) i]) == 0) {
         no_matches = false;
-        // THESE MATCH THE ORDER OF THE VECTOR
-        if (i == 0) { s += "A Minor\n"; }
-        else if (i == 1) { s += "A# Minor\n"; }
-        else if (i == 2) { s += "B Minor\n"; }
-        else if (i == 3) { s += "C Minor\n"; }
-        else if (i == 4) { s += "C# Minor\n"; }
-        else if (i == 5) { s += "D Minor\n"; }
-        else if (i == 6) { s += "D# Minor\n"; }
-        else if (i == 7) { s += "E Minor\n"; }
-        else if (i == 8) { s += "F Minor\n"; }
-        else if (i == 9) { s += "F# Minor\n"; }
-        else if (i == 10) { s += "G Minor\n"; }
-        else if (i == 11) { s += "G# Minor\n"; }
-        else if (i == 12) { s += "C Major\n"; }
-        else if (i == 13) { s += "G Major\n"; }
-        else if (i == 14) { s += "D Major\n"; }
-        else if (i == 15) { s += "A Major\n"; }
-        else if (i == 16) { s += "E Major\n"; }
-        else if (i == 17) { s += "B Major\n"; }
-        else if (i == 18) { s += "F Major\n"; }
-        else if (i == 19) { s += "A# Major\n"; }
-        else if (i == 20) { s += "D# Major\n"; }
-        else if (i == 21) { s += "G# Major\n"; }
-        else if (i == 22) { s += "C# Major\n"; }
-        else if (i == 23) { s += "F# Major\n"; }
+        s += String(get_key_name(i)) + "\n";
       }
     }
     if (no_matches) {
@@ -136,6 +177,120 @@ public:
     return s;
   }
 
+  const Histogram& get_histogram() const { return histogram; }
+
+  // Note-ons closer together than this build one chord, so a rolled or strummed chord is
+  // one change in the progression rather than its dyad, then its triad.
+  static constexpr double roll_seconds = 0.1;
+
+  // The chord formed by the notes held right now, named from the lowest one.
+  ChordTable::Chord get_chord() const { return current_chord; }
+  String get_chord_name() const { return String(ChordTable::getName(current_chord)); }
+
+  // Every chord played since the last reset, labelled against the current best key.
+  // Chords come from note-ons: letting go of a chord's notes one at a time never adds
+  // the chords that are left on the way.
+  const ChordProgression& get_progression() const { return progression; }
+
+  // Off for users that only want the key (the headless stream), so a session that runs
+  // for days doesn't keep every chord. Turning it off clears the progression, and
+  // nothing is learned while it's off.
+  void set_progression_enabled(bool enabled) {
+    progression_enabled = enabled;
+    if (!enabled) {
+      progression.clear();
+      gesture_entry = false;
+    }
+  }
+
+  // Key evidence: seconds each pitch class has sounded for, through the sustain and
+  // sostenuto pedals, so held harmony outweighs passing and grace notes.
+  Histogram get_evidence(double now = 0.0) const { return voices.getEvidence(now); }
+
+  // What the keys are ranked on: the evidence, or the note counts while nothing has
+  // sounded for any time yet (just after the first note-ons, or after loading a state
+  // saved without the durations).
+  Histogram get_key_evidence() const {
+    const auto evidence = get_evidence();
+    return KeyFollower::getEvidenceToRank(evidence, histogram);
+  }
+
+  // Time stamp of the latest message, which is when get_evidence() is measured up to.
+  double get_last_event_time() const { return voices.getLastTime(); }
+
+  // Re-labels the progression if the best key (or the locked key, if there is one)
+  // has moved. Call after a batch of messages.
+  void update_progression_key(int locked_key = -1) {
+    RankedKey best { locked_key, 0.0f, 0.0f };
+    if (locked_key >= 0 || rank_keys(get_key_evidence(), &best, 1) == 1)
+      progression.setKey(tonics[(size_t) best.index], best.index < 12);
+  }
+
+  // For saving the analysis with the plugin state and putting it back.
+  uint16_t get_notes_mask() const { return notes_input; }
+
+  uint32_t get_notes_seen() const { return notes_seen; }
+
+  void restore(const Histogram& h, uint16_t notes_mask, uint32_t seen) {
+    reset();
+    histogram = h;
+    notes_input = (uint16_t) (notes_mask & 0xfff);
+    notes_seen = seen;
+  }
+
+  // After restore(), which clears it.
+  void restore_evidence(const Histogram& evidence) { voices.restore(evidence); }
+
+  void restore_progression_step(uint32_t position, int chord_id) {
+    progression.add(position, ChordTable::fromId(chord_id));
+  }
+
+  // Chord transitions learned this session, for saving and loading.
+  const ChordPredictor& get_predictor() const { return predictor; }
+  void restore_transition(int cell, int count) { predictor.restore(cell, count); }
+
+  // Likely chords to follow the last one played, best first. Returns the number written.
+  int suggest_next_chords(ChordPredictor::Suggestion* results, int max_results) const {
+    if (progression.size() == 0 || !progression.hasKey())
+      return 0;
+    return predictor.suggest(progression.getChordId(progression.size() - 1), progression.getTonic(),
+                             progression.isMinorKey(), results, max_results);
+  }
+
+  // Ranks every key against a pitch-class histogram (index 0 = C) and writes
+  // the best max_results of them into results. Returns the number written.
+  // Only reads the scale tables, so one finder can be shared between threads.
+  // KeyFollower does the ranking, so the stream and the key output agree with it.
+  int rank_keys(const Histogram& h, RankedKey* results, int max_results) const {
+    KeyFollower::RankedKey ranked[num_keys];
+    const auto num = KeyFollower::rankKeys(h, ranked, max_results);
+    for (int i = 0; i < num; i++)
+      results[i] = { ranked[i].key, ranked[i].score, ranked[i].tonicWeight };
+    return num;
+  }
+
+  // Key index <-> tonic pitch class (0 = C) and mode.
+  static int get_key_tonic(int index) { return tonics[(size_t) index]; }
+  static bool is_minor_key(int index) { return index < 12; }
+
+  static int get_key_index(int tonic, bool minor) {
+    for (int i = minor ? 0 : 12; i < (minor ? 12 : num_keys); i++) {
+      if (tonics[(size_t) i] == tonic % 12)
+        return i;
+    }
+    return -1;
+  }
+
+  static const char* get_key_name(int index) {
+    // THESE MATCH THE ORDER OF THE SCALES
+    static const char* const names[num_keys] = {
+      "A Minor", "A# Minor", "B Minor", "C Minor", "C# Minor", "D Minor",
+      "D# Minor", "E Minor", "F Minor", "F# Minor", "G Minor", "G# Minor",
+      "C Major", "G Major", "D Major", "A Major", "E Major", "B Major",
+      "F Major", "A# Major", "D# Major", "G# Major", "C# Major", "F# Major" };
+    return names[index];
+  }
+
 
 private:
   /*
@@ -147,61 +302,416 @@ private:
  
   enum Note {C, CS, D, DS, E, F, FS, G, GS, A, AS, B};
 
-  std::set<Note> AMinor  = { A,B,C,D,E,F,G,A };
-  std::set<Note> ASMinor = { AS,C,CS,DS,F,FS,GS };
-  std::set<Note> BMinor  = { B,CS,D,E,FS,G,A,B };
-  std::set<Note> CMinor  = { C,D,DS,F,G,GS,AS,C };
-  std::set<Note> CSMinor = { CS,DS,E,FS,GS,A,B };
-  std::set<Note> DMinor  = { D,E,F,G,A,AS,C };
-  std::set<Note> DSMinor = { DS,F,FS,GS,AS,B,CS };
-  std::set<Note> EMinor  = { E,FS,G,A,B,C,D };
-  std::set<Note> FMinor  = { F,G,GS,AS,C,CS,DS };
-  std::set<Note> FSMinor = { FS,GS,A,B,CS,D,E };
-  std::set<Note> GMinor  = { G,A,AS,C,D,DS,F };
-  std::set<Note> GSMinor = { GS,AS,B,CS,DS,E,FS };
-
-  std::set<Note> CMajor = { C,D,E,F,G,A,B };
-  std::set<Note> GMajor = { G,A,B,C,D,E,FS };
-  std::set<Note> DMajor = { D,E,FS,G,A,B,CS };
-  std::set<Note> AMajor = { A,B,CS,D,E,FS,GS };
-  std::set<Note> EMajor = { E,FS,GS,A,B,CS,DS };
-  std::set<Note> BMajor = { B,CS,DS,E,FS,GS,AS };
-  std::set<Note> FMajor = { F,G,A,AS,C,D,E };
-  std::set<Note> ASMajor = { AS,C,D,DS,F,G,A };
-  std::set<Note> DSMajor = { DS,F,G,GS,AS,C,D };
-  std::set<Note> GSMajor = { GS,AS,C,CS,DS,F,G };
-  std::set<Note> CSMajor = { CS,DS,F,FS,GS,AS,C };
-  std::set<Note> FSMajor = { FS,GS,AS,B,CS,DS,F };
-
-  std::set<Note> Notes_Input = {};
+  // Pitch classes played since the last reset, one bit each (bit 0 = C).
+  uint16_t notes_input = 0;
+  Histogram histogram = {};
+
+  // Held notes, kept up to date per event so the chord is one table lookup.
+  std::array<uint8_t, 128> held_counts = {};
+  std::array<uint8_t, 12> held_pitch_classes = {};
+  std::array<uint64_t, 2> held_bits = {};
+  uint16_t held_mask = 0;
+  ChordTable::Chord current_chord;
+
+  // The chord being played: the note-ons of one gesture, with its entry in the
+  // progression replaced as more notes arrive. A gesture closes when one of its own
+  // notes is let go or a note comes later than roll_seconds after the last.
+  std::array<uint16_t, 128> held_gesture = {};    // the gesture each held note was pressed in
+  uint16_t gesture = 0;
+  bool gesture_open = false;
+  bool gesture_entry = false;                     // the progression's last chord is this gesture's
+  uint32_t gesture_position = 0;
+  double last_note_on_time = 0.0;
+
+  ChordProgression progression;
+  bool progression_enabled = true;
+  ChordPredictor predictor;
+  uint32_t notes_seen = 0;
+  VoiceTable voices;
+
+  void note_on(int note, double time) {
+    auto& count = held_counts[(size_t) note];
+    if (count == 255)
+      return;
+
+    if (!gesture_open || time - last_note_on_time > roll_seconds) {
+      close_gesture();
+      ++gesture;
+      gesture_open = true;
+      gesture_position = notes_seen;
+    }
+    last_note_on_time = time;
+    held_gesture[(size_t) note] = gesture;
 
-  // DON'T CHANGE ORDER OF SCALES. THEY ARE HARD CODEDED IN FUNCTIONS ABOVE
-  std::vector<std::set<Note>> scales{
-  AMinor,ASMinor,BMinor,CMinor,CSMinor,DMinor,DSMinor,EMinor,FMinor,FSMinor,GMinor,GSMinor,
-  CMajor,GMajor,DMajor,AMajor,EMajor,BMajor,FMajor,ASMajor,DSMajor,GSMajor,CSMajor,FSMajor};
+    if (count++ == 0) {
+      held_bits[(size_t) note >> 6] |= uint64_t(1) << (note & 63);
+      if (held_pitch_classes[(size_t) (note % 12)]++ == 0)
+        held_mask = (uint16_t) (held_mask | (1 << (note % 12)));
+    }
+    update_chord();
+    set_gesture_chord();
+  }
+
+  void note_off(int note) {
+    auto& count = held_counts[(size_t) note];
+    if (count == 0)
+      return;
+
+    const auto from_earlier_gesture = held_gesture[(size_t) note] != gesture;
+
+    if (--count == 0) {
+      held_bits[(size_t) note >> 6] &= ~(uint64_t(1) << (note & 63));
+      if (--held_pitch_classes[(size_t) (note % 12)] == 0)
+        held_mask = (uint16_t) (held_mask & ~(1 << (note % 12)));
+    }
+    update_chord();
+
+    // Letting go of the chord's own notes ends it. Letting go of the last notes held over
+    // from before (legato) leaves it on its own, which is the chord that was meant.
+    if (!from_earlier_gesture)
+      close_gesture();
+    else if (gesture_open && only_gesture_notes_held())
+      set_gesture_chord();
+  }
+
+  void release_all() {
+    held_counts.fill(0);
+    held_pitch_classes.fill(0);
+    held_bits.fill(0);
+    held_mask = 0;
+    current_chord = {};
+    close_gesture();
+  }
+
+  int lowest_held_note() const {
+    for (size_t i = 0; i < held_bits.size(); i++) {
+      if (const auto b = held_bits[i])
+        return (int) i * 64 + juce::countNumberOfBits((b & (~b + 1)) - 1);
+    }
+    return -1;
+  }
+
+  bool only_gesture_notes_held() const {
+    for (size_t i = 0; i < held_bits.size(); i++) {
+      for (auto b = held_bits[i]; b != 0; b &= b - 1) {
+        const auto note = i * 64 + (size_t) juce::countNumberOfBits((b & (~b + 1)) - 1);
+        if (held_gesture[note] != gesture)
+          return false;
+      }
+    }
+    return true;
+  }
+
+  void update_chord() {
+    const auto lowest = lowest_held_note();
+    current_chord = lowest < 0 ? ChordTable::Chord() : ChordTable::recognise(held_mask, lowest % 12);
+  }
+
+  // Makes the held chord the open gesture's entry in the progression, in place of the one
+  // its first notes made.
+  void set_gesture_chord() {
+    if (!progression_enabled || !current_chord.isValid())
+      return;
+
+    if (gesture_entry) {
+      if (progression.getChordId(progression.size() - 1) == current_chord.getId())
+        return;
+      progression.removeLast();
+    }
+
+    gesture_entry = progression.add(gesture_position, current_chord);
+  }
+
+  void close_gesture() {
+    // The gesture's chord is final now. Each change of chord is one step of learning, in
+    // the key the progression is labelled in.
+    const auto size = progression.size();
+    if (gesture_entry && size >= 2 && progression.hasKey())
+      predictor.learn(progression.getChordId(size - 2), progression.getChordId(size - 1),
+                      progression.getTonic(), progression.isMinorKey());
+
+    gesture_open = false;
+    gesture_entry = false;
+  }
+
+  // Tonic of each entry in scales, same order.
+  static constexpr std::array<int, num_keys> tonics = KeyFollower::tonics;
 
+  // Each scale as a pitch-class mask (bit 0 = C), built at compile time and shared
+  // by every instance.
+  // DON'T CHANGE ORDER OF SCALES. THEY ARE HARD CODEDED IN FUNCTIONS ABOVE
+  static constexpr std::array<uint16_t, num_keys> scale_masks = [] {
+    std::array<uint16_t, num_keys> masks = {};
+    for (int i = 0; i < num_keys; i++) {
+      const auto& degrees = i < 12 ? EdoScale<12>::minorDegrees : EdoScale<12>::majorDegrees;
+      for (auto degree : degrees)
+        masks[(size_t) i] = (uint16_t) (masks[(size_t) i] | (1 << ((tonics[(size_t) i] + degree) % 12)));
+    }
+    return masks;
+  }();
 
 };
 
+// Carries host MIDI from the audio thread to the message thread. The audio thread
+// side never builds a MidiMessage or allocates: MidiBufferScanner picks out the
+// events the analysis uses, and each batch goes into the ring with one write.
+// Tuning SysEx payloads travel in a second ring of bytes, in the same order.
 class MidiQueue
 {
 public:
-    void push (const MidiBuffer& buffer)
+    // A message (time stamp = sample offset) and the block it arrived in.
+    struct Entry
+    {
+        MidiMessage message;
+        uint32 blockIndex = 0;
+        double hostTime = 0.0;
+        bool ignored = false;       // of no use to the analysis, only queued for the journal
+    };
+
+    /** While set, push() queues the events the analysis skips as well, marked as ignored,
+        so the session journal gets the host's MIDI as it came. They go into a ring of their
+        own, so a dense clock or aftertouch stream can't crowd out the events the analysis
+        uses. Only short messages are kept; other SysEx and what doesn't fit is counted by
+        takeNumIgnoredNotKept(). Message thread.
+    */
+    void setKeepIgnored (bool shouldKeep)
+    {
+        if (shouldKeep && ignoredSlots.empty())
+            ignoredSlots.resize (ignoredQueueSize);     // never freed, so the audio thread can't see it move
+
+        keepIgnored.store (shouldKeep, std::memory_order_release);
+    }
+
+    void push (const MidiBuffer& buffer, uint32 blockIndex = 0, double hostTime = 0.0)
     {
-        for (const auto metadata : buffer)
-            fifo.write (1).forEach ([&] (int dest) { messages[(size_t) dest] = metadata.getMessage(); });
+        uint64 numPushed = 0, numLost = 0, numNotKept = 0;
+        const auto keep = keepIgnored.load (std::memory_order_acquire);
+
+        const auto numIgnored = MidiBufferScanner::scan (buffer, [&] (const MidiBufferScanner::Event* events, int numEvents)
+        {
+            const auto numToAnalyse = keep ? (int) std::count_if (events, events + numEvents, [] (const MidiBufferScanner::Event& e)
+                                                                  {
+                                                                      return e.kind != MidiBufferScanner::ignored;
+                                                                  })
+                                           : numEvents;
+
+            // Whatever doesn't fit is dropped, so the oldest events are the ones that get through.
+            const auto numToWrite = jmin (numToAnalyse, fifo.getFreeSpace());
+            numLost += (uint64) (numToAnalyse - numToWrite);
+
+            int start1, size1, start2, size2;
+            fifo.prepareToWrite (numToWrite, start1, size1, start2, size2);
+
+            for (int i = 0, written = 0; written < size1 + size2; ++i)
+            {
+                const auto& event = events[i];
+
+                if (event.kind == MidiBufferScanner::ignored)
+                    continue;
+
+                auto& slot = slots[(size_t) (written < size1 ? start1 + written : start2 + written - size1)];
+                ++written;
+                slot.blockIndex = blockIndex;
+                slot.hostTime = hostTime;
+                slot.samplePosition = event.samplePosition;
+                slot.size = event.size;
+
+                if (event.size <= (int) sizeof (slot.data))
+                    std::memcpy (slot.data, event.data, (size_t) event.size);
+                else if (! writeSysEx (event.data, event.size))
+                    slot.size = 0;      // no room for the payload: the consumer skips it
+
+                if (slot.size > 0)
+                    ++numPushed;
+                else
+                    ++numLost;
+            }
+
+            fifo.finishedWrite (size1 + size2);
+
+            if (numToAnalyse < numEvents)
+                numNotKept += keepIgnoredEvents (events, numEvents, numEvents - numToAnalyse, numToWrite, blockIndex, hostTime);
+
+            slotsWritten += (uint32) numToWrite;
+        }, keep);
+
+        pushed.fetch_add (numPushed, std::memory_order_relaxed);
+        dropped.fetch_add (numLost, std::memory_order_relaxed);
+        ignored.fetch_add ((uint64) numIgnored, std::memory_order_relaxed);
+        ignoredNotKept.fetch_add (numNotKept, std::memory_order_relaxed);
     }
 
     template <typename OutputIt>
     void pop (OutputIt out)
     {
-        fifo.read (fifo.getNumReady()).forEach ([&] (int source) { *out++ = messages[(size_t) source]; });
+        int start1, size1, start2, size2, ignoredStart1 = 0, ignoredSize1 = 0, ignoredStart2 = 0, ignoredSize2 = 0;
+
+        // The ignored ring first: everything analysable that was pushed before what's there
+        // is then in the main ring too.
+        if (! ignoredSlots.empty())
+            ignoredFifo.prepareToRead (ignoredFifo.getNumReady(), ignoredStart1, ignoredSize1, ignoredStart2, ignoredSize2);
+
+        fifo.prepareToRead (fifo.getNumReady(), start1, size1, start2, size2);
+        int numTaken = 0, numIgnoredTaken = 0;
+
+        for (;;)
+        {
+            // An ignored event goes back in after the slots that were written before it.
+            if (numIgnoredTaken < ignoredSize1 + ignoredSize2)
+            {
+                const auto& slot = ignoredSlots[(size_t) (numIgnoredTaken < ignoredSize1 ? ignoredStart1 + numIgnoredTaken
+                                                                                         : ignoredStart2 + numIgnoredTaken - ignoredSize1)];
+
+                if ((int32) (slot.slotsBefore - slotsRead) <= 0)
+                {
+                    if (slot.size > 0)
+                        *out++ = { MidiMessage (slot.data, slot.size, slot.samplePosition), slot.blockIndex, slot.hostTime, true };
+
+                    ++numIgnoredTaken;
+                    continue;
+                }
+            }
+
+            if (numTaken == size1 + size2)
+                break;
+
+            const auto& slot = slots[(size_t) (numTaken < size1 ? start1 + numTaken : start2 + numTaken - size1)];
+            ++numTaken;
+            ++slotsRead;
+
+            if (slot.size == 0)
+                continue;
+
+            if (slot.size <= (int) sizeof (slot.data))
+            {
+                *out++ = { MidiMessage (slot.data, slot.size, slot.samplePosition), slot.blockIndex, slot.hostTime, false };
+                continue;
+            }
+
+            int sysExStart1, sysExSize1, sysExStart2, sysExSize2;
+            sysExFifo.prepareToRead (slot.size, sysExStart1, sysExSize1, sysExStart2, sysExSize2);
+            sysExScratch.resize ((size_t) slot.size);
+            std::memcpy (sysExScratch.data(), sysExBytes.data() + sysExStart1, (size_t) sysExSize1);
+            std::memcpy (sysExScratch.data() + sysExSize1, sysExBytes.data() + sysExStart2, (size_t) sysExSize2);
+            sysExFifo.finishedRead (sysExSize1 + sysExSize2);
+
+            *out++ = { MidiMessage (sysExScratch.data(), slot.size, slot.samplePosition), slot.blockIndex, slot.hostTime, false };
+        }
+
+        fifo.finishedRead (numTaken);
+
+        if (! ignoredSlots.empty())
+            ignoredFifo.finishedRead (numIgnoredTaken);
+    }
+
+    /** Ignored events left out of the journal since the last call. Consumer thread. */
+    uint64 takeNumIgnoredNotKept() noexcept  { return ignoredNotKept.exchange (0, std::memory_order_relaxed); }
+
+    // Events queued, events lost because the queue was full, and events the analysis
+    // has no use for. Safe to read from any thread.
+    uint64 getNumPushed() const noexcept     { return pushed.load (std::memory_order_relaxed); }
+    uint64 getNumDropped() const noexcept    { return dropped.load (std::memory_order_relaxed); }
+    uint64 getNumIgnored() const noexcept    { return ignored.load (std::memory_order_relaxed); }
+
+    /** Bytes allocated for the rings, outside sizeof (MidiQueue). Consumer thread only. */
+    size_t getMemoryUsed() const
+    {
+        return slots.capacity() * sizeof (Slot) + ignoredSlots.capacity() * sizeof (IgnoredSlot)
+                 + sysExBytes.capacity() + sysExScratch.capacity();
     }
 
 private:
+    struct Slot
+    {
+        double hostTime;
+        uint32 blockIndex;
+        int32 samplePosition;
+        int32 size;             // more than sizeof (data): the payload is in the SysEx ring
+        uint8 data[3];
+    };
+
+    struct IgnoredSlot
+    {
+        double hostTime;
+        uint32 blockIndex;
+        int32 samplePosition;
+        uint32 slotsBefore;     // main ring slots written before it, so pop() can put it back in order
+        uint8 data[3];
+        uint8 size;
+    };
+
+    // Writes a batch's ignored events to their own ring, oldest first. numWrittenFromBatch of
+    // its other events made it into the main ring. Returns the number left out.
+    uint64 keepIgnoredEvents (const MidiBufferScanner::Event* events, int numEvents, int numToKeep,
+                              int numWrittenFromBatch, uint32 blockIndex, double hostTime)
+    {
+        const auto numToWrite = jmin (numToKeep, ignoredFifo.getFreeSpace());
+        auto numLeftOut = (uint64) (numToKeep - numToWrite);
+        int start1, size1, start2, size2;
+        ignoredFifo.prepareToWrite (numToWrite, start1, size1, start2, size2);
+        int numBefore = 0;
+
+        for (int i = 0, written = 0; written < size1 + size2; ++i)
+        {
+            const auto& event = events[i];
+
+            if (event.kind != MidiBufferScanner::ignored)
+            {
+                numBefore = jmin (numBefore + 1, numWrittenFromBatch);
+                continue;
+            }
+
+            auto& slot = ignoredSlots[(size_t) (written < size1 ? start1 + written : start2 + written - size1)];
+            ++written;
+            slot.hostTime = hostTime;
+            slot.blockIndex = blockIndex;
+            slot.samplePosition = event.samplePosition;
+            slot.slotsBefore = slotsWritten + (uint32) numBefore;
+            slot.size = (uint8) jmin (event.size, (int) sizeof (slot.data));
+
+            if (event.size > (int) sizeof (slot.data))
+            {
+                slot.size = 0;      // SysEx: kept out, and the consumer skips it
+                ++numLeftOut;
+            }
+
+            std::memcpy (slot.data, event.data, (size_t) slot.size);
+        }
+
+        ignoredFifo.finishedWrite (size1 + size2);
+        return numLeftOut;
+    }
+
+    bool writeSysEx (const uint8* data, int size)
+    {
+        if (sysExFifo.getFreeSpace() < size)
+            return false;
+
+        int start1, size1, start2, size2;
+        sysExFifo.prepareToWrite (size, start1, size1, start2, size2);
+        std::memcpy (sysExBytes.data() + start1, data, (size_t) size1);
+        std::memcpy (sysExBytes.data() + start2, data + size1, (size_t) size2);
+        sysExFifo.finishedWrite (size1 + size2);
+        return true;
+    }
+
+    // 16384 events of 24 bytes, and room for 40 bulk tuning dumps between drains. The ring of
+    // ignored events is only allocated once a journal wants them.
     static constexpr auto queueSize = 1 << 14;
+    static constexpr auto sysExQueueSize = 1 << 14;
+    static constexpr auto ignoredQueueSize = 1 << 14;
+
     AbstractFifo fifo { queueSize };
-    std::vector<MidiMessage> messages = std::vector<MidiMessage> (queueSize);
+    std::vector<Slot> slots = std::vector<Slot> (queueSize);
+    AbstractFifo sysExFifo { sysExQueueSize };
+    std::vector<uint8> sysExBytes = std::vector<uint8> (sysExQueueSize);
+    std::vector<uint8> sysExScratch;        // consumer only
+    AbstractFifo ignoredFifo { ignoredQueueSize };
+    std::vector<IgnoredSlot> ignoredSlots;
+    uint32 slotsWritten = 0;                // producer only
+    uint32 slotsRead = 0;                   // consumer only
+    std::atomic<uint64> pushed { 0 }, dropped { 0 }, ignored { 0 }, ignoredNotKept { 0 };
+    std::atomic<bool> keepIgnored { false };
 };
 
 // Stores the last N messages. Safe to access from the message thread only.
@@ -233,6 +743,8 @@ public:
 
     size_t size() const                                  { return messages.size(); }
 
+    size_t getMemoryUsed() const                         { return messages.capacity() * sizeof (MidiMessage); }
+
     std::function<void()> onChange;
 
 private:
@@ -357,47 +869,67 @@ private:
 class MidiLoggerPluginDemoProcessor  :  public AudioProcessor,
                                         private Timer,
                                         public Component,
-                                        private MidiInputCallback,
-                                        private MidiKeyboardStateListener
+                                        private MidiKeyboardStateListener,
+                                        private ChangeListener
 {
 public:
     MidiLoggerPluginDemoProcessor()
-      : keyboardComponent(keyboardState, juce::MidiKeyboardComponent::verticalKeyboardFacingRight),
-      //startTime(juce::Time::getMillisecondCounterHiRes() * 0.001),
+      : //startTime(juce::Time::getMillisecondCounterHiRes() * 0.001),
       AudioProcessor (getBusesLayout())
     {
         state.addChild ({ "uiState", { { "width",  500 }, { "height", 400 } }, {} }, -1, nullptr);
+        keyWindows.setLengths ({ 1.0f, 8.0f });
+        keyOutput.addParameters (*this);
         startTimerHz (60);
         //keyboardComponent.setMidiChannel(2);
+        midiDevices->addChangeListener(this);
     }
 
     ~MidiLoggerPluginDemoProcessor() override { 
       stopTimer(); 
+      midiDevices->removeChangeListener(this);
       keyboardState.removeListener(this);
-      deviceManager.removeMidiInputDeviceCallback(juce::MidiInput::getAvailableDevices()[midiInputList.getSelectedItemIndex()].identifier, this);
     }
 
     
     MidiKeyFinder Midi_Key_Finder_Util;
+    AnalysisHistory history;                          // every analysed note, within a memory budget
+    KeyWindows keyWindows;                            // shorter readings from the same running totals
+    MicrotonalKeyFinder microtonalKeys;               // follows bends and retuning, when not in 12-EDO
 
     // For Keyboard
-    juce::AudioDeviceManager deviceManager;           // [1]
-    juce::ComboBox midiInputList;                     // [2]
-    juce::Label midiInputListLabel;
-    int lastInputIndex = 0;                           // [3]
+    // The widgets live in the editor, which only exists while it's open. The device
+    // manager is only created once an input is chosen: in a host the MIDI comes
+    // from the track, and the standalone app picks a device by default.
+    struct DeviceInput
+    {
+        juce::AudioDeviceManager deviceManager;       // [1]
+        MergedMidiInput merged { deviceManager };     // every device we listen to feeds this
+    };
+
+    std::unique_ptr<DeviceInput> deviceInput;
+    SharedResourcePointer<MidiDeviceList> midiDevices;
+    Array<MidiDeviceInfo> midiInputs;                 // the devices offered in the editor's input list
+    int selectedInputId = 0;                          // [2] in the editor's input list, 0 = none
+    String currentInputIdentifier;                    // [3]
+    bool listenToAllInputs = false;
     bool isAddingFromMidiInput = false;               // [4]
 
-    juce::MidiKeyboardState keyboardState;            // [5]
-    juce::MidiKeyboardComponent keyboardComponent;    // [6]
+    juce::MidiKeyboardState keyboardState;            // [5] the editor's keyboard shows this
+    std::vector<MergedMidiInput::Event> keyboardEvents; // played on it, until the next drain
+    static constexpr int keyboardSlot = MergedMidiInput::maxInputs;  // the device slot they're journalled under
 
-    juce::TextEditor midiMessagesBox;
+    String keysText;                                  // what the editor's text box shows
     double startTime;
     // End of Keyboard Variables
 
     // Some public functions for Keyboard
     void clearMessages()
     {
-      midiMessagesBox.clear();
+      keysText.clear();
+
+      if (auto* editor = getEditor())
+        editor->clearKeys();
     }
     // End of public functions for Keyboard
 
@@ -411,7 +943,7 @@ public:
 
     const String getName() const override                                     { return "MIDI Key Detector"; }
     bool acceptsMidi() const override                                         { return true; }
-    bool producesMidi() const override                                        { return false; }
+    bool producesMidi() const override                                        { return true; }
     double getTailLengthSeconds() const override                              { return 0.0; }
 
     int getNumPrograms() override                                             { return 0; }
@@ -420,19 +952,136 @@ public:
     const String getProgramName (int) override                                { return {}; }
     void changeProgramName (int, const String&) override                      {}
 
-    void prepareToPlay (double, int) override                                 {}
-    void releaseResources() override                                          {}
+    void prepareToPlay (double sampleRate, int maximumExpectedSamplesPerBlock) override
+    {
+        currentSampleRate = sampleRate;
+        currentBlockSize = maximumExpectedSamplesPerBlock;
+        keyOutput.prepare (sampleRate);
+    }
+
+    void releaseResources() override
+    {
+        if (std::exchange (renderingOffline, false))
+            offline.endRender();
+    }
 
     void getStateInformation (MemoryBlock& destData) override
     {
-        if (auto xmlState = state.createXml())
-            copyXmlToBinary (*xmlState, destData);
+        // Hosts call this from any thread, so the analysis is copied while the timer can't
+        // touch it, and the copy is what's sized and written. A state loaded but not yet
+        // applied is still the plugin's state as far as the host is concerned.
+        SavedState saved;
+
+        {
+            const ScopedLock sl (stateLock);
+            saved = pendingState != nullptr ? *pendingState : getSavedState();
+        }
+
+        // Sized for the worst case up front, so the state is written straight into the host's block.
+        destData.setSize (getStateSizeUpperBound (saved), false);
+        PluginState::Writer writer (destData.getData(), destData.getSize());
+        writeState (saved, writer);
+        jassert (writer.ok());
+        destData.setSize (writer.getNumBytesWritten());
     }
 
     void setStateInformation (const void* data, int size) override
     {
-        if (auto xmlState = getXmlFromBinary (data, size))
-            state = ValueTree::fromXml (*xmlState);
+        PluginState::Reader reader (data, (size_t) jmax (0, size));
+        auto loaded = std::make_unique<SavedState>();
+
+        if (reader.isValid())
+        {
+            *loaded = readState (reader);
+        }
+        else if (auto xmlState = getXmlFromBinary (data, size))
+        {
+            // Saved by a version that only kept the window size, as XML.
+            const auto ui = ValueTree::fromXml (*xmlState).getChildWithName ("uiState");
+
+            if (ui.isValid())
+                loaded->uiSize = std::make_pair ((int) ui["width"], (int) ui["height"]);
+        }
+
+        {
+            const ScopedLock sl (stateLock);
+            pendingState = std::move (loaded);
+        }
+
+        // The editor reads the analysis on the message thread, so that's where it changes.
+        if (MessageManager::existsAndIsCurrentThread())
+            applyPendingState();
+    }
+
+    /** When set (>= 0, an index into MidiKeyFinder's keys) the progression is labelled
+        against this key instead of the detected one. */
+    void setLockedKey(int keyIndex)
+    {
+      const ScopedLock sl(stateLock);
+      lockedKey = jlimit(-1, MidiKeyFinder::num_keys - 1, keyIndex);
+      keyOutput.setLockedKey(lockedKey);
+      keysNeedShowing = true;
+    }
+
+    int getLockedKey() const        { return lockedKey; }
+
+    /** The key shown on the keyboard: the locked one if there is one, else the detected one. */
+    int getShownKey() const         { return lockedKey >= 0 ? lockedKey : detectedKey.load(); }
+
+    /** Equal divisions of the octave for the microtonal analysis: one of
+        MicrotonalKeyFinder::supportedDivisions. 12 leaves only the regular analysis. */
+    void setDivisions(int divisions)
+    {
+      const ScopedLock sl(stateLock);
+      microtonalKeys.setDivisions(divisions);
+      keysNeedShowing = true;
+    }
+
+    int getDivisions() const        { return microtonalKeys.getDivisions(); }
+
+    /** Lengths in bars of the shorter key readings shown next to the whole-song one, e.g.
+        { 1, 8 }. A length of 0 is the whole song again. At most KeyWindows::maxWindows. */
+    void setKeyWindows(const std::vector<float>& bars)
+    {
+      const ScopedLock sl(stateLock);
+      keyWindows.setLengths(bars);
+      keysNeedShowing = true;
+    }
+
+    const std::vector<float>& getKeyWindows() const     { return keyWindows.getLengths(); }
+
+    /** How key changes go out to the host as MIDI (they always update the key parameters).
+        They follow the host's MIDI only, not the devices or the on-screen keyboard.
+        channel is 1-16. */
+    void setKeyOutput(KeyChangeOutput::Format format, int channel, int controllerNumber)
+    {
+      const ScopedLock sl(stateLock);
+      keyOutput.setFormat(format);
+      keyOutput.setController(channel, controllerNumber);
+    }
+
+    KeyChangeOutput::Format getKeyOutputFormat() const  { return keyOutput.getFormat(); }
+
+    /** The best key over each key window up to the latest note (-1 if nothing sounded in it),
+        in setKeyWindows() order. All of them come from the one set of running totals. */
+    std::vector<int> getWindowKeys() const
+    {
+      const auto totals = Midi_Key_Finder_Util.get_evidence();
+      const auto time = Midi_Key_Finder_Util.get_last_event_time();
+      std::vector<int> keys;
+
+      for (int i = 0; i < keyWindows.getNumWindows(); ++i)
+      {
+        MidiKeyFinder::RankedKey best;
+        keys.push_back(Midi_Key_Finder_Util.rank_keys(keyWindows.getEvidence(i, totals, time), &best, 1) == 1 ? best.index : -1);
+      }
+
+      return keys;
+    }
+
+    void advanceKeyWindows(double time)
+    {
+      keyWindows.advance(time, [this] { return Midi_Key_Finder_Util.get_evidence(); });
     }
 
 
@@ -464,36 +1113,117 @@ public:
 
     void logMessage(const juce::String& m)
     {
-      midiMessagesBox.moveCaretToEnd();
-      midiMessagesBox.insertTextAtCaret(m + juce::newLine);
+      keysText << m << juce::newLine;
+
+      if (auto* editor = getEditor())
+        editor->appendKeys(m + juce::newLine);
+    }
+
+    DeviceInput& getDeviceInput()
+    {
+      if (deviceInput == nullptr)
+        deviceInput = std::make_unique<DeviceInput>();
+
+      return *deviceInput;
+    }
+
+    void setSelectedInputId(int id)
+    {
+      selectedInputId = id;
+
+      if (auto* editor = getEditor())
+        editor->updateInputList();
     }
 
     /** Starts listening to a MIDI input device, enabling it if necessary. */
     void setMidiInput(int index)
     {
-      auto list = juce::MidiInput::getAvailableDevices();
+      if (!isPositiveAndBelow(index, midiInputs.size()))
+        return;
+
+      auto newInput = midiInputs[index];
+
+      getDeviceInput().merged.setInputs({ newInput });
+      setSelectedInputId(index + 1);
+
+      currentInputIdentifier = newInput.identifier;
+      listenToAllInputs = false;
+    }
+
+    /** Listens to every device at once. Devices that are plugged in or removed later
+        are picked up by refreshMidiInputList without interrupting the others. */
+    void setAllMidiInputs()
+    {
+      getDeviceInput().merged.setInputs(midiInputs);
+      setSelectedInputId(allInputsItemId);
+
+      listenToAllInputs = true;
+    }
+
+    void midiInputListChanged(int id)
+    {
+      if (id == allInputsItemId)
+        setAllMidiInputs();
+      else
+        setMidiInput(id - 1);
+    }
+
+    /** Takes the devices from the cached scan and re-opens the chosen ones. Never enumerates
+        devices itself. */
+    void refreshMidiInputList()
+    {
+      midiInputs = midiDevices->getDevices();
+
+      if (auto* editor = getEditor())
+        editor->updateInputList();
+
+      if (listenToAllInputs)
+      {
+        setAllMidiInputs();
+        return;
+      }
 
-      deviceManager.removeMidiInputDeviceCallback(list[lastInputIndex].identifier, this);
+      if (currentInputIdentifier.isNotEmpty())
+      {
+        for (int i = 0; i < midiInputs.size(); ++i)
+        {
+          if (midiInputs[i].identifier == currentInputIdentifier)
+          {
+            setMidiInput(i);
+            return;
+          }
+        }
 
-      auto newInput = list[index];
+        // Unplugged: stop listening but keep the choice, so it resumes when the device comes back.
+        if (deviceInput != nullptr)
+          deviceInput->merged.setInputs({});
+        return;
+      }
 
-      if (!deviceManager.isMidiInputDeviceEnabled(newInput.identifier))
-        deviceManager.setMidiInputDeviceEnabled(newInput.identifier, true);
+      // A plugin waits to be asked; only the standalone app opens a device unprompted.
+      if (!JUCEApplicationBase::isStandaloneApp() || midiInputs.isEmpty())
+        return;
 
-      deviceManager.addMidiInputDeviceCallback(newInput.identifier, this);
-      midiInputList.setSelectedId(index + 1, juce::dontSendNotification);
+      // find the first enabled device and use that by default
+      for (int i = 0; i < midiInputs.size(); ++i)
+      {
+        if (getDeviceInput().deviceManager.isMidiInputDeviceEnabled(midiInputs[i].identifier))
+        {
+          setMidiInput(i);
+          return;
+        }
+      }
 
-      lastInputIndex = index;
+      // if no enabled devices were found just use the first one in the list
+      setMidiInput(0);
     }
 
-    // These methods handle callbacks from the midi device + on-screen keyboard..
-    void handleIncomingMidiMessage(juce::MidiInput* source, const juce::MidiMessage& message) override
+    void changeListenerCallback(ChangeBroadcaster*) override
     {
-      const juce::ScopedValueSetter<bool> scopedInputFlag(isAddingFromMidiInput, true);
-      keyboardState.processNextMidiEvent(message);
-      postMessageToList(message, source->getName());
+      refreshMidiInputList();
     }
 
+    // These methods handle callbacks from the on-screen keyboard..
     void handleNoteOn(juce::MidiKeyboardState*, int midiChannel, int midiNoteNumber, float velocity) override
     {
       if (!isAddingFromMidiInput)
@@ -521,9 +1251,6 @@ public:
 
     void addMessageToList(const juce::MidiMessage& message, const juce::String& source)
     {
-
-      midiMessagesBox.clear();
-
       auto time = message.getTimeStamp() - startTime;
 
       auto hours = ((int)(time / 3600.0)) % 24;
@@ -538,55 +1265,461 @@ public:
         millis);
 
       auto description = getMidiMessageDescription(message);
-      Midi_Key_Finder_Util.add_midi_message(message);
-      auto test2 = Midi_Key_Finder_Util.get_keys();
-      juce::String midiMessageString(test2); // [7]
-      //juce::String midiMessageString(test2 + " | " + timecode + "  -  " + description + " (" + source + ")"); // [7]
-      logMessage(midiMessageString);
+
+      // Analysed by the next drain, the way a device's notes are, so the journal and the
+      // history get them too.
+      if (message.getRawDataSize() > (int) sizeof (MergedMidiInput::Event::data))
+        return;
+
+      MergedMidiInput::Event e {};
+      e.timeStamp = message.getTimeStamp();
+      std::memcpy(e.data, message.getRawData(), (size_t) message.getRawDataSize());
+      e.size = (uint8) message.getRawDataSize();
+      e.slot = (uint8) keyboardSlot;
+
+      const ScopedLock sl(stateLock);
+      keyboardEvents.push_back(e);
     }
 
-    // This is used to dispach an incoming message to the message thread
-    class IncomingMessageCallback : public juce::CallbackMessage
+    void showDetectedKeys()
     {
-    public:
-      IncomingMessageCallback(MidiLoggerPluginDemoProcessor* o, const juce::MidiMessage& m, const juce::String& s)
-        : owner(o), message(m), source(s)
-      {}
+      Midi_Key_Finder_Util.update_progression_key(lockedKey);
+      clearMessages();
+      logMessage(Midi_Key_Finder_Util.get_keys());
 
-      void messageCallback() override
+      MidiKeyFinder::RankedKey best;
+      if (Midi_Key_Finder_Util.rank_keys(Midi_Key_Finder_Util.get_key_evidence(), &best, 1) == 1)
       {
-        if (owner != nullptr)
-          owner->addMessageToList(message, source);
+        logMessage("Most likely: " + String(MidiKeyFinder::get_key_name(best.index)));
+        detectedKey = best.index;
       }
 
+      const auto windowKeys = getWindowKeys();
 
-      Component::SafePointer<MidiLoggerPluginDemoProcessor> owner;
-      juce::MidiMessage message;
-      juce::String source;
-    };
+      for (size_t i = 0; i < windowKeys.size(); ++i)
+      {
+        if (windowKeys[i] >= 0)
+          logMessage(keyWindows.getName((int) i) + ": " + MidiKeyFinder::get_key_name(windowKeys[i]));
+      }
 
+      if (lockedKey >= 0)
+        logMessage("Locked to " + String(MidiKeyFinder::get_key_name(lockedKey)));
 
-    // END KEYBOARD FUNCTIONS
+      if (auto* editor = getEditor())
+        editor->showKey(getShownKey());
 
+      if (microtonalKeys.getDivisions() != 12)
+        logMessage(String(microtonalKeys.getDivisions()) + "-EDO:\n" + microtonalKeys.getBestKeys(3));
 
+      if (Midi_Key_Finder_Util.get_chord().isValid())
+        logMessage("Chord: " + Midi_Key_Finder_Util.get_chord_name());
 
-private:
+      ChordPredictor::Suggestion next[3];
+      const auto numNext = Midi_Key_Finder_Util.suggest_next_chords(next, 3);
 
+      if (numNext > 0)
+      {
+        String s("Next:");
+        const auto& progression = Midi_Key_Finder_Util.get_progression();
 
-    class Editor  : public AudioProcessorEditor,
-                    private Value::Listener
-    {
-    public:
-        explicit Editor (MidiLoggerPluginDemoProcessor& ownerIn)
-            : AudioProcessorEditor (ownerIn),
-              owner2 (ownerIn),
-              table (owner2.model, owner2.Midi_Key_Finder_Util)
-        {
-            //addAndMakeVisible (table);
-            addAndMakeVisible (clearButton);
-            //addAndMakeVisible (resetButton);
+        for (int i = 0; i < numNext; ++i)
+          s += String(i > 0 ? "," : "") + " " + String(ChordTable::getName(ChordTable::fromId(next[i].chordId)))
+             + " (" + progression.getNumeralForChord(next[i].chordId) + ") " + String(roundToInt(next[i].probability * 100.0f)) + "%";
 
-            setResizable (true, true);
+        logMessage(s);
+      }
+
+      if (!offlineKeyTrack.empty())
+        logMessage("Offline render: " + describeOfflineKeyTrack());
+    }
+
+    /** The last offline render's key track, e.g. "C Major, A Minor at 1:12". */
+    String describeOfflineKeyTrack() const
+    {
+      constexpr size_t maxSegments = 8;
+      String s;
+
+      for (size_t i = 0; i < offlineKeyTrack.size() && i < maxSegments; ++i)
+      {
+        const auto& segment = offlineKeyTrack[i];
+        const auto key = toKeyFinderKey(segment.key);
+        const auto seconds = (int) segment.startTime;
+
+        s += (i > 0 ? ", " : "") + String(MidiKeyFinder::get_key_name(key));
+
+        if (i > 0)
+          s += String::formatted(" at %d:%02d", seconds / 60, seconds % 60);
+      }
+
+      if (offlineKeyTrack.size() > maxSegments)
+        s += ", ... (" + String((int) offlineKeyTrack.size()) + " keys)";
+
+      return s;
+    }
+
+    // MidiKeyFinder's key indices <-> OfflineKeyAnalyser's (C..B major, then C..B minor).
+    static int toOfflineKey(int keyIndex)
+    {
+      if (!isPositiveAndBelow(keyIndex, MidiKeyFinder::num_keys))
+        return -1;
+
+      return MidiKeyFinder::get_key_tonic(keyIndex) + (MidiKeyFinder::is_minor_key(keyIndex) ? 12 : 0);
+    }
+
+    static int toKeyFinderKey(int offlineKey)  { return MidiKeyFinder::get_key_index(offlineKey % 12, offlineKey >= 12); }
+
+    void resetAnalysis()
+    {
+      const ScopedLock sl(stateLock);
+      Midi_Key_Finder_Util.reset();
+      history.clear();
+      microtonalKeys.reset();
+      keyWindows.reset();
+      offlineKeyTrack.clear();
+      detectedKey = -1;
+      keyOutput.reset();
+      clearMessages();
+
+      if (auto* editor = getEditor())
+        editor->showKey(getShownKey());
+    }
+
+    /** Best key for the notes analysed between two times (seconds, on the
+        Time::getMillisecondCounterHiRes() * 0.001 clock), or -1 if there were none. */
+    int getKeyForWindow(double startTime, double endTime) const
+    {
+      MidiKeyFinder::RankedKey best;
+      const auto h = history.getHistogram(startTime, endTime);
+      return Midi_Key_Finder_Util.rank_keys(h, &best, 1) == 1 ? best.index : -1;
+    }
+
+    /** Records the MIDI the analysis is given to a session journal until stopJournal(), host
+        events before anything is filtered out. The analysis starts again from nothing, as
+        the replay's does, and states loaded while recording go into the journal. */
+    bool startJournal(const File& file)
+    {
+      auto writer = std::make_unique<SessionJournal::Writer>(file, currentSampleRate, currentBlockSize);
+
+      if (!writer->openedOk())
+        return false;
+
+      const ScopedLock sl(stateLock);
+      resetAnalysis();
+      journal = std::move(writer);
+      queue.setKeepIgnored(true);
+      return true;
+    }
+
+    void stopJournal()
+    {
+      queue.setKeepIgnored(false);
+      journal = nullptr;
+    }
+
+    /** Where every host MIDI event ended up. received == consumed + dropped + ignored + (still queued),
+        where ignored events are ones the analysis has no use for (clock, aftertouch, ...), and
+        truncated counts consumed events that the per-tick cap kept out of the analysis. */
+    struct MidiStats
+    {
+        uint64 received = 0, dropped = 0, consumed = 0, truncated = 0, ignored = 0;
+    };
+
+    MidiStats getMidiStats() const
+    {
+        auto stats = midiStats;
+        stats.dropped = queue.getNumDropped();
+        stats.ignored = queue.getNumIgnored() + offlineIgnored;
+        stats.received = queue.getNumPushed() + offlineReceived + stats.dropped + stats.ignored;
+        return stats;
+    }
+
+    /** What one instance holds on to, in bytes. The editor (only there while it's open),
+        the device scan and the offline workers (both shared by every instance) aren't counted. */
+    struct MemoryFootprint
+    {
+        size_t instance = 0;        // sizeof the processor, with everything it holds by value
+        size_t queue = 0;           // the host MIDI rings
+        size_t history = 0;         // AnalysisHistory's blocks
+        size_t progression = 0;     // the chords played so far
+        size_t offline = 0;         // offline renders in flight or not yet handed over, and host events waiting behind them
+        size_t display = 0;         // the message list and the log text kept for the editor
+        size_t devices = 0;         // a lower bound: the MIDI device manager object, not what it allocates
+
+        size_t getTotal() const     { return instance + queue + history + progression + offline + display + devices; }
+    };
+
+    MemoryFootprint getMemoryFootprint() const
+    {
+        MemoryFootprint f;
+        f.instance = sizeof (*this);
+        f.queue = queue.getMemoryUsed();
+        f.history = history.getMemoryUsed() + keyWindows.getMemoryUsed();
+        f.progression = Midi_Key_Finder_Util.get_progression().getMemoryUsed();
+        f.offline = offline.getMemoryUsed() + deferredEntries.capacity() * sizeof (MidiQueue::Entry)
+                      + offlineKeyTrack.capacity() * sizeof (OfflineKeyAnalyser::Segment)
+                      + (offlineHandover != nullptr ? offlineHandover->events.capacity() * sizeof (OfflineKeyAnalyser::Event) : 0);
+        f.display = model.getMemoryUsed() + keysText.getNumBytesAsUTF8();
+        f.devices = deviceInput != nullptr ? sizeof (DeviceInput) : 0;
+        return f;
+    }
+    bool isJournalling() const      { return journal != nullptr; }
+
+    /** Hands everything queued by processBlock and the MIDI devices to the analysis.
+        Called from the timer. */
+    void drainPendingMidi()
+    {
+        drain ([this] (auto&& analyseDeviceEvent)
+        {
+            // Everything from the MIDI devices, already merged into timestamp order.
+            if (deviceInput != nullptr)
+                deviceInput->merged.popMerged (analyseDeviceEvent);
+
+            // Then the on-screen keyboard.
+            for (const auto& e : keyboardEvents)
+                analyseDeviceEvent (e);
+
+            keyboardEvents.clear();
+        });
+    }
+
+    /** The journal replay's drainPendingMidi(): recorded device events stand in for the
+        devices and take the same path through the analysis. */
+    void drainPendingMidi (const std::vector<MergedMidiInput::Event>& deviceEvents)
+    {
+        drain ([&] (auto&& analyseDeviceEvent)
+        {
+            for (const auto& e : deviceEvents)
+                analyseDeviceEvent (e);
+        });
+    }
+
+    /** For the journal replay: loads a state the live session loaded, where it did. */
+    void applyJournalledState (const void* data, int size)
+    {
+        setStateInformation (data, size);
+        applyPendingState();
+    }
+
+    /** For the journal replay: the next processBlock() takes this block index and host time
+        instead of counting and reading the clock, as the recorded block did. */
+    void setNextBlockTime (uint32 blockIndex, double hostTime)
+    {
+        blockCounter = blockIndex;
+        nextBlockTime = hostTime;
+    }
+
+    /** A hash of the analysis as it stands: the note counts and durations, the length and
+        latest chord of the progression, and the detected key. The journal records it at
+        every drain, and the replay checks it drain by drain. */
+    uint64 getAnalysisFingerprint() const
+    {
+        SessionJournal::Fingerprint f;
+        f.add (Midi_Key_Finder_Util.get_histogram());
+        f.add (Midi_Key_Finder_Util.get_evidence());
+
+        const auto& progression = Midi_Key_Finder_Util.get_progression();
+        f.add (progression.size());
+
+        if (progression.size() > 0)
+        {
+            f.add (progression.getPosition (progression.size() - 1));
+            f.add (progression.getChordId (progression.size() - 1));
+        }
+
+        f.add (detectedKey.load());
+        return f.get();
+    }
+
+    // The live and replayed drains, which differ only in where the device events come from.
+    template <typename PopDeviceEvents>
+    void drain (PopDeviceEvents&& popDeviceEvents)
+    {
+        const ScopedLock sl (stateLock);
+        keyWindows.setSecondsPerBar (secondsPerBar);
+
+        std::vector<MidiQueue::Entry> entries;
+        entries.swap (deferredEntries);
+        queue.pop (std::back_inserter (entries));
+
+        const auto numIgnoredNotKept = queue.takeNumIgnoredNotKept();
+
+        if (journal != nullptr && numIgnoredNotKept > 0)
+            journal->addLost (numIgnoredNotKept);
+
+        // Whatever the host played after an offline render started waits until the
+        // render's own events have been handed over, so the analysis sees them in order.
+        const auto renderBlock = pendingOfflineBlock();
+        const auto firstAfterRender = renderBlock < 0 ? entries.end()
+                                                      : std::stable_partition (entries.begin(), entries.end(), [renderBlock] (const MidiQueue::Entry& e)
+                                                                               {
+                                                                                   return (int64) e.blockIndex < renderBlock;
+                                                                               });
+        auto numFromHost = addHostEntries (entries.begin(), firstAfterRender);
+        numFromHost += handOverOfflineEvents();
+
+        if (pendingOfflineBlock() < 0)
+            numFromHost += addHostEntries (firstAfterRender, entries.end());
+        else
+            deferredEntries.assign (firstAfterRender, entries.end());
+
+        bool anyFromDevices = false;
+        const auto microtonal = microtonalKeys.getDivisions() != 12;
+
+        popDeviceEvents ([&] (const MergedMidiInput::Event& e)
+        {
+            if (journal != nullptr)
+                journal->addDeviceEvent (e.slot, e.timeStamp, e.data, e.size);
+
+            const MidiMessage m (e.data, e.size, e.timeStamp);
+            const juce::ScopedValueSetter<bool> scopedInputFlag (isAddingFromMidiInput, true);
+            keyboardState.processNextMidiEvent (m);
+            Midi_Key_Finder_Util.add_midi_message (m);
+            advanceKeyWindows (e.timeStamp);
+            history.add (e.timeStamp, m);
+
+            if (microtonal)
+                microtonalKeys.addMidiMessage (m);
+
+            anyFromDevices = true;
+        });
+
+        if (anyFromDevices)
+            showDetectedKeys();
+
+        if (journal != nullptr && (anyFromDevices || numFromHost > 0))
+            journal->addDrain (getAnalysisFingerprint());
+    }
+
+    template <typename It>
+    size_t addHostEntries (It begin, It end)
+    {
+        std::vector<MidiMessage> messages;
+        messages.reserve ((size_t) std::distance (begin, end));
+
+        for (auto it = begin; it != end; ++it)
+        {
+            const auto& e = *it;
+
+            if (journal != nullptr)
+                journal->addHostEvent (e.blockIndex, e.hostTime, (int) e.message.getTimeStamp(),
+                                       e.message.getRawData(), e.message.getRawDataSize());
+
+            // The replay's queue filters these out again, and counts them as ignored.
+            if (e.ignored)
+                continue;
+
+            // From here on the time stamp is when the event happened, for the history.
+            auto m = e.message;
+            m.setTimeStamp (e.hostTime + m.getTimeStamp() / currentSampleRate);
+            messages.push_back (m);
+        }
+
+        //model.addMessages (messages.begin(), messages.end());
+        addMIDIMessages(messages.begin(), messages.end());
+        return messages.size();
+    }
+
+    /** The first block whose host events must wait for an offline render, or -1. */
+    int64 pendingOfflineBlock() const
+    {
+        return offlineHandover != nullptr ? (int64) offlineHandover->firstBlock : offline.getFirstPendingBlock();
+    }
+
+    /** Gives the realtime analysis the next batch of events from a finished offline render,
+        as if they had come through the queue. Returns the number handed over. */
+    size_t handOverOfflineEvents()
+    {
+        offline.update();
+
+        if (offlineHandover == nullptr)
+        {
+            offlineHandover = offline.takeResult();
+
+            if (offlineHandover == nullptr)
+                return 0;
+
+            offlineHandedOver = 0;
+            offlineReceived += (uint64) offlineHandover->events.size();
+            offlineIgnored += (uint64) offlineHandover->numIgnored;
+        }
+
+        const auto& events = offlineHandover->events;
+        const auto num = jmin ((size_t) numToStore2, events.size() - offlineHandedOver);
+
+        std::vector<MidiMessage> messages;
+        messages.reserve (num);
+
+        for (size_t i = offlineHandedOver; i < offlineHandedOver + num; ++i)
+        {
+            const auto& e = events[i];
+            const auto time = offlineHandover->getWallTime (e.time);
+
+            // At offset 0 of a block record of its own time, which is the time it's analysed at.
+            if (journal != nullptr)
+                journal->addHostEvent (e.blockIndex, time, 0, e.message.getRawData(), e.message.getRawDataSize());
+
+            auto m = e.message;
+            m.setTimeStamp (time);
+            messages.push_back (m);
+        }
+
+        addMIDIMessages(messages.begin(), messages.end());
+        offlineHandedOver += num;
+
+        if (offlineHandedOver == events.size())
+        {
+            offlineKeyTrack = std::move (offlineHandover->keyTrack);
+            offlineHandover = nullptr;
+            keysNeedShowing = true;
+        }
+
+        return num;
+    }
+
+    // This is used to dispach an incoming message to the message thread
+    class IncomingMessageCallback : public juce::CallbackMessage
+    {
+    public:
+      IncomingMessageCallback(MidiLoggerPluginDemoProcessor* o, const juce::MidiMessage& m, const juce::String& s)
+        : owner(o), message(m), source(s)
+      {}
+
+      void messageCallback() override
+      {
+        if (owner != nullptr)
+          owner->addMessageToList(message, source);
+      }
+
+
+      Component::SafePointer<MidiLoggerPluginDemoProcessor> owner;
+      juce::MidiMessage message;
+      juce::String source;
+    };
+
+
+    // END KEYBOARD FUNCTIONS
+
+
+
+private:
+
+
+    class Editor  : public AudioProcessorEditor,
+                    private Value::Listener
+    {
+    public:
+        explicit Editor (MidiLoggerPluginDemoProcessor& ownerIn)
+            : AudioProcessorEditor (ownerIn),
+              owner2 (ownerIn),
+              table (owner2.model, owner2.Midi_Key_Finder_Util),
+              progressionView (owner2.Midi_Key_Finder_Util.get_progression()),
+              keyboardComponent (owner2.keyboardState, KeyHighlightKeyboard::verticalKeyboardFacingRight)
+        {
+            //addAndMakeVisible (table);
+            addAndMakeVisible (clearButton);
+            //addAndMakeVisible (resetButton);
+
+            setResizable (true, true);
             lastUIWidth .referTo (owner2.state.getChildWithName ("uiState").getPropertyAsValue ("width",  nullptr));
             lastUIHeight.referTo (owner2.state.getChildWithName ("uiState").getPropertyAsValue ("height", nullptr));
             setSize (lastUIWidth.getValue(), lastUIHeight.getValue());
@@ -595,56 +1728,105 @@ private:
             lastUIHeight.addListener (this);
 
             
-            clearButton.onClick = [&] { owner2.Midi_Key_Finder_Util.reset(); owner2.midiMessagesBox.clear(); };
+            clearButton.onClick = [&] { owner2.resetAnalysis(); };
+
+            addAndMakeVisible (progressionView);
+
+            addAndMakeVisible (tuningList);
+
+            for (auto divisions : MicrotonalKeyFinder::supportedDivisions)
+                tuningList.addItem (String (divisions) + "-EDO", divisions);
+
+            tuningList.setSelectedId (owner2.getDivisions(), dontSendNotification);
+            tuningList.onChange = [this] { owner2.setDivisions (tuningList.getSelectedId()); };
+
+            // Item ids are KeyChangeOutput::Format + 1.
+            addAndMakeVisible (keyOutputList);
+            keyOutputList.addItem ("Key out: off", KeyChangeOutput::off + 1);
+            keyOutputList.addItem ("Key out: CC", KeyChangeOutput::controller + 1);
+            keyOutputList.addItem ("Key out: SysEx", KeyChangeOutput::sysEx + 1);
+            keyOutputList.setSelectedId (owner2.getKeyOutputFormat() + 1, dontSendNotification);
+            keyOutputList.onChange = [this]
+            {
+                owner2.setKeyOutput ((KeyChangeOutput::Format) (keyOutputList.getSelectedId() - 1),
+                                     owner2.keyOutput.getChannel(), owner2.keyOutput.getControllerNumber());
+            };
+
+            addAndMakeVisible (recordButton);
+            recordButton.setToggleState (owner2.isJournalling(), dontSendNotification);
+            recordButton.onClick = [this] { toggleJournal(); };
             
 
 
             //FOR KEYBOARD
-            owner2.midiInputListLabel.setText("MIDI Input:", juce::dontSendNotification);
-            owner2.midiInputListLabel.attachToComponent(&owner2.midiInputList, true);
+            midiInputListLabel.setText("MIDI Input:", juce::dontSendNotification);
+            midiInputListLabel.attachToComponent(&midiInputList, true);
+
+            addAndMakeVisible(midiInputList);
+            midiInputList.setTextWhenNoChoicesAvailable("No MIDI Inputs Enabled");
+            midiInputList.onChange = [this] { owner2.midiInputListChanged(midiInputList.getSelectedId()); };
+
+            // Uses whatever the background scan has found so far; the list fills in
+            // through changeListenerCallback once the scan completes. This editor isn't
+            // the active one yet, so it fills its own list.
+            owner2.refreshMidiInputList();
+            updateInputList();
+
+            addAndMakeVisible(keyboardComponent);
+            owner2.keyboardState.addListener(&owner2);
+            showKey(owner2.getShownKey());
+
+            addAndMakeVisible(midiMessagesBox);
+            midiMessagesBox.setMultiLine(true);
+            midiMessagesBox.setReturnKeyStartsNewLine(true);
+            midiMessagesBox.setReadOnly(true);
+            midiMessagesBox.setScrollbarsShown(true);
+            midiMessagesBox.setCaretVisible(false);
+            midiMessagesBox.setPopupMenuEnabled(true);
+            midiMessagesBox.setFont(Font(20.0f, 1));
+            midiMessagesBox.setColour(juce::TextEditor::backgroundColourId, juce::Colour(0x32ffffff));
+            midiMessagesBox.setColour(juce::TextEditor::outlineColourId, juce::Colour(0x1c000000));
+            midiMessagesBox.setColour(juce::TextEditor::shadowColourId, juce::Colour(0x16000000));
+            midiMessagesBox.setText(owner2.keysText, false);
+
 
-            addAndMakeVisible(owner2.midiInputList);
-            owner2.midiInputList.setTextWhenNoChoicesAvailable("No MIDI Inputs Enabled");
-            auto midiInputs = juce::MidiInput::getAvailableDevices();
+        }
 
+        /** Fills the input list from the processor's cached device scan. */
+        void updateInputList()
+        {
             juce::StringArray midiInputNames;
 
-            for (auto input : midiInputs)
-              midiInputNames.add(input.name);
+            for (auto input : owner2.midiInputs)
+                midiInputNames.add(input.name);
 
-            owner2.midiInputList.addItemList(midiInputNames, 1);
-            owner2.midiInputList.onChange = [this] { owner2.setMidiInput(owner2.midiInputList.getSelectedItemIndex()); };
+            midiInputList.clear(juce::dontSendNotification);
 
-            // find the first enabled device and use that by default
-            for (auto input : midiInputs)
+            if (owner2.midiInputs.size() > 1)
             {
-              if (owner2.deviceManager.isMidiInputDeviceEnabled(input.identifier))
-              {
-                owner2.setMidiInput(midiInputs.indexOf(input));
-                break;
-              }
+                midiInputList.addItem("All MIDI Inputs", allInputsItemId);
+                midiInputList.addSeparator();
             }
 
-            // if no enabled devices were found just use the first one in the list
-            if (owner2.midiInputList.getSelectedId() == 0)
-              owner2.setMidiInput(0);
-
-            addAndMakeVisible(owner2.keyboardComponent);
-            owner2.keyboardState.addListener(&owner2);
+            midiInputList.addItemList(midiInputNames, 1);
+            midiInputList.setSelectedId(owner2.selectedInputId, juce::dontSendNotification);
+        }
 
-            addAndMakeVisible(owner2.midiMessagesBox);
-            owner2.midiMessagesBox.setMultiLine(true);
-            owner2.midiMessagesBox.setReturnKeyStartsNewLine(true);
-            owner2.midiMessagesBox.setReadOnly(true);
-            owner2.midiMessagesBox.setScrollbarsShown(true);
-            owner2.midiMessagesBox.setCaretVisible(false);
-            owner2.midiMessagesBox.setPopupMenuEnabled(true);
-            owner2.midiMessagesBox.setFont(Font(20.0f, 1));
-            owner2.midiMessagesBox.setColour(juce::TextEditor::backgroundColourId, juce::Colour(0x32ffffff));
-            owner2.midiMessagesBox.setColour(juce::TextEditor::outlineColourId, juce::Colour(0x1c000000));
-            owner2.midiMessagesBox.setColour(juce::TextEditor::shadowColourId, juce::Colour(0x16000000));
+        void appendKeys(const juce::String& text)
+        {
+            midiMessagesBox.moveCaretToEnd();
+            midiMessagesBox.insertTextAtCaret(text);
+        }
 
+        void clearKeys()    { midiMessagesBox.clear(); }
 
+        /** Marks a key (MidiKeyFinder's index, -1 for none) on the keyboard. */
+        void showKey(int keyIndex)
+        {
+            if (isPositiveAndBelow(keyIndex, MidiKeyFinder::num_keys))
+                keyboardComponent.setKey(MidiKeyFinder::get_key_tonic(keyIndex), MidiKeyFinder::is_minor_key(keyIndex));
+            else
+                keyboardComponent.setKey(-1, false);
         }
 
         void paint (Graphics& g) override
@@ -657,12 +1839,17 @@ private:
             auto bounds = getLocalBounds();
 
 
-            owner2.midiInputList.setBounds(bounds.removeFromTop(36).removeFromRight(getWidth() - 150).reduced(8));
-            owner2.keyboardComponent.setBounds(bounds.removeFromLeft(120).reduced(8));
-            owner2.midiMessagesBox.setBounds(bounds.removeFromLeft(250).reduced(8));
+            midiInputList.setBounds(bounds.removeFromTop(36).removeFromRight(getWidth() - 150).reduced(8));
+            progressionView.setBounds(bounds.removeFromBottom(76).reduced(8));
+            keyboardComponent.setBounds(bounds.removeFromLeft(120).reduced(8));
+            midiMessagesBox.setBounds(bounds.removeFromLeft(250).reduced(8));
 
             //table.setBounds(bounds.removeFromLeft(300).reduced(8));
-            clearButton.setBounds(bounds.removeFromLeft(100).withSizeKeepingCentre(100, getHeight() - 50).reduced(8,0));
+            auto buttons = bounds.removeFromLeft(100);
+            tuningList.setBounds(buttons.removeFromTop(36).reduced(8, 6));
+            keyOutputList.setBounds(buttons.removeFromTop(36).reduced(8, 6));
+            recordButton.setBounds(buttons.removeFromBottom(36).reduced(8));
+            clearButton.setBounds(buttons.withSizeKeepingCentre(100, buttons.getHeight() - 50).reduced(8,0));
             //resetButton.setBounds(bounds.removeFromLeft(80).withSizeKeepingCentre(50, 24));
             
 
@@ -672,6 +1859,22 @@ private:
 
     private:
 
+        void toggleJournal()
+        {
+            if (! recordButton.getToggleState())
+            {
+                owner2.stopJournal();
+                return;
+            }
+
+            const auto folder = File::getSpecialLocation (File::userDocumentsDirectory).getChildFile ("AutoKey Journals");
+            folder.createDirectory();
+
+            const auto file = folder.getNonexistentChildFile (Time::getCurrentTime().formatted ("session-%Y%m%d-%H%M%S"), ".akj");
+
+            if (! owner2.startJournal (file))
+                recordButton.setToggleState (false, dontSendNotification);
+        }
 
         void valueChanged (Value&) override
         {
@@ -681,20 +1884,527 @@ private:
         MidiLoggerPluginDemoProcessor& owner2;
 
         MidiTable table;
+        ProgressionView progressionView;
         TextButton clearButton { "Clear" };
+        ComboBox tuningList;
+        ComboBox keyOutputList;
         TextButton resetButton { "RESET" };
+        ToggleButton recordButton { "Record" };
+
+        juce::ComboBox midiInputList;
+        juce::Label midiInputListLabel;
+        KeyHighlightKeyboard keyboardComponent;
+        juce::TextEditor midiMessagesBox;
 
         Value lastUIWidth, lastUIHeight;
 
 
     };
 
+    Editor* getEditor() const       { return dynamic_cast<Editor*> (getActiveEditor()); }
+
     void timerCallback() override
     {
-        std::vector<MidiMessage> messages;
-        queue.pop (std::back_inserter (messages));
-        //model.addMessages (messages.begin(), messages.end());
-        addMIDIMessages(messages.begin(), messages.end());
+        const ScopedLock sl (stateLock);
+        applyPendingState();
+        drainPendingMidi();
+        keyOutput.notifyParameterListeners();
+
+        if (keysNeedShowing.exchange (false))
+            showDetectedKeys();
+    }
+
+    // Everything the plugin state holds, as plain data. getStateInformation() copies it out
+    // under stateLock and then sizes and writes that one copy. A loaded state waits in
+    // pendingState until the message thread, which owns the analysis, applies it; the
+    // sections it didn't have are left empty and don't change anything.
+    struct SavedState
+    {
+        struct Analysis
+        {
+            MidiKeyFinder::Histogram histogram {};
+            uint16 notesMask = 0;
+            uint32 notesSeen = 0;
+        };
+
+        struct Config
+        {
+            uint64 historyBudget = AnalysisHistory::defaultMemoryBudget;
+            int lockedKey = -1;
+        };
+
+        struct KeyOutput
+        {
+            KeyChangeOutput::Format format = KeyChangeOutput::off;
+            int channel = 16, controllerNumber = 20;
+        };
+
+        std::optional<std::pair<int, int>> uiSize;
+        std::optional<Analysis> analysis;
+        std::optional<MidiKeyFinder::Histogram> evidence;
+        std::optional<Config> config;
+        std::optional<int> divisions;
+        std::optional<std::vector<float>> windows;
+        std::optional<KeyOutput> keyOutput;
+        std::vector<std::pair<uint32, int>> progression;        // position, chord id
+        std::vector<std::pair<int, int>> transitions;           // predictor cell, count
+        std::optional<AnalysisHistory::Saved> history;
+    };
+
+    // The newest 256 KB of the history, about 80,000 notes, go into the state. The
+    // checkpoints keep the whole-song counts right for anything older.
+    static constexpr size_t maxSavedHistoryBlocks = 64;
+
+    // Caller holds stateLock.
+    SavedState getSavedState() const
+    {
+        SavedState s;
+        const auto ui = state.getChildWithName ("uiState");
+        s.uiSize = std::make_pair ((int) ui["width"], (int) ui["height"]);
+        s.analysis = SavedState::Analysis { Midi_Key_Finder_Util.get_histogram(), Midi_Key_Finder_Util.get_notes_mask(),
+                                            Midi_Key_Finder_Util.get_notes_seen() };
+        s.evidence = Midi_Key_Finder_Util.get_evidence();
+        s.config = SavedState::Config { (uint64) history.getMemoryBudget(), lockedKey };
+        s.divisions = microtonalKeys.getDivisions();
+        s.windows = keyWindows.getLengths();
+        s.keyOutput = SavedState::KeyOutput { keyOutput.getFormat(), keyOutput.getChannel(), keyOutput.getControllerNumber() };
+
+        const auto& progression = Midi_Key_Finder_Util.get_progression();
+        s.progression.reserve ((size_t) progression.size());
+
+        for (int i = 0; i < progression.size(); ++i)
+            s.progression.emplace_back (progression.getPosition (i), progression.getChordId (i));
+
+        const auto& predictor = Midi_Key_Finder_Util.get_predictor();
+        s.transitions.reserve ((size_t) predictor.getNumCounts());
+        predictor.forEachCount ([&] (int cell, int count) { s.transitions.emplace_back (cell, count); });
+
+        s.history = history.save (maxSavedHistoryBlocks);
+        return s;
+    }
+
+    static size_t getStateSizeUpperBound (const SavedState& s)
+    {
+        using namespace PluginState;
+        auto size = (size_t) (headerSize + 10 * sectionHeaderSize
+                               + 2 * 4                      // ui
+                               + 12 * 4 + 2 + 4             // analysis
+                               + 12 * 4                     // evidence
+                               + 8 + 1                      // config
+                               + 1                          // tuning
+                               + 1 + 4 * KeyWindows::maxWindows   // windows
+                               + 3                          // key output
+                               + maxVarintSize * (1 + 2 * s.progression.size())
+                               + maxVarintSize * (1 + 2 * s.transitions.size()));
+
+        if (s.history)
+        {
+            size += 3 * maxVarintSize + 8 + 12 * 4;
+
+            for (const auto& block : s.history->blocks)
+                size += 2 * 8 + 12 * 4 + 2 * maxVarintSize + block.data.size();
+        }
+
+        return size;
+    }
+
+    static void writeState (const SavedState& s, PluginState::Writer& w)
+    {
+        if (s.uiSize)
+        {
+            w.beginSection (PluginState::uiSection);
+            w.writeInt32 (s.uiSize->first);
+            w.writeInt32 (s.uiSize->second);
+            w.endSection();
+        }
+
+        if (s.analysis)
+        {
+            w.beginSection (PluginState::analysisSection);
+
+            for (auto weight : s.analysis->histogram)
+                w.writeFloat (weight);
+
+            w.writeUInt16 (s.analysis->notesMask);
+            w.writeUInt32 (s.analysis->notesSeen);
+            w.endSection();
+        }
+
+        if (s.evidence)
+        {
+            w.beginSection (PluginState::evidenceSection);
+
+            for (auto seconds : *s.evidence)
+                w.writeFloat (seconds);
+
+            w.endSection();
+        }
+
+        if (s.config)
+        {
+            w.beginSection (PluginState::configSection);
+            w.writeUInt64 (s.config->historyBudget);
+            w.writeInt8 ((int8) s.config->lockedKey);
+            w.endSection();
+        }
+
+        if (s.divisions)
+        {
+            w.beginSection (PluginState::tuningSection);
+            w.writeUInt8 ((uint8) *s.divisions);
+            w.endSection();
+        }
+
+        if (s.windows)
+        {
+            w.beginSection (PluginState::windowsSection);
+            w.writeUInt8 ((uint8) s.windows->size());
+
+            for (auto bars : *s.windows)
+                w.writeFloat (bars);
+
+            w.endSection();
+        }
+
+        if (s.keyOutput)
+        {
+            w.beginSection (PluginState::keyOutputSection);
+            w.writeUInt8 ((uint8) s.keyOutput->format);
+            w.writeUInt8 ((uint8) s.keyOutput->channel);
+            w.writeUInt8 ((uint8) s.keyOutput->controllerNumber);
+            w.endSection();
+        }
+
+        w.beginSection (PluginState::progressionSection);
+        w.writeVarint ((uint64) s.progression.size());
+
+        uint32 last = 0;
+
+        for (const auto& step : s.progression)
+        {
+            w.writeVarint (step.first - jmin (step.first, last));
+            w.writeVarint ((uint64) step.second);
+            last = step.first;
+        }
+
+        w.endSection();
+
+        // After the analysis section, whose restore clears what was learned.
+        w.beginSection (PluginState::transitionsSection);
+        w.writeVarint ((uint64) s.transitions.size());
+
+        int lastCell = 0;
+
+        for (const auto& transition : s.transitions)
+        {
+            w.writeVarint ((uint64) (transition.first - lastCell));
+            w.writeVarint ((uint64) transition.second);
+            lastCell = transition.first;
+        }
+
+        w.endSection();
+
+        if (s.history)
+        {
+            const auto& h = *s.history;
+            w.beginSection (PluginState::historySection);
+            w.writeVarint ((uint64) h.numEvents);
+            w.writeVarint ((uint64) h.numEventsDropped);
+            w.writeUInt64 ((uint64) h.lastTimeMs);
+            writeCounts (w, h.totals);
+            w.writeVarint ((uint64) h.blocks.size());
+
+            for (const auto& block : h.blocks)
+            {
+                w.writeUInt64 ((uint64) block.startTimeMs);
+                w.writeUInt64 ((uint64) block.lastTimeMs);
+                writeCounts (w, block.counts);
+                w.writeVarint ((uint64) block.numEvents);
+                w.writeVarint ((uint64) block.data.size());
+                w.writeBytes (block.data.data(), block.data.size());
+            }
+
+            w.endSection();
+        }
+    }
+
+    static void writeCounts (PluginState::Writer& w, const AnalysisHistory::Counts& counts)
+    {
+        for (auto count : counts)
+            w.writeUInt32 (count);
+    }
+
+    static AnalysisHistory::Counts readCounts (PluginState::Reader& r)
+    {
+        AnalysisHistory::Counts counts;
+
+        for (auto& count : counts)
+            count = r.readUInt32();
+
+        return counts;
+    }
+
+    // Any thread: only parses, the processor is left alone.
+    static SavedState readState (PluginState::Reader& r)
+    {
+        SavedState s;
+        PluginState::Section section;
+
+        while (r.nextSection (section))
+        {
+            switch (section)
+            {
+                case PluginState::uiSection:
+                {
+                    const auto width = r.readInt32();
+                    const auto height = r.readInt32();
+
+                    if (r.ok())
+                        s.uiSize = std::make_pair (width, height);
+
+                    break;
+                }
+
+                case PluginState::analysisSection:
+                {
+                    SavedState::Analysis analysis;
+
+                    for (auto& weight : analysis.histogram)
+                    {
+                        weight = r.readFloat();
+
+                        if (! std::isfinite (weight) || weight < 0.0f)
+                            weight = 0.0f;
+                    }
+
+                    analysis.notesMask = r.readUInt16();
+                    analysis.notesSeen = r.readUInt32();
+
+                    if (r.ok())
+                        s.analysis = analysis;
+
+                    break;
+                }
+
+                case PluginState::evidenceSection:
+                {
+                    MidiKeyFinder::Histogram evidence;
+
+                    for (auto& seconds : evidence)
+                    {
+                        seconds = r.readFloat();
+
+                        if (! std::isfinite (seconds) || seconds < 0.0f)
+                            seconds = 0.0f;
+                    }
+
+                    if (r.ok())
+                        s.evidence = evidence;
+
+                    break;
+                }
+
+                case PluginState::configSection:
+                {
+                    const auto budget = r.readUInt64();
+                    const auto key = r.readInt8();
+
+                    if (r.ok())
+                        s.config = SavedState::Config { jlimit ((uint64) 64 * 1024, (uint64) 1 << 30, budget),
+                                                        jlimit (-1, MidiKeyFinder::num_keys - 1, (int) key) };
+
+                    break;
+                }
+
+                case PluginState::progressionSection:
+                {
+                    const auto count = r.readVarint();
+                    uint64 position = 0;
+
+                    for (uint64 i = 0; i < count && r.ok(); ++i)
+                    {
+                        position += r.readVarint();
+                        const auto chordId = r.readVarint();
+
+                        if (r.ok())
+                            s.progression.emplace_back ((uint32) position, (int) jmin (chordId, (uint64) INT_MAX));
+                    }
+
+                    break;
+                }
+
+                case PluginState::tuningSection:
+                {
+                    const auto divisions = r.readUInt8();
+
+                    if (r.ok())
+                        s.divisions = (int) divisions;
+
+                    break;
+                }
+
+                case PluginState::windowsSection:
+                {
+                    std::vector<float> bars ((size_t) jmin ((int) r.readUInt8(), KeyWindows::maxWindows));
+
+                    for (auto& length : bars)
+                        length = r.readFloat();
+
+                    if (r.ok())
+                        s.windows = std::move (bars);
+
+                    break;
+                }
+
+                case PluginState::transitionsSection:
+                {
+                    const auto count = r.readVarint();
+                    uint64 cell = 0;
+
+                    for (uint64 i = 0; i < count && r.ok() && cell < (uint64) ChordPredictor::numCells; ++i)
+                    {
+                        cell += r.readVarint();
+                        const auto transitions = r.readVarint();
+
+                        if (r.ok())
+                            s.transitions.emplace_back ((int) jmin (cell, (uint64) ChordPredictor::numCells), (int) jmin (transitions, (uint64) 0xffff));
+                    }
+
+                    break;
+                }
+
+                case PluginState::keyOutputSection:
+                {
+                    const auto format = r.readUInt8();
+                    const auto channel = r.readUInt8();
+                    const auto number = r.readUInt8();
+
+                    if (r.ok())
+                        s.keyOutput = SavedState::KeyOutput { (KeyChangeOutput::Format) jmin ((int) format, (int) KeyChangeOutput::sysEx),
+                                                              (int) channel, (int) number };
+
+                    break;
+                }
+
+                case PluginState::historySection:
+                {
+                    AnalysisHistory::Saved h;
+                    h.numEvents = (int64) jmin (r.readVarint(), (uint64) INT64_MAX);
+                    h.numEventsDropped = (int64) jmin (r.readVarint(), (uint64) INT64_MAX);
+                    h.lastTimeMs = (int64) r.readUInt64();
+                    h.totals = readCounts (r);
+
+                    // Each block takes at least this many bytes, which bounds what a bad count can allocate.
+                    const auto numBlocks = jmin (r.readVarint(), (uint64) r.getNumBytesLeft() / (2 * 8 + 12 * 4 + 2));
+
+                    for (uint64 i = 0; i < numBlocks && r.ok(); ++i)
+                    {
+                        AnalysisHistory::Saved::Block block;
+                        block.startTimeMs = (int64) r.readUInt64();
+                        block.lastTimeMs = (int64) r.readUInt64();
+                        block.counts = readCounts (r);
+                        block.numEvents = (int) jmin (r.readVarint(), (uint64) AnalysisHistory::blockSize);
+                        block.data.resize ((size_t) jmin (r.readVarint(), (uint64) AnalysisHistory::blockSize + 1));
+
+                        if (r.readBytes (block.data.data(), block.data.size()))
+                            h.blocks.push_back (std::move (block));
+                    }
+
+                    if (r.ok())
+                        s.history = std::move (h);
+
+                    break;
+                }
+
+                default:
+                    break;
+            }
+        }
+
+        return s;
+    }
+
+    // Message thread: brings a loaded state into the analysis, in the order the sections
+    // were always applied in.
+    void applySavedState (const SavedState& s)
+    {
+        const ScopedLock sl (stateLock);
+
+        // The replay loads it at the same point.
+        if (journal != nullptr)
+        {
+            MemoryBlock block (getStateSizeUpperBound (s));
+            PluginState::Writer writer (block.getData(), block.getSize());
+            writeState (s, writer);
+            journal->addState (block.getData(), writer.getNumBytesWritten());
+        }
+
+        if (s.uiSize)
+            setUISize (s.uiSize->first, s.uiSize->second);
+
+        if (s.analysis)
+        {
+            Midi_Key_Finder_Util.restore (s.analysis->histogram, s.analysis->notesMask, s.analysis->notesSeen);
+            keyWindows.reset();
+        }
+
+        // States saved before the durations were kept rank on the note counts until new notes sound.
+        if (s.evidence)
+            Midi_Key_Finder_Util.restore_evidence (*s.evidence);
+
+        // So the host's key parameters don't wait for new notes either.
+        if (s.analysis)
+            keyOutput.restore (Midi_Key_Finder_Util.get_evidence(), Midi_Key_Finder_Util.get_histogram());
+
+        if (s.config)
+        {
+            history.setMemoryBudget ((size_t) s.config->historyBudget);
+            setLockedKey (s.config->lockedKey);
+        }
+
+        if (s.divisions)
+            microtonalKeys.setDivisions (*s.divisions);
+
+        if (s.windows)
+            keyWindows.setLengths (*s.windows);
+
+        if (s.keyOutput)
+            setKeyOutput (s.keyOutput->format, s.keyOutput->channel, s.keyOutput->controllerNumber);
+
+        for (const auto& step : s.progression)
+            Midi_Key_Finder_Util.restore_progression_step (step.first, step.second);
+
+        for (const auto& transition : s.transitions)
+            Midi_Key_Finder_Util.restore_transition (transition.first, transition.second);
+
+        // A history that doesn't decode is dropped, as is one from a state that only
+        // had the running totals.
+        if (s.history)
+            history.restore (*s.history);
+        else if (s.analysis)
+            history.clear();
+
+        // The keys are back as soon as the next timer tick, without waiting for new MIDI.
+        keysNeedShowing = true;
+    }
+
+    void applyPendingState()
+    {
+        const ScopedLock sl (stateLock);
+
+        if (pendingState != nullptr)
+            applySavedState (*std::exchange (pendingState, nullptr));
+    }
+
+    void setUISize (int width, int height)
+    {
+        auto ui = state.getChildWithName ("uiState");
+
+        if (width > 0 && height > 0)
+        {
+            ui.setProperty ("width", width, nullptr);
+            ui.setProperty ("height", height, nullptr);
+        }
     }
 
 
@@ -704,27 +2414,67 @@ private:
     {
       const auto numNewMessages = (int)std::distance(begin, end);
       const auto numToAdd = juce::jmin(numToStore2, numNewMessages);
-      const auto numToRemove = jmax(0, (int)messages2.size() + numToAdd - numToStore2);
-      messages2.erase(messages2.begin(), std::next(messages2.begin(), numToRemove));
-      messages2.insert(messages2.end(), std::prev(end, numToAdd), end);
-      
-      for (MidiMessage m : messages2) {
-        addMessageToList(m, "Midi-in");
+      midiStats.consumed += (uint64) numNewMessages;
+      midiStats.truncated += (uint64) (numNewMessages - numToAdd);
+
+      // In 12-EDO the regular analysis is all there is, and nothing reads the microtonal one.
+      const auto microtonal = microtonalKeys.getDivisions() != 12;
+
+      // Only the newest numToStore2 are analysed, straight from the caller's buffer.
+      for (auto it = std::prev(end, numToAdd); it != end; ++it) {
+        const MidiMessage& m = *it;
+        Midi_Key_Finder_Util.add_midi_message(m);
+        advanceKeyWindows(m.getTimeStamp());
+        history.add(m.getTimeStamp(), m);
+
+        if (microtonal)
+          microtonalKeys.addMidiMessage(m);
       }
-      messages2.clear();
+
+      if (numToAdd > 0)
+        showDetectedKeys();
       //midiMessagesBox.clear();
 
     }
 
     static constexpr auto numToStore2 = 1000;
-    std::vector<MidiMessage> messages2;
+    static constexpr int allInputsItemId = 10000;
+    MidiStats midiStats;                            // consumed/truncated, message thread only
 
 
     template <typename Element>
     void process (AudioBuffer<Element>& audio, MidiBuffer& midi)
     {
         audio.clear();
-        queue.push (midi);
+        const auto now = nextBlockTime >= 0.0 ? std::exchange (nextBlockTime, -1.0)
+                                              : Time::getMillisecondCounterHiRes() * 0.001;
+
+        if (auto* playHead = getPlayHead())
+        {
+            AudioPlayHead::CurrentPositionInfo position;
+
+            if (playHead->getCurrentPosition (position) && position.bpm > 0.0 && position.timeSigDenominator > 0)
+                secondsPerBar = 60.0 / position.bpm * position.timeSigNumerator * 4.0 / position.timeSigDenominator;
+        }
+
+        if (isNonRealtime())
+        {
+            // Rendering offline: nothing is waiting on us, so the heavier analysis takes the block.
+            if (! std::exchange (renderingOffline, true))
+                offline.beginRender (blockCounter, now, toOfflineKey (detectedKey));
+
+            offline.addBlock (midi, blockCounter++, audio.getNumSamples(), currentSampleRate, now);
+        }
+        else
+        {
+            if (std::exchange (renderingOffline, false))
+                offline.endRender();
+
+            queue.push (midi, blockCounter++, now);
+        }
+
+        // After the analysis has taken its copy, so it never sees the key changes themselves.
+        keyOutput.process (midi, audio.getNumSamples());
     }
 
     static BusesProperties getBusesLayout()
@@ -736,6 +2486,26 @@ private:
 
     ValueTree state { "state" };
     MidiQueue queue;
+    uint32 blockCounter = 0;                        // audio thread only
+    double nextBlockTime = -1.0;                    // set by the journal replay, audio thread only
+    double currentSampleRate = 44100.0;
+    int currentBlockSize = 512;
+    std::unique_ptr<SessionJournal::Writer> journal; // message thread only
+    int lockedKey = -1;
+    CriticalSection stateLock;                      // held by whatever changes what the plugin state saves
+    std::unique_ptr<SavedState> pendingState;       // loaded by the host, until the message thread applies it
+    std::atomic<bool> keysNeedShowing { false };
+    std::atomic<int> detectedKey { -1 };            // the realtime tier's best key, for the offline tier to start from
+    std::atomic<double> secondsPerBar { 2.0 };      // from the host's tempo and time signature, for the key windows
+    KeyChangeOutput keyOutput;                      // key changes to the host, from the audio thread
+
+    OfflineKeyAnalyser offline;
+    bool renderingOffline = false;                  // audio thread only
+    std::unique_ptr<OfflineKeyAnalyser::Result> offlineHandover;  // message thread from here down
+    size_t offlineHandedOver = 0;
+    std::vector<OfflineKeyAnalyser::Segment> offlineKeyTrack;
+    std::vector<MidiQueue::Entry> deferredEntries;  // host events from after an offline render, until it's handed over
+    uint64 offlineReceived = 0, offlineIgnored = 0;
     MidiListModel model; // The data to show in the UI. We keep it around in the processor so that
                          // the view is persistent even when the plugin UI is closed and reopened.
 
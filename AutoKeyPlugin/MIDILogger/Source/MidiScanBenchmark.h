@@ -0,0 +1,143 @@
+/*
+  ==============================================================================
+
+    Times MidiQueue (the raw-byte scanner) against the path it replaced,
+    which built a MidiMessage for every event and did one FIFO write per
+    event, for block sizes from 32 to 4096 samples.
+
+    Blocks are dense and mixed like a busy session: notes, pedal and other
+    controllers, pitch bend, clock and aftertouch. Each block is pushed and
+    popped, and both are timed: the scanner moved building the MidiMessage
+    from push() to pop(), so push() alone would flatter it.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+class MidiScanBenchmark
+{
+public:
+    struct Result
+    {
+        int blockSize, eventsPerBlock;
+        double perMessageNs, scannerNs;     // per event
+    };
+
+    struct Report
+    {
+        std::vector<Result> results;
+
+        String toString() const
+        {
+            String s ("block  events  per-message ns/event  scanner ns/event  speedup\n");
+
+            for (const auto& r : results)
+                s += String (r.blockSize).paddedLeft (' ', 5) + String (r.eventsPerBlock).paddedLeft (' ', 8)
+                   + String (r.perMessageNs, 1).paddedLeft (' ', 22) + String (r.scannerNs, 1).paddedLeft (' ', 18)
+                   + (String (r.perMessageNs / jmax (r.scannerNs, 1.0e-9), 2) + "x").paddedLeft (' ', 9) + "\n";
+
+            return s;
+        }
+    };
+
+    static Report run (int64 eventsPerMeasurement = 2000000)
+    {
+        Report report;
+
+        for (int blockSize = 32; blockSize <= 4096; blockSize *= 2)
+        {
+            const auto block = makeBlock (blockSize);
+            const auto numBlocks = (int) jmax ((int64) 1, eventsPerMeasurement / block.getNumEvents());
+
+            // The consumers' vectors keep their capacity, so neither side times allocation.
+            std::vector<MidiQueue::Entry> drained;
+            drained.reserve ((size_t) block.getNumEvents());
+
+            PerMessageQueue legacy;
+            const auto legacySeconds = time (numBlocks, [&] { legacy.push (block); legacy.pop (std::back_inserter (drained)); },
+                                             [&] { drained.clear(); });
+
+            MidiQueue queue;
+            const auto scannerSeconds = time (numBlocks, [&] { queue.push (block); queue.pop (std::back_inserter (drained)); },
+                                              [&] { drained.clear(); });
+
+            const auto numEvents = (double) numBlocks * block.getNumEvents();
+            report.results.push_back ({ blockSize, block.getNumEvents(),
+                                        legacySeconds * 1.0e9 / numEvents, scannerSeconds * 1.0e9 / numEvents });
+        }
+
+        return report;
+    }
+
+private:
+    // What MidiQueue::push used to do.
+    class PerMessageQueue
+    {
+    public:
+        void push (const MidiBuffer& buffer)
+        {
+            for (const auto metadata : buffer)
+            {
+                const auto scope = fifo.write (1);
+
+                if (scope.blockSize1 + scope.blockSize2 == 0)
+                    continue;
+
+                scope.forEach ([&] (int dest) { entries[(size_t) dest].message = metadata.getMessage(); });
+            }
+        }
+
+        template <typename OutputIt>
+        void pop (OutputIt out)
+        {
+            fifo.read (fifo.getNumReady()).forEach ([&] (int source) { *out++ = entries[(size_t) source]; });
+        }
+
+    private:
+        AbstractFifo fifo { 1 << 14 };
+        std::vector<MidiQueue::Entry> entries = std::vector<MidiQueue::Entry> (1 << 14);
+    };
+
+    // Seconds spent in pushAndPop(), leaving out the untimed clean-up after each block.
+    template <typename PushAndPop, typename CleanUp>
+    static double time (int numBlocks, PushAndPop&& pushAndPop, CleanUp&& cleanUp)
+    {
+        int64 ticks = 0;
+
+        for (int i = 0; i < numBlocks; ++i)
+        {
+            const auto start = Time::getHighResolutionTicks();
+            pushAndPop();
+            ticks += Time::getHighResolutionTicks() - start;
+            cleanUp();
+        }
+
+        return Time::highResolutionTicksToSeconds (ticks);
+    }
+
+    // One event every other sample.
+    static MidiBuffer makeBlock (int blockSize)
+    {
+        MidiBuffer block;
+        Random random (blockSize);
+
+        for (int pos = 0; pos < blockSize; pos += 2)
+        {
+            const auto note = 36 + random.nextInt (48);
+
+            switch (random.nextInt (10))
+            {
+                case 0:  block.addEvent (MidiMessage::midiClock(), pos); break;
+                case 1:  block.addEvent (MidiMessage::aftertouchChange (1, note, random.nextInt (128)), pos); break;
+                case 2:  block.addEvent (MidiMessage::controllerEvent (1, 64, random.nextBool() ? 127 : 0), pos); break;
+                case 3:  block.addEvent (MidiMessage::pitchWheel (1, random.nextInt (16384)), pos); break;
+                case 4:
+                case 5:  block.addEvent (MidiMessage::noteOff (1, note), pos); break;
+                default: block.addEvent (MidiMessage::noteOn (1, note, (uint8) (1 + random.nextInt (127))), pos); break;
+            }
+        }
+
+        return block;
+    }
+};
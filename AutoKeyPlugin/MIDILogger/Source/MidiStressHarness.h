@@ -0,0 +1,261 @@
+/*
+  ==============================================================================
+
+    Drives a processor from a simulated host thread at extreme MIDI rates
+    while the message-thread consumer is deliberately stalled, then checks
+    that every event is accounted for (queued and consumed, or counted as
+    dropped) and that the consumer recovers afterwards. Finally searches for
+    the highest event rate that survives a 60 Hz consumer without loss.
+
+    The producer and consumer only share the MidiQueue, so this is also the
+    run to build with -fsanitize=thread (e.g. CXXFLAGS/LDFLAGS on the Linux
+    makefile) when checking for data races.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+class MidiStressHarness
+{
+public:
+    struct Options
+    {
+        int stallMs = 500;
+        double secondsPerPhase = 1.0;
+    };
+
+    struct Report
+    {
+        StringArray lines;
+        double maxSustainedEventsPerSecond = 0.0;
+        bool passed = true;
+
+        String toString() const
+        {
+            return lines.joinIntoString ("\n") + "\nmax sustained rate without loss: "
+                 + String (maxSustainedEventsPerSecond, 0) + " events/s\n" + (passed ? "PASSED" : "FAILED");
+        }
+    };
+
+    /** Must be called on the message thread, which plays the consumer. */
+    static Report run (const Options& options)
+    {
+        Report report;
+        MidiLoggerPluginDemoProcessor processor;
+        processor.prepareToPlay (48000.0, blockSize);
+
+        // The host threads hand the same buffer back every block, so key changes written
+        // into it would pile up and throw the counts off.
+        processor.setKeyOutput (KeyChangeOutput::off, 16, 20);
+
+        auto check = [&report] (bool ok, const String& what)
+        {
+            if (! ok)
+            {
+                report.lines.add ("  FAIL: " + what);
+                report.passed = false;
+            }
+        };
+
+        // 1. Huge blocks, flat out, consumer asleep: must overflow, and must say so.
+        {
+            const auto r = runPhase (processor, makeNoteBlock (10000), 0.0, options.secondsPerPhase, options.stallMs);
+            report.lines.add (r.describe ("10k-event blocks, stalled consumer"));
+            check (r.accountingHolds(), "events unaccounted for");
+            check (r.delta.dropped > 0, "expected the stalled consumer to cause drops");
+        }
+
+        // 2. Same processor at a moderate rate: the consumer has to have caught up.
+        {
+            const auto r = runPhase (processor, makeNoteBlock (64), 48000.0 / blockSize, options.secondsPerPhase, 0);
+            report.lines.add (r.describe ("recovery at " + String (r.eventsPerSecond, 0) + " events/s"));
+            check (r.accountingHolds(), "events unaccounted for");
+            check (r.delta.dropped == 0, "consumer did not recover after the stall");
+        }
+
+        // 3. Long SysEx between notes, stalled consumer.
+        {
+            const auto r = runPhase (processor, makeSysExBlock (64 * 1024, 16), 0.0, options.secondsPerPhase, options.stallMs);
+            report.lines.add (r.describe ("64 KB SysEx, stalled consumer"));
+            check (r.accountingHolds(), "events unaccounted for");
+            check (r.delta.ignored == r.sent / (uint64) (16 + 1), "the non-tuning SysEx should be skipped, not queued");
+        }
+
+        // 4. Roughly what a MIDI 2.0 transport can deliver: millions of short messages per second.
+        {
+            const auto r = runPhase (processor, makeNoteBlock (4096), 2.0e6 / 4096, options.secondsPerPhase, 0);
+            report.lines.add (r.describe ("MIDI 2.0 bandwidth (2M events/s target)"));
+            check (r.accountingHolds(), "events unaccounted for");
+        }
+
+        // 5. Highest paced rate with no loss: double until it breaks, then bisect.
+        {
+            double good = 0.0, bad = 0.0;
+
+            for (double rate = 25000.0; rate <= 6.4e7 && bad == 0.0; rate *= 2.0)
+            {
+                if (lossless (processor, rate, options))
+                    good = rate;
+                else
+                    bad = rate;
+            }
+
+            for (int i = 0; i < 4 && bad > 0.0; ++i)
+            {
+                const auto mid = 0.5 * (good + bad);
+
+                if (lossless (processor, mid, options))
+                    good = mid;
+                else
+                    bad = mid;
+            }
+
+            report.maxSustainedEventsPerSecond = good;
+        }
+
+        const auto totals = processor.getMidiStats();
+        report.lines.add ("total: " + String (totals.received) + " received, " + String (totals.consumed) + " consumed, "
+                          + String (totals.dropped) + " dropped, " + String (totals.ignored) + " ignored, "
+                          + String (totals.truncated) + " truncated by the per-tick cap");
+        check (totals.received == totals.consumed + totals.dropped + totals.ignored, "totals do not balance");
+
+        return report;
+    }
+
+private:
+    static constexpr int blockSize = 512;
+    static constexpr int eventsPerRateBlock = 256;
+
+    using Stats = MidiLoggerPluginDemoProcessor::MidiStats;
+
+    struct PhaseResult
+    {
+        Stats delta;
+        uint64 sent = 0;
+        double seconds = 0.0, eventsPerSecond = 0.0;
+
+        bool accountingHolds() const
+        {
+            return delta.received == sent && delta.received == delta.consumed + delta.dropped + delta.ignored;
+        }
+
+        String describe (const String& name) const
+        {
+            return name + ": sent " + String (sent) + " in " + String (seconds, 2) + " s ("
+                 + String (eventsPerSecond, 0) + "/s), consumed " + String (delta.consumed)
+                 + ", dropped " + String (delta.dropped) + ", ignored " + String (delta.ignored)
+                 + ", truncated " + String (delta.truncated);
+        }
+    };
+
+    class HostThread  : public Thread
+    {
+    public:
+        HostThread (MidiLoggerPluginDemoProcessor& p, const MidiBuffer& block, double blocksPerSecond, double secondsToRun)
+            : Thread ("SimulatedHost"), processor (p), midi (block),
+              rate (blocksPerSecond), seconds (secondsToRun) {}
+
+        void run() override
+        {
+            AudioBuffer<float> audio (processor.getTotalNumOutputChannels(), blockSize);
+            const auto start = Time::getHighResolutionTicks();
+            const auto ticksPerSecond = (double) Time::getHighResolutionTicksPerSecond();
+            const auto end = start + (int64) (seconds * ticksPerSecond);
+
+            for (auto now = start; now < end && ! threadShouldExit(); now = Time::getHighResolutionTicks())
+            {
+                if (rate > 0.0)
+                {
+                    const auto due = start + (int64) ((double) numBlocks * ticksPerSecond / rate);
+
+                    if (now < due)
+                    {
+                        if (due - now > (int64) (ticksPerSecond * 0.002))
+                            Thread::sleep (1);
+
+                        continue;
+                    }
+                }
+
+                processor.processBlock (audio, midi);
+                ++numBlocks;
+            }
+
+            elapsed = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - start);
+        }
+
+        MidiLoggerPluginDemoProcessor& processor;
+        MidiBuffer midi;
+        const double rate, seconds;
+        uint64 numBlocks = 0;
+        double elapsed = 0.0;
+    };
+
+    static PhaseResult runPhase (MidiLoggerPluginDemoProcessor& processor, const MidiBuffer& block,
+                                 double blocksPerSecond, double seconds, int stallMs)
+    {
+        const auto before = processor.getMidiStats();
+        HostThread host (processor, block, blocksPerSecond, seconds);
+        host.startThread (8);
+
+        if (stallMs > 0)
+            Thread::sleep (stallMs);
+
+        while (host.isThreadRunning())
+        {
+            processor.drainPendingMidi();
+            Thread::sleep (16);
+        }
+
+        host.waitForThreadToExit (-1);
+        processor.drainPendingMidi();
+
+        const auto after = processor.getMidiStats();
+        PhaseResult r;
+        r.delta.received  = after.received  - before.received;
+        r.delta.dropped   = after.dropped   - before.dropped;
+        r.delta.consumed  = after.consumed  - before.consumed;
+        r.delta.truncated = after.truncated - before.truncated;
+        r.delta.ignored   = after.ignored   - before.ignored;
+        r.sent = host.numBlocks * (uint64) block.getNumEvents();
+        r.seconds = host.elapsed;
+        r.eventsPerSecond = (double) r.sent / jmax (host.elapsed, 1.0e-9);
+        return r;
+    }
+
+    static bool lossless (MidiLoggerPluginDemoProcessor& processor, double eventsPerSecond, const Options& options)
+    {
+        const auto r = runPhase (processor, makeNoteBlock (eventsPerRateBlock), eventsPerSecond / eventsPerRateBlock,
+                                 jmin (0.5, options.secondsPerPhase), 0);
+
+        // A producer that can't keep up with the target doesn't count as sustaining it.
+        return r.delta.dropped == 0 && r.eventsPerSecond >= 0.95 * eventsPerSecond;
+    }
+
+    static MidiBuffer makeNoteBlock (int numEvents)
+    {
+        MidiBuffer block;
+
+        for (int i = 0; i < numEvents; ++i)
+        {
+            const auto note = 36 + (i / 2) % 48;
+            block.addEvent ((i & 1) == 0 ? MidiMessage::noteOn (1, note, (uint8) 100) : MidiMessage::noteOff (1, note),
+                            (int) ((int64) i * blockSize / numEvents));
+        }
+
+        return block;
+    }
+
+    static MidiBuffer makeSysExBlock (int sysExSize, int numNotes)
+    {
+        auto block = makeNoteBlock (numNotes);
+        HeapBlock<uint8> payload ((size_t) sysExSize, true);
+
+        for (int i = 0; i < sysExSize; ++i)
+            payload[i] = (uint8) (i & 0x7f);
+
+        block.addEvent (MidiMessage::createSysExMessage (payload.get(), sysExSize), blockSize / 2);
+        return block;
+    }
+};
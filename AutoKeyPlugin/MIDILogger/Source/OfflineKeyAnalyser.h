@@ -0,0 +1,544 @@
+/*
+  ==============================================================================
+
+    The heavier analysis tier, used while the host renders offline
+    (isNonRealtime()), when nothing is waiting on processBlock and there is
+    CPU to spare.
+
+    The audio thread keeps every event the analysis uses, timed by samples
+    rendered rather than by the clock. Worker threads cut the render into
+    short frames, weight each pitch class by how long it sounded (through
+    the pedals, with a VoiceTable), and once a frame has enough lookahead
+    buffered they correlate a long window around it against the full
+    Krumhansl-Kessler profiles of all 24 keys. When the render ends, a
+    Viterbi pass over the frames picks the key track that best balances the
+    correlations against the cost of modulating.
+
+    The finished render hands back its events as well as its key track, so
+    the realtime tier can take over as if it had heard every note itself.
+
+    Every instance shares one pool of worker threads, started by the first
+    render.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <array>
+#include <memory>
+
+class OfflineKeyAnalyser
+{
+public:
+    /** Keys here are 0-11 for C..B major and 12-23 for C..B minor. */
+    static constexpr int numKeys = 24;
+
+    static constexpr double frameSeconds = 0.5;
+    static constexpr double windowSeconds = 16.0;      // centred on the frame, so half of it is lookahead
+    static constexpr int framesPerJob = 64;
+
+    struct Event
+    {
+        double time;            // seconds since the start of the render
+        uint32 blockIndex;
+        MidiMessage message;    // time stamp = sample position within the block
+    };
+
+    struct Segment
+    {
+        double startTime;       // seconds since the start of the render
+        int key;
+        float correlation;      // mean over the segment, -1..1
+    };
+
+    struct Result
+    {
+        std::vector<Event> events;
+        std::vector<Segment> keyTrack;
+        double length = 0.0;                    // seconds rendered
+        double wallStart = 0.0, wallEnd = 0.0;  // when it was rendered, on the processBlock clock
+        uint32 firstBlock = 0;
+        int64 numIgnored = 0;
+
+        /** Spreads the render over the time it actually took, so its events line up with the live ones. */
+        double getWallTime (double renderTime) const
+        {
+            return wallStart + (wallEnd - wallStart) * jlimit (0.0, 1.0, renderTime / jmax (length, 1.0e-9));
+        }
+    };
+
+    //==============================================================================
+    /** Audio thread, on the first offline block. priorKey (or -1) is what the realtime tier
+        had detected, and is where the smoothing starts from. May lock and allocate.
+    */
+    void beginRender (uint32 firstBlock, double wallTime, int priorKey)
+    {
+        auto render = std::make_shared<Render>();
+        render->firstBlock = firstBlock;
+        render->wallStart = render->wallEnd = wallTime;
+        render->priorKey = priorKey;
+
+        if (workers == nullptr)
+            workers = std::make_unique<SharedResourcePointer<Workers>>();
+
+        const ScopedLock sl (rendersLock);
+        renders.push_back (render);
+        active = render.get();
+    }
+
+    /** Audio thread, for every offline block. May lock and allocate. */
+    void addBlock (const MidiBuffer& midi, uint32 blockIndex, int numSamples, double sampleRate, double wallTime)
+    {
+        if (active == nullptr)
+            return;
+
+        auto& r = *active;
+        int frames = 0;
+
+        {
+            const ScopedLock sl (r.lock);
+            const auto blockStart = r.length;
+
+            r.numIgnored += MidiBufferScanner::scan (midi, [&] (const MidiBufferScanner::Event* events, int num)
+            {
+                for (int i = 0; i < num; ++i)
+                    r.events.push_back ({ blockStart + events[i].samplePosition / sampleRate, blockIndex,
+                                          MidiMessage (events[i].data, events[i].size, events[i].samplePosition) });
+            });
+
+            r.length += numSamples / sampleRate;
+            r.wallEnd = wallTime;
+            frames = (int) (r.length / frameSeconds);
+        }
+
+        if (frames - r.lastDispatchedFrame >= framesPerJob)
+        {
+            r.lastDispatchedFrame = frames;
+            dispatch (r.shared_from_this(), false);
+        }
+    }
+
+    /** Audio thread, on the first realtime block after a render (or when resources are released).
+        Realtime safe: the final pass is queued by update().
+    */
+    void endRender() noexcept
+    {
+        if (active != nullptr)
+            active->ended = true;
+
+        active = nullptr;
+    }
+
+    //==============================================================================
+    /** Message thread: starts the final pass of renders that have ended. */
+    void update()
+    {
+        const ScopedLock sl (rendersLock);
+
+        for (auto& render : renders)
+            if (render->ended && ! std::exchange (render->finalDispatched, true))
+                dispatch (render, true);
+    }
+
+    /** Message thread: the oldest render, once it has been analysed. Renders come out in order. */
+    std::unique_ptr<Result> takeResult()
+    {
+        const ScopedLock sl (rendersLock);
+
+        if (renders.empty() || ! renders.front()->published)
+            return {};
+
+        auto result = std::move (renders.front()->result);
+        renders.erase (renders.begin());
+        return result;
+    }
+
+    /** Message thread: what the renders whose results haven't been taken hold, in bytes. */
+    size_t getMemoryUsed() const
+    {
+        const ScopedLock sl (rendersLock);
+        size_t total = 0;
+
+        for (auto& render : renders)
+        {
+            const auto& r = *render;
+            total += sizeof (Render);
+
+            {
+                const ScopedLock renderScope (r.lock);
+                total += r.events.capacity() * sizeof (Event) + r.scored.capacity() * sizeof (ScoredRange);
+
+                for (auto& range : r.scored)
+                    total += range.correlations.capacity() * sizeof (Correlations);
+
+                if (r.result != nullptr)
+                    total += sizeof (Result) + r.result->events.capacity() * sizeof (Event)
+                               + r.result->keyTrack.capacity() * sizeof (Segment);
+            }
+
+            const ScopedLock buildScope (r.buildLock);
+            total += r.evidence.capacity() * sizeof (VoiceTable::Evidence);
+        }
+
+        return total;
+    }
+
+    /** First block of the oldest render whose result hasn't been taken, or -1. */
+    int64 getFirstPendingBlock() const
+    {
+        const ScopedLock sl (rendersLock);
+        return renders.empty() ? -1 : (int64) renders.front()->firstBlock;
+    }
+
+    //==============================================================================
+    enum class Profiles
+    {
+        krumhanslKessler,   // probe-tone ratings; what the offline tier uses
+        temperley           // Kostka-Payne corpus frequencies
+    };
+
+    /** Pearson correlation of a pitch-class profile (0 = C) with every key's profile. */
+    static std::array<float, numKeys> correlate (const std::array<float, 12>& profile,
+                                                 Profiles profiles = Profiles::krumhanslKessler)
+    {
+        static const std::array<KeyProfiles, 2> allKeyProfiles
+        {
+            makeKeyProfiles ({ 6.35f, 2.23f, 3.48f, 2.33f, 4.38f, 4.09f, 2.52f, 5.19f, 2.39f, 3.66f, 2.29f, 2.88f },
+                             { 6.33f, 2.68f, 3.52f, 5.38f, 2.60f, 3.53f, 2.54f, 4.75f, 3.98f, 2.69f, 3.34f, 3.17f }),
+            makeKeyProfiles ({ 5.0f, 2.0f, 3.5f, 2.0f, 4.5f, 4.0f, 2.0f, 4.5f, 2.0f, 3.5f, 1.5f, 4.0f },
+                             { 5.0f, 2.0f, 3.5f, 4.5f, 2.0f, 4.0f, 2.0f, 4.5f, 3.5f, 2.0f, 1.5f, 4.0f })
+        };
+
+        const auto& keyProfiles = allKeyProfiles[(size_t) profiles];
+
+        std::array<float, numKeys> result {};
+        float mean = 0.0f;
+
+        for (auto w : profile)
+            mean += w / 12.0f;
+
+        float norm = 0.0f;
+
+        for (auto w : profile)
+            norm += (w - mean) * (w - mean);
+
+        if (norm <= 1.0e-9f)
+            return result;      // nothing sounded, or everything equally: no opinion
+
+        norm = std::sqrt (norm);
+
+        for (int key = 0; key < numKeys; ++key)
+        {
+            float sum = 0.0f;
+
+            for (size_t pc = 0; pc < 12; ++pc)
+                sum += (profile[pc] - mean) * keyProfiles[(size_t) key][pc];
+
+            result[(size_t) key] = sum / norm;
+        }
+
+        return result;
+    }
+
+    /** The most likely key for each frame, given each frame's correlations. */
+    static std::vector<int> smooth (const std::vector<std::array<float, numKeys>>& correlations, int priorKey)
+    {
+        constexpr float sharpness = 12.0f;         // log-likelihood per unit of correlation
+        constexpr float modulationCost = 24.0f;
+        constexpr float costPerFifth = 1.0f;
+        constexpr float priorBonus = 2.0f;
+
+        static const auto transitionCost = makeTransitionCosts (modulationCost, costPerFifth);
+
+        const auto numFrames = correlations.size();
+        std::vector<int> path (numFrames);
+
+        if (numFrames == 0)
+            return path;
+
+        std::vector<std::array<uint8, numKeys>> from (numFrames);
+        std::array<float, numKeys> score, next;
+
+        for (int key = 0; key < numKeys; ++key)
+            score[(size_t) key] = sharpness * correlations[0][(size_t) key] + (key == priorKey ? priorBonus : 0.0f);
+
+        for (size_t f = 1; f < numFrames; ++f)
+        {
+            for (size_t key = 0; key < (size_t) numKeys; ++key)
+            {
+                auto best = score[0] - transitionCost[0][key];
+                uint8 bestFrom = 0;
+
+                for (size_t prev = 1; prev < (size_t) numKeys; ++prev)
+                {
+                    const auto s = score[prev] - transitionCost[prev][key];
+
+                    if (s > best)
+                    {
+                        best = s;
+                        bestFrom = (uint8) prev;
+                    }
+                }
+
+                next[key] = best + sharpness * correlations[f][key];
+                from[f][key] = bestFrom;
+            }
+
+            score = next;
+        }
+
+        path.back() = (int) std::distance (score.begin(), std::max_element (score.begin(), score.end()));
+
+        for (auto f = numFrames - 1; f > 0; --f)
+            path[f - 1] = from[f][(size_t) path[f]];
+
+        return path;
+    }
+
+private:
+    using Correlations = std::array<float, numKeys>;
+    using KeyProfiles = std::array<std::array<float, 12>, numKeys>;
+
+    struct ScoredRange
+    {
+        int firstFrame;
+        std::vector<Correlations> correlations;
+    };
+
+    struct Render  : public std::enable_shared_from_this<Render>
+    {
+        // Written by the audio thread, under lock.
+        CriticalSection lock;
+        std::vector<Event> events;
+        double length = 0.0, wallStart = 0.0, wallEnd = 0.0;
+        int64 numIgnored = 0;
+        std::vector<ScoredRange> scored;
+        std::unique_ptr<Result> result;
+
+        uint32 firstBlock = 0;
+        int priorKey = -1;
+        int lastDispatchedFrame = 0;        // audio thread only
+        bool finalDispatched = false;       // under rendersLock
+
+        // Cutting into frames happens in order, one job at a time, under buildLock.
+        CriticalSection buildLock;
+        VoiceTable voices;
+        size_t numEventsBuilt = 0;
+        std::vector<VoiceTable::Evidence> evidence;     // running totals at each frame boundary
+        int numFramesClaimed = 0;
+        bool buildFinished = false;
+
+        std::atomic<bool> ended { false }, finalPassDone { false }, published { false };
+        std::atomic<int> activeJobs { 0 };
+    };
+
+    static constexpr int framesEachSide = (int) (windowSeconds / frameSeconds) / 2;
+
+    void dispatch (std::shared_ptr<Render> render, bool isFinal)
+    {
+        ++render->activeJobs;
+
+        // Jobs only touch the render they hold, so they can outlive this analyser.
+        (*workers)->addJob ([render, isFinal]
+        {
+            analyse (*render, isFinal);
+
+            if (isFinal)
+                render->finalPassDone = true;
+
+            // Whichever job finishes last, once the final pass has run, puts the result together.
+            if (--render->activeJobs == 0 && render->finalPassDone && ! render->published.exchange (true))
+                publish (*render);
+        });
+    }
+
+    // Extends the frame boundaries as far as the render has got, then correlates every
+    // frame that now has its full lookahead (or every remaining frame, at the end).
+    static void analyse (Render& r, bool isFinal)
+    {
+        std::vector<VoiceTable::Evidence> window;
+        int firstFrame = 0, numFrames = 0, windowStart = 0;
+
+        {
+            const ScopedLock buildScope (r.buildLock);
+
+            if (r.buildFinished)
+                return;
+
+            std::vector<Event> newEvents;
+            double length = 0.0;
+
+            {
+                const ScopedLock sl (r.lock);
+                newEvents.assign (r.events.begin() + (ptrdiff_t) r.numEventsBuilt, r.events.end());
+                length = r.length;
+            }
+
+            r.numEventsBuilt += newEvents.size();
+
+            auto boundaryTime = [&r] { return (double) r.evidence.size() * frameSeconds; };
+
+            for (const auto& e : newEvents)
+            {
+                while (boundaryTime() <= e.time)
+                    r.evidence.push_back (r.voices.getEvidence (boundaryTime()));
+
+                r.voices.handle (e.message, e.time);
+            }
+
+            while (boundaryTime() <= length)
+                r.evidence.push_back (r.voices.getEvidence (boundaryTime()));
+
+            if (isFinal)
+            {
+                // Close the last, partial frame.
+                if (r.evidence.size() < 2 || boundaryTime() - frameSeconds < length)
+                    r.evidence.push_back (r.voices.getEvidence (boundaryTime()));
+
+                r.buildFinished = true;
+            }
+
+            const auto totalFrames = (int) r.evidence.size() - 1;
+            const auto readyFrames = isFinal ? totalFrames : jmax (0, totalFrames - framesEachSide);
+
+            firstFrame = r.numFramesClaimed;
+            numFrames = jmax (0, readyFrames - firstFrame);
+            r.numFramesClaimed += numFrames;
+
+            windowStart = jmax (0, firstFrame - framesEachSide);
+            const auto windowEnd = jmin (totalFrames, firstFrame + numFrames + framesEachSide);
+            window.assign (r.evidence.begin() + windowStart, r.evidence.begin() + windowEnd + 1);
+        }
+
+        if (numFrames == 0)
+            return;
+
+        ScoredRange range { firstFrame, std::vector<Correlations> ((size_t) numFrames) };
+        const auto last = (int) window.size() - 1;
+
+        for (int i = 0; i < numFrames; ++i)
+        {
+            const auto frame = firstFrame + i - windowStart;
+            const auto& lo = window[(size_t) jmax (0, frame - framesEachSide)];
+            const auto& hi = window[(size_t) jmin (last, frame + 1 + framesEachSide)];
+
+            std::array<float, 12> profile;
+
+            for (size_t pc = 0; pc < 12; ++pc)
+                profile[pc] = jmax (0.0f, hi[pc] - lo[pc]);
+
+            range.correlations[(size_t) i] = correlate (profile);
+        }
+
+        const ScopedLock sl (r.lock);
+        r.scored.push_back (std::move (range));
+    }
+
+    static void publish (Render& r)
+    {
+        auto result = std::make_unique<Result>();
+
+        {
+            const ScopedLock sl (r.lock);
+
+            std::sort (r.scored.begin(), r.scored.end(),
+                       [] (const ScoredRange& a, const ScoredRange& b) { return a.firstFrame < b.firstFrame; });
+
+            std::vector<Correlations> correlations;
+
+            for (auto& range : r.scored)
+                correlations.insert (correlations.end(), range.correlations.begin(), range.correlations.end());
+
+            const auto path = smooth (correlations, r.priorKey);
+
+            for (size_t f = 0; f < path.size(); ++f)
+            {
+                const auto key = path[f];
+                const auto c = correlations[f][(size_t) key];
+
+                if (result->keyTrack.empty() || result->keyTrack.back().key != key)
+                {
+                    result->keyTrack.push_back ({ (double) f * frameSeconds, key, c });
+                    continue;
+                }
+
+                // Running mean over the segment's frames.
+                auto& segment = result->keyTrack.back();
+                const auto n = (float) (f - (size_t) (segment.startTime / frameSeconds));
+                segment.correlation += (c - segment.correlation) / (n + 1.0f);
+            }
+
+            result->events = std::move (r.events);
+            result->length = r.length;
+            result->wallStart = r.wallStart;
+            result->wallEnd = r.wallEnd;
+            result->firstBlock = r.firstBlock;
+            result->numIgnored = r.numIgnored;
+            r.result = std::move (result);
+        }
+
+        r.published = true;
+    }
+
+    // Major and minor profiles (from the tonic up), rotated to every tonic, centred and normalised.
+    static KeyProfiles makeKeyProfiles (const std::array<float, 12>& major, const std::array<float, 12>& minor)
+    {
+        KeyProfiles profiles;
+
+        for (int key = 0; key < numKeys; ++key)
+        {
+            const auto& base = key < 12 ? major : minor;
+            const auto tonic = key % 12;
+            auto& p = profiles[(size_t) key];
+            float mean = 0.0f, norm = 0.0f;
+
+            for (int pc = 0; pc < 12; ++pc)
+            {
+                p[(size_t) pc] = base[(size_t) ((pc - tonic + 12) % 12)];
+                mean += p[(size_t) pc] / 12.0f;
+            }
+
+            for (auto& w : p)
+            {
+                w -= mean;
+                norm += w * w;
+            }
+
+            for (auto& w : p)
+                w /= std::sqrt (norm);
+        }
+
+        return profiles;
+    }
+
+    // Staying is free; modulating costs more the further the new key signature is round the circle of fifths.
+    static std::array<std::array<float, numKeys>, numKeys> makeTransitionCosts (float modulationCost, float costPerFifth)
+    {
+        auto signature = [] (int key) { return ((key % 12 + (key < 12 ? 0 : 3)) * 7) % 12; };
+
+        std::array<std::array<float, numKeys>, numKeys> costs;
+
+        for (int from = 0; from < numKeys; ++from)
+        {
+            for (int to = 0; to < numKeys; ++to)
+            {
+                const auto steps = std::abs (signature (from) - signature (to));
+                costs[(size_t) from][(size_t) to] = from == to ? 0.0f
+                                                               : modulationCost + costPerFifth * (float) jmin (steps, 12 - steps);
+            }
+        }
+
+        return costs;
+    }
+
+    struct Workers  : public ThreadPool
+    {
+        Workers() : ThreadPool (jlimit (1, 4, SystemStats::getNumCpus() - 1)) {}
+    };
+
+    CriticalSection rendersLock;
+    std::vector<std::shared_ptr<Render>> renders;   // oldest first
+    Render* active = nullptr;                       // audio thread only
+    std::unique_ptr<SharedResourcePointer<Workers>> workers;    // set before the first render is added
+};
@@ -0,0 +1,262 @@
+/*
+  ==============================================================================
+
+    Binary encoding of the plugin state.
+
+    Layout (little endian):
+
+        header    "AKST", uint16 version, uint16 reserved
+        sections  uint8 tag, uint32 payload size, payload
+
+    Readers skip sections they don't know, so newer sections can be added
+    without bumping the version; the version only changes when the meaning
+    of an existing section does. The Writer fills a caller-supplied buffer
+    without allocating, and the Reader walks the bytes in place.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+namespace PluginState
+{
+    enum Section : uint8
+    {
+        uiSection = 1,          // int32 width, int32 height
+        analysisSection,        // float32[12] histogram, uint16 pitch-class mask, uint32 note-ons seen
+        configSection,          // uint64 history memory budget, int8 locked key (-1 = none)
+        progressionSection,     // varint count, then per chord: varint position delta, varint chord id
+        tuningSection,          // uint8 equal divisions of the octave
+        windowsSection,         // uint8 count, then float32 length in bars per key window
+        keyOutputSection,       // uint8 format (KeyChangeOutput::Format), uint8 channel, uint8 controller number
+        transitionsSection,     // varint count, then per learned chord transition: varint cell delta, varint count
+        historySection,         // AnalysisHistory: varint events, varint events dropped, int64 last time (ms),
+                                // uint32[12] note-on totals, varint block count, then per block: int64 start
+                                // and last time (ms), uint32[12] checkpoint, varint events, varint size, bytes
+        evidenceSection         // float32[12] seconds sounded per pitch class
+    };
+
+    static constexpr char magic[4] = { 'A', 'K', 'S', 'T' };
+    static constexpr uint16 currentVersion = 1;
+    static constexpr int headerSize = 8;
+    static constexpr int sectionHeaderSize = 5;
+    static constexpr int maxVarintSize = 10;
+
+    //==============================================================================
+    class Writer
+    {
+    public:
+        Writer (void* destination, size_t capacity)
+            : start (static_cast<uint8*> (destination)), pos (start), end (start + capacity)
+        {
+            writeBytes (magic, sizeof (magic));
+            writeUInt16 (currentVersion);
+            writeUInt16 (0);
+        }
+
+        /** False if the buffer was too small; everything after that point was discarded. */
+        bool ok() const                     { return ! overflowed; }
+        size_t getNumBytesWritten() const   { return (size_t) (pos - start); }
+
+        void beginSection (Section tag)
+        {
+            writeUInt8 (tag);
+            sectionStart = pos;
+            writeUInt32 (0);    // patched by endSection()
+        }
+
+        void endSection()
+        {
+            if (overflowed || sectionStart == nullptr)
+                return;
+
+            const auto size = (uint32) (pos - sectionStart - 4);
+            writeAt (sectionStart, size);
+            sectionStart = nullptr;
+        }
+
+        void writeUInt8 (uint8 v)           { writeBytes (&v, 1); }
+        void writeInt8 (int8 v)             { writeBytes (&v, 1); }
+        void writeUInt16 (uint16 v)         { const uint8 b[] = { (uint8) v, (uint8) (v >> 8) }; writeBytes (b, sizeof (b)); }
+        void writeUInt32 (uint32 v)         { uint8 b[4]; writeAt (b, v); writeBytes (b, sizeof (b)); }
+        void writeInt32 (int32 v)           { writeUInt32 ((uint32) v); }
+        void writeUInt64 (uint64 v)         { writeUInt32 ((uint32) v); writeUInt32 ((uint32) (v >> 32)); }
+
+        void writeFloat (float v)
+        {
+            uint32 bits;
+            std::memcpy (&bits, &v, sizeof (bits));
+            writeUInt32 (bits);
+        }
+
+        void writeVarint (uint64 v)
+        {
+            while (v >= 0x80)
+            {
+                writeUInt8 ((uint8) (v | 0x80));
+                v >>= 7;
+            }
+
+            writeUInt8 ((uint8) v);
+        }
+
+        void writeBytes (const void* data, size_t size)
+        {
+            if (overflowed || (size_t) (end - pos) < size)
+            {
+                overflowed = true;
+                return;
+            }
+
+            std::memcpy (pos, data, size);
+            pos += size;
+        }
+
+    private:
+        static void writeAt (uint8* dest, uint32 v)
+        {
+            for (int i = 0; i < 4; ++i)
+                dest[i] = (uint8) (v >> (8 * i));
+        }
+
+        uint8* const start;
+        uint8* pos;
+        uint8* const end;
+        uint8* sectionStart = nullptr;
+        bool overflowed = false;
+    };
+
+    //==============================================================================
+    class Reader
+    {
+    public:
+        Reader (const void* data, size_t size)
+            : pos (static_cast<const uint8*> (data)), end (pos + size)
+        {
+            if (size < (size_t) headerSize || std::memcmp (pos, magic, sizeof (magic)) != 0)
+                return;
+
+            pos += sizeof (magic);
+            version = readUInt16();
+            readUInt16();
+            valid = version <= currentVersion;
+        }
+
+        /** False if this isn't our format, or it comes from a newer build. */
+        bool isValid() const        { return valid; }
+        uint16 getVersion() const   { return version; }
+
+        /** Moves to the next section, skipping whatever is left of the current one. */
+        bool nextSection (Section& tag)
+        {
+            if (! valid)
+                return false;
+
+            if (sectionEnd != nullptr)
+                pos = std::exchange (sectionEnd, nullptr);
+
+            if (end - pos < sectionHeaderSize)
+                return false;
+
+            tag = (Section) *pos++;
+            const auto size = readUInt32();
+
+            if ((uint64) (end - pos) < size)
+                return false;
+
+            sectionEnd = pos + size;
+            return true;
+        }
+
+        /** False if a read ran past the end of its section. */
+        bool ok() const             { return ! overran; }
+
+        uint8 readUInt8()           { return canRead (1) ? *pos++ : 0; }
+        int8 readInt8()             { return (int8) readUInt8(); }
+
+        uint16 readUInt16()
+        {
+            if (! canRead (2))
+                return 0;
+
+            const auto v = (uint16) (pos[0] | (pos[1] << 8));
+            pos += 2;
+            return v;
+        }
+
+        uint32 readUInt32()
+        {
+            if (! canRead (4))
+                return 0;
+
+            const auto v = (uint32) pos[0] | ((uint32) pos[1] << 8) | ((uint32) pos[2] << 16) | ((uint32) pos[3] << 24);
+            pos += 4;
+            return v;
+        }
+
+        int32 readInt32()           { return (int32) readUInt32(); }
+        uint64 readUInt64()         { const auto lo = readUInt32(); return lo | ((uint64) readUInt32() << 32); }
+
+        float readFloat()
+        {
+            const auto bits = readUInt32();
+            float v;
+            std::memcpy (&v, &bits, sizeof (v));
+            return v;
+        }
+
+        uint64 readVarint()
+        {
+            uint64 v = 0;
+
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                const auto byte = readUInt8();
+                v |= (uint64) (byte & 0x7f) << shift;
+
+                if ((byte & 0x80) == 0)
+                    return v;
+            }
+
+            overran = true;
+            return v;
+        }
+
+        /** Copies the next size bytes out, or fails without reading any of them. */
+        bool readBytes (void* dest, size_t size)
+        {
+            if (! canRead (size))
+                return false;
+
+            if (size > 0)
+                std::memcpy (dest, pos, size);
+
+            pos += size;
+            return true;
+        }
+
+        /** How much of the current section is left to read. */
+        size_t getNumBytesLeft() const
+        {
+            return (size_t) ((sectionEnd != nullptr ? sectionEnd : end) - pos);
+        }
+
+    private:
+        bool canRead (size_t numBytes)
+        {
+            const auto* limit = sectionEnd != nullptr ? sectionEnd : end;
+
+            if ((size_t) (limit - pos) >= numBytes)
+                return true;
+
+            overran = true;
+            return false;
+        }
+
+        const uint8* pos;
+        const uint8* const end;
+        const uint8* sectionEnd = nullptr;
+        uint16 version = 0;
+        bool valid = false, overran = false;
+    };
+}
@@ -0,0 +1,101 @@
+/*
+  ==============================================================================
+
+    A horizontal strip showing the chord progression as Roman numerals, with
+    the chord names underneath. Only the cells inside the visible window are
+    drawn, however long the progression gets. It follows the newest chord
+    until the user scrolls back.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "ChordProgression.h"
+
+class ProgressionView  : public Component,
+                         private Timer,
+                         private ScrollBar::Listener
+{
+public:
+    explicit ProgressionView (const ChordProgression& p)
+        : progression (p)
+    {
+        addAndMakeVisible (scrollBar);
+        scrollBar.setAutoHide (false);
+        scrollBar.addListener (this);
+        startTimerHz (30);
+    }
+
+    ~ProgressionView() override     { scrollBar.removeListener (this); }
+
+    void paint (Graphics& g) override
+    {
+        const auto area = getLocalBounds().withTrimmedBottom (scrollBarHeight);
+        const auto start = scrollBar.getCurrentRangeStart();
+        const auto first = jmax (0, (int) start);
+        const auto last = jmin (progression.size(), (int) std::ceil (start + getNumVisibleCells()));
+
+        for (int i = first; i < last; ++i)
+        {
+            const auto x = area.getX() + roundToInt ((i - start) * cellWidth);
+            auto cell = Rectangle<int> (x, area.getY(), cellWidth, area.getHeight()).reduced (2);
+
+            g.setColour (Colour (0x32ffffff));
+            g.fillRoundedRectangle (cell.toFloat(), 4.0f);
+
+            g.setColour (findColour (Label::textColourId));
+            g.setFont (Font (20.0f, Font::bold));
+            g.drawFittedText (progression.hasKey() ? progression.getNumeral (i) : String ("?"),
+                              cell.removeFromTop (cell.getHeight() * 3 / 5), Justification::centred, 1);
+
+            g.setFont (Font (13.0f));
+            g.drawFittedText (progression.getChordName (i), cell, Justification::centred, 1);
+        }
+    }
+
+    void resized() override
+    {
+        scrollBar.setBounds (getLocalBounds().removeFromBottom (scrollBarHeight));
+        updateScrollBar();
+    }
+
+private:
+    double getNumVisibleCells() const   { return (double) getWidth() / cellWidth; }
+
+    void updateScrollBar()
+    {
+        const auto visible = getNumVisibleCells();
+        const auto total = jmax ((double) progression.size(), visible);
+
+        scrollBar.setRangeLimits (0.0, total, dontSendNotification);
+        scrollBar.setCurrentRange (followingEnd ? total - visible : scrollBar.getCurrentRangeStart(),
+                                   visible, dontSendNotification);
+    }
+
+    void timerCallback() override
+    {
+        if (progression.getVersion() == lastVersion)
+            return;
+
+        lastVersion = progression.getVersion();
+        updateScrollBar();
+        repaint();
+    }
+
+    void scrollBarMoved (ScrollBar*, double newRangeStart) override
+    {
+        followingEnd = newRangeStart + getNumVisibleCells() >= scrollBar.getMaximumRangeLimit() - 0.5;
+        repaint();
+    }
+
+    static constexpr int cellWidth = 64;
+    static constexpr int scrollBarHeight = 10;
+
+    const ChordProgression& progression;
+    ScrollBar scrollBar { false };
+    uint32 lastVersion = 0;
+    bool followingEnd = true;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ProgressionView)
+};
@@ -0,0 +1,486 @@
+/*
+  ==============================================================================
+
+    Compact binary journal of everything the analysis sees, for reproducing
+    live sessions and using them as regression tests and benchmarks.
+
+    Layout (little endian):
+
+        header   "AKJ1", uint16 version, uint16 reserved, float64 sample rate,
+                 uint32 max block size, int64 start time (ms since epoch)
+
+        records  uint8 tag followed by
+                   block        varint block index delta, float64 host time
+                   hostEvent    varint sample offset, varint size, bytes
+                   deviceEvent  uint8 device slot, float64 time stamp, varint size, bytes
+                   drain        uint64 fingerprint of the analysis afterwards (version 2)
+                                - the analysis consumed everything before this
+                   lost         varint number of records dropped because the writer fell behind
+                   state        varint size, a plugin state (getStateInformation) that was
+                                loaded into the analysis here (version 3)
+
+    Host events belong to the most recent block record, and a host event is
+    analysed at its block's host time plus its offset at the sample rate. A
+    block whose events were analysed at other times (an offline render's)
+    gets a block record per time, with the same index. Records appear in the
+    order the analysis consumed them, and drain records mark the points where
+    it did, so a replay that honours them reproduces the analysis exactly and
+    can check it against the live fingerprints as it goes.
+
+    Recording starts from a fresh analysis, as the replay does. Device
+    events from slot MergedMidiInput::maxInputs came from the on-screen
+    keyboard, which takes the devices' path through the analysis.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+namespace SessionJournal
+{
+    enum Tag : uint8
+    {
+        blockTag = 1,
+        hostEventTag,
+        deviceEventTag,
+        drainTag,
+        lostTag,
+        stateTag
+    };
+
+    static constexpr char magic[4] = { 'A', 'K', 'J', '1' };
+    static constexpr uint16 currentVersion = 3;
+    static constexpr int headerSize = 4 + 2 + 2 + 8 + 4 + 8;
+
+    //==============================================================================
+    /** FNV-1a over the exact bytes of what's added, so any difference in a float shows up. */
+    class Fingerprint
+    {
+    public:
+        explicit Fingerprint (uint64 seed = 0xcbf29ce484222325ull)  : hash (seed) {}
+
+        template <typename Value>
+        void add (const Value& value)
+        {
+            static_assert (std::is_trivially_copyable<Value>::value, "Fingerprints are taken from the bytes");
+            auto* bytes = reinterpret_cast<const uint8*> (&value);
+
+            for (size_t i = 0; i < sizeof (Value); ++i)
+                hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+        }
+
+        uint64 get() const      { return hash; }
+
+    private:
+        uint64 hash;
+    };
+
+    //==============================================================================
+    /** Encodes records on the calling thread and hands them to a background thread
+        that writes them to disk. All add* calls must come from the same thread.
+    */
+    class Writer  : private Thread
+    {
+    public:
+        Writer (const File& file, double sampleRate, int maxBlockSize)
+            : Thread ("SessionJournalWriter"),
+              stream (file)
+        {
+            if (! stream.openedOk())
+                return;
+
+            stream.setPosition (0);
+            stream.truncate();
+
+            stream.write (magic, sizeof (magic));
+            stream.writeShort ((short) currentVersion);
+            stream.writeShort (0);
+            stream.writeDouble (sampleRate);
+            stream.writeInt (maxBlockSize);
+            stream.writeInt64 (Time::currentTimeMillis());
+
+            startThread (3);
+        }
+
+        ~Writer() override
+        {
+            signalThreadShouldExit();
+            notify();
+            stopThread (4000);
+            drain();
+            stream.flush();
+        }
+
+        bool openedOk() const               { return stream.openedOk(); }
+        uint64 getNumLostRecords() const    { return totalLost; }
+
+        void addHostEvent (uint32 blockIndex, double hostTime, int sampleOffset, const uint8* data, int size)
+        {
+            record.clear();
+            const auto newBlock = ! hasBlock || blockIndex != lastBlock || hostTime != lastHostTime;
+
+            if (newBlock)
+            {
+                record.push_back (blockTag);
+                writeVarint ((uint32) (blockIndex - lastBlock));
+                writeRaw (&hostTime, sizeof (hostTime));
+            }
+
+            record.push_back (hostEventTag);
+            writeVarint ((uint64) jmax (0, sampleOffset));
+            writeVarint ((uint64) size);
+            writeRaw (data, (size_t) size);
+
+            // Deltas are relative to the last block record that actually made it into the journal.
+            if (submit() && newBlock)
+            {
+                lastBlock = blockIndex;
+                lastHostTime = hostTime;
+                hasBlock = true;
+            }
+        }
+
+        void addDeviceEvent (int slot, double timeStamp, const uint8* data, int size)
+        {
+            record.clear();
+            record.push_back (deviceEventTag);
+            record.push_back ((uint8) slot);
+            writeRaw (&timeStamp, sizeof (timeStamp));
+            writeVarint ((uint64) size);
+            writeRaw (data, (size_t) size);
+            submit();
+        }
+
+        void addDrain (uint64 fingerprint)
+        {
+            record.clear();
+            record.push_back (drainTag);
+            writeRaw (&fingerprint, sizeof (fingerprint));
+            submit();
+        }
+
+        /** Host events that never reached the journal: lost records for the replay to warn about. */
+        void addLost (uint64 numRecords)
+        {
+            pendingLost += numRecords;
+            totalLost += numRecords;
+        }
+
+        void addState (const void* data, size_t size)
+        {
+            record.clear();
+            record.push_back (stateTag);
+            writeVarint ((uint64) size);
+            writeRaw (data, size);
+            submit();
+        }
+
+    private:
+        bool submit()
+        {
+            if (pendingLost > 0)
+            {
+                std::vector<uint8> lostRecord { lostTag };
+                writeVarint (lostRecord, pendingLost);
+
+                if (! push (lostRecord))
+                {
+                    ++pendingLost;
+                    ++totalLost;
+                    return false;
+                }
+
+                pendingLost = 0;
+            }
+
+            if (! push (record))
+            {
+                ++pendingLost;
+                ++totalLost;
+                return false;
+            }
+
+            return true;
+        }
+
+        bool push (const std::vector<uint8>& bytes)
+        {
+            if (fifo.getFreeSpace() < (int) bytes.size())
+                return false;
+
+            int start1, size1, start2, size2;
+            fifo.prepareToWrite ((int) bytes.size(), start1, size1, start2, size2);
+            std::memcpy (ring.data() + start1, bytes.data(), (size_t) size1);
+            std::memcpy (ring.data() + start2, bytes.data() + size1, (size_t) size2);
+            fifo.finishedWrite (size1 + size2);
+
+            if (fifo.getNumReady() > ringSize / 2)
+                notify();
+
+            return true;
+        }
+
+        void run() override
+        {
+            while (! threadShouldExit())
+            {
+                wait (50);
+                drain();
+            }
+        }
+
+        void drain()
+        {
+            int start1, size1, start2, size2;
+            fifo.prepareToRead (fifo.getNumReady(), start1, size1, start2, size2);
+            stream.write (ring.data() + start1, (size_t) size1);
+            stream.write (ring.data() + start2, (size_t) size2);
+            fifo.finishedRead (size1 + size2);
+        }
+
+        void writeVarint (uint64 value)                   { writeVarint (record, value); }
+
+        static void writeVarint (std::vector<uint8>& out, uint64 value)
+        {
+            while (value >= 0x80)
+            {
+                out.push_back ((uint8) (value | 0x80));
+                value >>= 7;
+            }
+
+            out.push_back ((uint8) value);
+        }
+
+        void writeRaw (const void* data, size_t size)
+        {
+            auto* bytes = static_cast<const uint8*> (data);
+            record.insert (record.end(), bytes, bytes + size);
+        }
+
+        static constexpr int ringSize = 1 << 20;
+
+        FileOutputStream stream;
+        AbstractFifo fifo { ringSize };
+        std::vector<uint8> ring = std::vector<uint8> (ringSize);
+
+        std::vector<uint8> record;
+        uint32 lastBlock = 0;
+        double lastHostTime = 0.0;
+        bool hasBlock = false;
+        uint64 pendingLost = 0, totalLost = 0;
+
+        JUCE_DECLARE_NON_COPYABLE (Writer)
+    };
+
+    //==============================================================================
+    /** Walks a memory-mapped journal without copying it. */
+    class Reader
+    {
+    public:
+        struct Record
+        {
+            Tag tag;
+            uint32 blockIndex;      // the block this record belongs to
+            double time;            // host time of the block, or device time stamp
+            int sampleOffset;       // host events only
+            int slot;               // device events only
+            const uint8* data;      // events and states
+            int size;
+            uint64 numLost;         // lost records only
+            uint64 fingerprint;     // drains only, from version 2
+            bool hasFingerprint;
+        };
+
+        explicit Reader (const File& file)
+            : mapped (file, MemoryMappedFile::readOnly)
+        {
+            if (mapped.getData() == nullptr)
+            {
+                error = "Can't open " + file.getFullPathName();
+                return;
+            }
+
+            start = static_cast<const uint8*> (mapped.getData());
+            end = start + mapped.getSize();
+
+            if (mapped.getSize() < (size_t) headerSize || std::memcmp (start, magic, sizeof (magic)) != 0)
+            {
+                error = "Not a session journal: " + file.getFullPathName();
+                return;
+            }
+
+            version = ByteOrder::littleEndianShort (start + 4);
+
+            if (version > currentVersion)
+            {
+                error = "Journal version is newer than this build";
+                return;
+            }
+
+            sampleRate = readDouble (start + 8);
+            maxBlockSize = (int) ByteOrder::littleEndianInt (start + 16);
+            rewind();
+        }
+
+        String getError() const         { return error; }
+        bool isValid() const            { return error.isEmpty(); }
+        double getSampleRate() const    { return sampleRate; }
+        int getMaxBlockSize() const     { return maxBlockSize; }
+
+        /** Whether drain records carry the live session's fingerprint. */
+        bool hasFingerprints() const    { return version >= 2; }
+
+        void rewind()
+        {
+            pos = start + headerSize;
+            blockIndex = 0;
+            blockTime = 0.0;
+        }
+
+        /** Reads the next record. Returns false at the end, or if the journal is truncated. */
+        bool next (Record& r)
+        {
+            while (pos < end)
+            {
+                r = {};
+                r.tag = (Tag) *pos++;
+
+                switch (r.tag)
+                {
+                    case blockTag:
+                    {
+                        uint64 delta = 0;
+
+                        if (! readVarint (delta) || ! canRead (8))
+                            return false;
+
+                        blockIndex += (uint32) delta;
+                        blockTime = readDouble (pos);
+                        pos += 8;
+                        continue;
+                    }
+
+                    case hostEventTag:
+                    {
+                        uint64 offset = 0, size = 0;
+
+                        if (! readVarint (offset) || ! readVarint (size) || ! canRead (size))
+                            return false;
+
+                        r.sampleOffset = (int) offset;
+                        r.data = pos;
+                        r.size = (int) size;
+                        pos += size;
+                        break;
+                    }
+
+                    case deviceEventTag:
+                    {
+                        uint64 size = 0;
+
+                        if (! canRead (9))
+                            return false;
+
+                        r.slot = *pos;
+                        r.time = readDouble (pos + 1);
+                        pos += 9;
+
+                        if (! readVarint (size) || ! canRead (size))
+                            return false;
+
+                        r.data = pos;
+                        r.size = (int) size;
+                        pos += size;
+                        r.blockIndex = blockIndex;
+                        return true;
+                    }
+
+                    case drainTag:
+                        if (hasFingerprints())
+                        {
+                            if (! canRead (8))
+                                return false;
+
+                            std::memcpy (&r.fingerprint, pos, sizeof (r.fingerprint));
+                            r.hasFingerprint = true;
+                            pos += 8;
+                        }
+
+                        break;
+
+                    case lostTag:
+                        if (! readVarint (r.numLost))
+                            return false;
+
+                        break;
+
+                    case stateTag:
+                    {
+                        uint64 size = 0;
+
+                        if (! readVarint (size) || ! canRead (size))
+                            return false;
+
+                        r.data = pos;
+                        r.size = (int) size;
+                        pos += size;
+                        break;
+                    }
+
+                    default:
+                        error = "Corrupt journal record";
+                        return false;
+                }
+
+                r.blockIndex = blockIndex;
+
+                if (r.tag == hostEventTag)
+                    r.time = blockTime;
+
+                return true;
+            }
+
+            return false;
+        }
+
+    private:
+        bool canRead (uint64 numBytes) const    { return (uint64) (end - pos) >= numBytes; }
+
+        bool readVarint (uint64& value)
+        {
+            value = 0;
+
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                if (pos >= end)
+                    return false;
+
+                const auto byte = *pos++;
+                value |= (uint64) (byte & 0x7f) << shift;
+
+                if ((byte & 0x80) == 0)
+                    return true;
+            }
+
+            return false;
+        }
+
+        static double readDouble (const uint8* p)
+        {
+            double d;
+            std::memcpy (&d, p, sizeof (d));
+            return d;
+        }
+
+        MemoryMappedFile mapped;
+        String error;
+        const uint8* start = nullptr;
+        const uint8* end = nullptr;
+        const uint8* pos = nullptr;
+        double sampleRate = 44100.0;
+        int maxBlockSize = 512;
+        uint16 version = 0;
+        uint32 blockIndex = 0;
+        double blockTime = 0.0;
+    };
+}
@@ -0,0 +1,182 @@
+/*
+  ==============================================================================
+
+    Feeds a recorded session journal back through the processor as fast as
+    possible, the way the live session reached the analysis:
+
+      - host events through processBlock, one call per recorded block, with
+        the block index and host time they were recorded with
+      - device events through the same path as the merged MIDI devices, with
+        their recorded time stamps
+      - a drain exactly where the live session drained
+      - any state the host loaded while recording, where it was loaded
+
+    After every drain the analysis fingerprint is compared with the one the
+    live session recorded there, and folded into a fingerprint for the whole
+    replay, so two replays of the same journal (or a replay before and after
+    a change) can be compared with a single number.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "SessionJournal.h"
+
+class SessionJournalReplay
+{
+public:
+    struct Report
+    {
+        int64 numEvents = 0, numBlocks = 0, numDrains = 0;
+        int64 numChecked = 0, numDiverged = 0, firstDivergence = -1;   // drains checked against the live session
+        uint64 numLost = 0, fingerprint = 0;
+        double seconds = 0.0;
+        String keys, failure;
+
+        String toString() const
+        {
+            if (failure.isNotEmpty())
+                return "Replay failed: " + failure;
+
+            return String (numEvents) + " events in " + String (numBlocks) + " blocks, "
+                 + String (numDrains) + " drains in " + String (seconds, 3) + " s ("
+                 + String ((double) numEvents / jmax (seconds, 1.0e-9), 0) + " events/s)\n"
+                 + (numLost > 0 ? "warning: " + String (numLost) + " records were lost while recording\n" : String())
+                 + (numChecked == 0 ? String ("no live fingerprints to check against (version 1 journal)\n")
+                                    : numDiverged == 0 ? "matches the live session at all " + String (numChecked) + " drains\n"
+                                                       : "diverged from the live session at drain " + String (firstDivergence + 1)
+                                                           + " (" + String (numDiverged) + " of " + String (numChecked) + " drains differ)\n")
+                 + "fingerprint " + String::toHexString ((int64) fingerprint) + "\n" + keys;
+        }
+    };
+
+    static Report run (MidiLoggerPluginDemoProcessor& processor, SessionJournal::Reader& reader)
+    {
+        Report report;
+
+        if (! reader.isValid())
+        {
+            report.failure = reader.getError();
+            return report;
+        }
+
+        const auto maxBlockSize = jmax (1, reader.getMaxBlockSize());
+        processor.prepareToPlay (reader.getSampleRate(), maxBlockSize);
+        processor.resetAnalysis();
+
+        AudioBuffer<float> audio (processor.getTotalNumOutputChannels(), maxBlockSize);
+        MidiBuffer midi;
+        std::vector<MergedMidiInput::Event> deviceEvents;
+        uint32 blockIndex = 0;
+        double blockTime = 0.0;
+        int lastOffset = 0;
+        SessionJournal::Fingerprint fingerprint;
+
+        auto flush = [&]
+        {
+            if (midi.isEmpty())
+                return;
+
+            audio.setSize (audio.getNumChannels(), jmax (maxBlockSize, lastOffset + 1), false, false, true);
+            processor.setNextBlockTime (blockIndex, blockTime);
+            processor.processBlock (audio, midi);
+            midi.clear();
+            lastOffset = 0;
+            ++report.numBlocks;
+        };
+
+        auto drain = [&]
+        {
+            flush();
+            processor.drainPendingMidi (deviceEvents);
+            deviceEvents.clear();
+
+            const auto snapshot = processor.getAnalysisFingerprint();
+            fingerprint.add (snapshot);
+            return snapshot;
+        };
+
+        const auto startTicks = Time::getHighResolutionTicks();
+        reader.rewind();
+        SessionJournal::Reader::Record r;
+
+        while (reader.next (r))
+        {
+            switch (r.tag)
+            {
+                case SessionJournal::hostEventTag:
+                    // MidiBuffer sorts by position, so an offset going backwards starts a new block too.
+                    if (r.blockIndex != blockIndex || r.time != blockTime || r.sampleOffset < lastOffset)
+                        flush();
+
+                    blockIndex = r.blockIndex;
+                    blockTime = r.time;
+                    midi.addEvent (r.data, r.size, r.sampleOffset);
+                    lastOffset = r.sampleOffset;
+                    ++report.numEvents;
+                    break;
+
+                case SessionJournal::deviceEventTag:
+                {
+                    // The merged input only carries short messages.
+                    if (r.size > (int) sizeof (MergedMidiInput::Event::data))
+                        break;
+
+                    MergedMidiInput::Event e {};
+                    e.timeStamp = r.time;
+                    std::memcpy (e.data, r.data, (size_t) r.size);
+                    e.size = (uint8) r.size;
+                    e.slot = (uint8) r.slot;
+                    deviceEvents.push_back (e);
+                    ++report.numEvents;
+                    break;
+                }
+
+                case SessionJournal::drainTag:
+                {
+                    const auto snapshot = drain();
+
+                    if (r.hasFingerprint)
+                    {
+                        ++report.numChecked;
+
+                        if (snapshot != r.fingerprint)
+                        {
+                            if (report.numDiverged++ == 0)
+                                report.firstDivergence = report.numDrains;
+                        }
+                    }
+
+                    ++report.numDrains;
+                    break;
+                }
+
+                case SessionJournal::lostTag:
+                    report.numLost += r.numLost;
+                    break;
+
+                case SessionJournal::stateTag:
+                    flush();
+                    processor.applyJournalledState (r.data, r.size);
+                    break;
+
+                case SessionJournal::blockTag:
+                default:
+                    break;
+            }
+        }
+
+        // Anything after the last drain was still queued when recording stopped.
+        drain();
+
+        report.seconds = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - startTicks);
+        report.fingerprint = fingerprint.get();
+        report.keys = processor.Midi_Key_Finder_Util.get_keys();
+
+        if (! reader.isValid())
+            report.failure = reader.getError();
+
+        return report;
+    }
+};
@@ -0,0 +1,199 @@
+/*
+  ==============================================================================
+
+    Times the MIDI 2.0 ingest path (UmpDecoder over aligned words, then
+    MidiKeyFinder::add_ump_event) against the MIDI 1.0 one (MidiBufferScanner
+    over a MidiBuffer, a MidiMessage per kept event, then add_midi_message),
+    for block sizes from 32 to 4096 samples.
+
+    Both blocks carry the same performance: notes (on the MIDI 2.0 side with
+    16-bit velocities, some with a pitch attribute), the sustain pedal,
+    pitch bend, clock and aftertouch. Decoding is timed on its own and
+    together with the analysis; the finder is reset between blocks, outside
+    the timing.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+class UmpBenchmark
+{
+public:
+    struct Result
+    {
+        int blockSize, eventsPerBlock;
+        double midi1DecodeNs, umpDecodeNs, midi1TotalNs, umpTotalNs;   // per event
+    };
+
+    struct Report
+    {
+        std::vector<Result> results;
+
+        String toString() const
+        {
+            String s ("block  events  decode ns/event: MIDI 1.0     UMP  speedup   with analysis: MIDI 1.0     UMP  speedup\n");
+
+            auto speedup = [] (double a, double b) { return (String (a / jmax (b, 1.0e-9), 2) + "x").paddedLeft (' ', 9); };
+
+            for (const auto& r : results)
+                s += String (r.blockSize).paddedLeft (' ', 5) + String (r.eventsPerBlock).paddedLeft (' ', 8)
+                   + String (r.midi1DecodeNs, 1).paddedLeft (' ', 26) + String (r.umpDecodeNs, 1).paddedLeft (' ', 8)
+                   + speedup (r.midi1DecodeNs, r.umpDecodeNs)
+                   + String (r.midi1TotalNs, 1).paddedLeft (' ', 26) + String (r.umpTotalNs, 1).paddedLeft (' ', 8)
+                   + speedup (r.midi1TotalNs, r.umpTotalNs) + "\n";
+
+            return s;
+        }
+    };
+
+    static Report run (int64 eventsPerMeasurement = 2000000)
+    {
+        Report report;
+        MidiKeyFinder finder;
+
+        for (int blockSize = 32; blockSize <= 4096; blockSize *= 2)
+        {
+            MidiBuffer midi1;
+            std::vector<uint32> ump;
+            makeBlocks (blockSize, midi1, ump);
+
+            const auto numBlocks = (int) jmax ((int64) 1, eventsPerMeasurement / midi1.getNumEvents());
+            const auto numEvents = (double) numBlocks * midi1.getNumEvents();
+            int64 sink = 0;     // so decoding can't be optimised away
+
+            auto decodeMidi1 = [&] (bool analyse)
+            {
+                MidiBufferScanner::scan (midi1, [&] (const MidiBufferScanner::Event* events, int num)
+                {
+                    for (int i = 0; i < num; ++i)
+                    {
+                        const MidiMessage m (events[i].data, events[i].size, events[i].samplePosition / 44100.0);
+
+                        if (analyse)
+                            finder.add_midi_message (m);
+                        else
+                            sink += m.getRawDataSize();
+                    }
+                });
+            };
+
+            auto decodeUmp = [&] (bool analyse)
+            {
+                UmpDecoder::decode (ump.data(), (int) ump.size(), [&] (const UmpDecoder::Event* events, int num)
+                {
+                    for (int i = 0; i < num; ++i)
+                    {
+                        if (analyse)
+                            finder.add_ump_event (events[i], 0.0);
+                        else
+                            sink += events[i].velocity;
+                    }
+                });
+            };
+
+            auto reset = [&] { finder.reset(); };
+
+            const Result r { blockSize, midi1.getNumEvents(),
+                             time (numBlocks, [&] { decodeMidi1 (false); }, reset) * 1.0e9 / numEvents,
+                             time (numBlocks, [&] { decodeUmp (false); }, reset) * 1.0e9 / numEvents,
+                             time (numBlocks, [&] { decodeMidi1 (true); }, reset) * 1.0e9 / numEvents,
+                             time (numBlocks, [&] { decodeUmp (true); }, reset) * 1.0e9 / numEvents };
+
+            report.results.push_back (r);
+
+            volatile auto keep = sink;
+            ignoreUnused (keep);
+        }
+
+        return report;
+    }
+
+private:
+    // Seconds spent in decode() only.
+    template <typename Decode, typename Reset>
+    static double time (int numBlocks, Decode&& decode, Reset&& reset)
+    {
+        int64 ticks = 0;
+
+        for (int i = 0; i < numBlocks; ++i)
+        {
+            const auto start = Time::getHighResolutionTicks();
+            decode();
+            ticks += Time::getHighResolutionTicks() - start;
+            reset();
+        }
+
+        return Time::highResolutionTicksToSeconds (ticks);
+    }
+
+    // One event every other sample, the same events in both forms.
+    static void makeBlocks (int blockSize, MidiBuffer& midi1, std::vector<uint32>& ump)
+    {
+        Random random (blockSize);
+
+        auto addUmp = [&] (uint32 first, uint32 second, bool isLong)
+        {
+            ump.push_back (first);
+
+            if (isLong)
+                ump.push_back (second);
+        };
+
+        for (int pos = 0; pos < blockSize; pos += 2)
+        {
+            const auto note = 36 + random.nextInt (48);
+            const auto noteWord = (uint32) note << 8;
+
+            switch (random.nextInt (10))
+            {
+                case 0:
+                    midi1.addEvent (MidiMessage::midiClock(), pos);
+                    addUmp (0x10f80000, 0, false);
+                    break;
+
+                case 1:
+                {
+                    const auto pressure = random.nextInt (128);
+                    midi1.addEvent (MidiMessage::aftertouchChange (1, note, pressure), pos);
+                    addUmp (0x40a00000 | noteWord, (uint32) pressure << 25, true);
+                    break;
+                }
+
+                case 2:
+                {
+                    const auto down = random.nextBool();
+                    midi1.addEvent (MidiMessage::controllerEvent (1, 64, down ? 127 : 0), pos);
+                    addUmp (0x40b04000, down ? 0xffffffff : 0, true);
+                    break;
+                }
+
+                case 3:
+                {
+                    const auto bend = random.nextInt (16384);
+                    midi1.addEvent (MidiMessage::pitchWheel (1, bend), pos);
+                    addUmp (0x40e00000, (uint32) bend << 18, true);
+                    break;
+                }
+
+                case 4:
+                case 5:
+                    midi1.addEvent (MidiMessage::noteOff (1, note), pos);
+                    addUmp (0x40800000 | noteWord, 0, true);
+                    break;
+
+                default:
+                {
+                    const auto velocity = 1 + random.nextInt (127);
+                    const auto hasPitch = random.nextInt (4) == 0;
+                    midi1.addEvent (MidiMessage::noteOn (1, note, (uint8) velocity), pos);
+                    addUmp (0x40900000 | noteWord | (hasPitch ? 3u : 0u),
+                            (uint32) UmpDecoder::velocityFrom7Bits[(size_t) velocity] << 16
+                              | (hasPitch ? (uint32) (note * 512 + random.nextInt (64)) : 0u),
+                            true);
+                    break;
+                }
+            }
+        }
+    }
+};
@@ -0,0 +1,264 @@
+/*
+  ==============================================================================
+
+    Decodes Universal MIDI Packets (MIDI 2.0) straight from aligned 32-bit
+    words, keeping only what the analysis can use and without building a
+    message object per packet:
+
+      - MIDI 2.0 note on/off, with the 16-bit velocity and, when the note
+        carries the Pitch 7.9 attribute, its exact pitch
+      - per-note pitch: the registered per-note controller Pitch 7.25 and
+        per-note pitch bend (taken as +/-48 semitones around the note
+        number, the default range)
+      - control changes, narrowed to 7 bits for the pedals
+      - MIDI 1.0 channel voice messages in UMP, with their 7-bit velocities
+        scaled up to 16 bits the way the MIDI 2.0 translation rules do it
+
+    Everything else (utility and system packets, SysEx, data messages,
+    channel pitch bend, pressure) is counted and skipped. Groups share the
+    sixteen channels. Packet lengths come from a table on the message type,
+    and kept events are compacted into fixed-size batches, as
+    MidiBufferScanner does for MIDI 1.0. A Reader does the same for a byte
+    stream, however the reads split its words and packets.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+
+namespace UmpDecoder
+{
+    enum Kind : uint8
+    {
+        ignored = 0,
+        noteOff,
+        noteOn,
+        perNotePitch,   // a sounding note's pitch has moved
+        controller
+    };
+
+    // Words per packet, by message type (the top nibble of the first word).
+    static constexpr std::array<uint8, 16> wordsForMessageType { 1, 1, 1, 2, 2, 4, 1, 1, 2, 2, 2, 3, 3, 4, 4, 4 };
+
+    // MIDI 1.0 velocities to 16 bits: a shift up to the centre value, bit repetition above it.
+    static constexpr std::array<uint16, 128> velocityFrom7Bits = []
+    {
+        std::array<uint16, 128> table {};
+
+        for (uint32 v = 0; v < 128; ++v)
+        {
+            auto scaled = v << 9;
+
+            if (v > 64)
+            {
+                for (auto repeat = (v & 0x3f) << 3; repeat != 0; repeat >>= 6)
+                    scaled |= repeat;
+            }
+
+            table[v] = (uint16) scaled;
+        }
+
+        return table;
+    }();
+
+    /** A kept event. Channels are 0-15. */
+    struct Event
+    {
+        float pitch;        // semitones, 60 = middle C: the note's pitch, or its new pitch for perNotePitch
+        uint16 velocity;    // notes
+        uint8 channel, note;
+        uint8 number, value;    // controllers, value 0-127
+        Kind kind;
+    };
+
+    inline int getPitchClass (float pitch) noexcept
+    {
+        return roundToInt (jlimit (0.0f, 127.0f, pitch)) % 12;
+    }
+
+    inline Event decodePacket (const uint32* packet) noexcept
+    {
+        const auto w = packet[0];
+        const auto type = w >> 28;
+        const auto opcode = (w >> 20) & 0xf;
+        const auto channel = (uint8) ((w >> 16) & 0xf);
+        const auto byte3 = (uint8) ((w >> 8) & 0x7f);
+        const auto byte4 = (uint8) (w & 0xff);
+
+        Event e { (float) byte3, 0, channel, byte3, 0, 0, ignored };
+
+        if (type == 0x2)   // MIDI 1.0 channel voice
+        {
+            const auto velocity = (uint8) (byte4 & 0x7f);
+
+            if (opcode == 0x9 && velocity > 0)
+            {
+                e.kind = noteOn;
+                e.velocity = velocityFrom7Bits[velocity];
+            }
+            else if (opcode == 0x8 || opcode == 0x9)
+            {
+                e.kind = noteOff;
+            }
+            else if (opcode == 0xb)
+            {
+                e.kind = controller;
+                e.number = byte3;
+                e.value = velocity;
+            }
+        }
+        else if (type == 0x4)   // MIDI 2.0 channel voice
+        {
+            const auto data = packet[1];
+
+            switch (opcode)
+            {
+                case 0x9:
+                    // Velocity 0 is still a note-on in MIDI 2.0; it just weighs nothing.
+                    e.kind = noteOn;
+                    e.velocity = (uint16) (data >> 16);
+
+                    if (byte4 == 3)     // attribute: Pitch 7.9
+                        e.pitch = (float) (data & 0xffff) / 512.0f;
+
+                    break;
+
+                case 0x8:
+                    e.kind = noteOff;
+                    break;
+
+                case 0x0:   // registered per-note controller
+                    if (byte4 == 3)     // Pitch 7.25
+                    {
+                        e.kind = perNotePitch;
+                        e.pitch = (float) ((double) data / (double) (1 << 25));
+                    }
+
+                    break;
+
+                case 0x6:   // per-note pitch bend, centred on 0x80000000
+                    e.kind = perNotePitch;
+                    e.pitch = (float) byte3 + (float) (((double) data - 2147483648.0) / 2147483648.0 * 48.0);
+                    break;
+
+                case 0xb:
+                    e.kind = controller;
+                    e.number = byte3;
+                    e.value = (uint8) (data >> 25);
+                    break;
+
+                default:
+                    break;
+            }
+        }
+
+        return e;
+    }
+
+    struct Result
+    {
+        int numWordsUsed = 0;   // whole packets only; a packet cut off at the end is left for next time
+        int numPackets = 0, numIgnored = 0;
+    };
+
+    static constexpr int batchSize = 128;
+
+    /** Calls onBatch (const Event* events, int numEvents) for the kept events, in order, up to
+        batchSize at a time.
+    */
+    template <typename Callback>
+    Result decode (const uint32* words, int numWords, Callback&& onBatch)
+    {
+        // Skipped packets are written too and then overwritten by the next one.
+        Event batch[batchSize];
+        int numInBatch = 0;
+        Result result;
+
+        while (result.numWordsUsed < numWords)
+        {
+            const auto* packet = words + result.numWordsUsed;
+            const auto size = (int) wordsForMessageType[packet[0] >> 28];
+
+            if (result.numWordsUsed + size > numWords)
+                break;
+
+            batch[numInBatch] = decodePacket (packet);
+            const auto kept = batch[numInBatch].kind != ignored;
+            numInBatch += kept ? 1 : 0;
+            result.numIgnored += kept ? 0 : 1;
+            result.numWordsUsed += size;
+            ++result.numPackets;
+
+            if (numInBatch == batchSize)
+            {
+                onBatch ((const Event*) batch, numInBatch);
+                numInBatch = 0;
+            }
+        }
+
+        if (numInBatch > 0)
+            onBatch ((const Event*) batch, numInBatch);
+
+        return result;
+    }
+
+    /** Turns reads of a big-endian byte stream (as UMP goes over the wire) into aligned words
+        and decodes them, carrying a split word or packet over to the next read. Each read
+        must be at most maxBytesPerRead.
+    */
+    template <int maxBytesPerRead>
+    class Reader
+    {
+    public:
+        /** Calls onEvent (const Event&) for each kept event, and returns the number of packets
+            completed by this read.
+        */
+        template <typename OnEvent>
+        int push (const uint8* data, int size, OnEvent&& onEvent)
+        {
+            jassert (size <= maxBytesPerRead);
+
+            while (size > 0 && numPartialBytes > 0)
+            {
+                partialWord = (partialWord << 8) | *data++;
+                --size;
+
+                if (++numPartialBytes == 4)
+                {
+                    words[(size_t) numWords++] = partialWord;
+                    numPartialBytes = 0;
+                }
+            }
+
+            for (; size >= 4; data += 4, size -= 4)
+                words[(size_t) numWords++] = ByteOrder::bigEndianInt (data);
+
+            if (size > 0)
+            {
+                partialWord = 0;
+
+                for (; size > 0; --size, ++numPartialBytes)
+                    partialWord = (partialWord << 8) | *data++;
+            }
+
+            const auto result = decode (words.data(), numWords, [&] (const Event* events, int num)
+            {
+                for (int i = 0; i < num; ++i)
+                    onEvent (events[i]);
+            });
+
+            numWords -= result.numWordsUsed;
+            std::copy (words.begin() + result.numWordsUsed, words.begin() + result.numWordsUsed + numWords, words.begin());
+            return result.numPackets;
+        }
+
+    private:
+        // A read's words plus the most a cut-off packet can leave over.
+        std::array<uint32, maxBytesPerRead / 4 + 4> words;
+        int numWords = 0, numPartialBytes = 0;
+        uint32 partialWord = 0;
+    };
+}
@@ -0,0 +1,275 @@
+/*
+  ==============================================================================
+
+    Follows which notes are actually sounding on each MIDI channel - keys
+    held down, notes held by the sustain pedal (CC64) and notes caught by
+    the sostenuto pedal (CC66) - and credits each pitch class with the time
+    its notes sounded for.
+
+    MIDI 1.0 notes are credited to their note number's pitch class with a
+    weight of 1. The note-level calls let a voice carry its own pitch class
+    (per-note pitch, which can move while it sounds) and a weight (e.g. from
+    a 16-bit velocity), so the credit is weight x seconds.
+
+    Everything is fixed-size and nothing allocates. Note events are O(1);
+    lifting a pedal costs one step per note it releases. Running voices are
+    kept as a total weight and a weighted sum of start times per pitch
+    class, so reading the evidence at any moment is also O(1).
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <array>
+
+class VoiceTable
+{
+public:
+    using Evidence = std::array<float, 12>;     // seconds sounded, per pitch class (0 = C)
+
+    /** Time is in seconds and should not go backwards by much; negative durations count as zero. */
+    void handle (const MidiMessage& m, double time)
+    {
+        const auto channelIndex = m.getChannel() - 1;
+
+        if (m.isNoteOn())
+            noteOn (channelIndex, m.getNoteNumber(), time);
+        else if (m.isNoteOff())
+            noteOff (channelIndex, m.getNoteNumber(), time);
+        else if (m.isController())
+            controller (channelIndex, m.getControllerNumber(), m.getControllerValue(), time);
+        else if (isPositiveAndBelow (channelIndex, 16))
+            lastTime = jmax (lastTime, time);
+    }
+
+    /** Channels are 0-15 here. pitchClass defaults to the note number's; weight is 0 to 1. */
+    void noteOn (int channelIndex, int note, double time, int pitchClass = -1, float weight = 1.0f)
+    {
+        if (! isValid (channelIndex, note))
+            return;
+
+        auto& c = channels[(size_t) channelIndex];
+        lastTime = jmax (lastTime, time);
+
+        endVoice (c, note, time);   // a retriggered note starts a new voice
+        c.keyDown.set (note);
+        c.sounding.set (note);
+        c.pitchClass[(size_t) note] = (uint8) (pitchClass < 0 ? note % 12 : pitchClass % 12);
+        c.weight[(size_t) note] = (uint16) roundToInt (jlimit (0.0f, 1.0f, weight) * (float) fullWeight);
+        startVoice (c, note, time);
+    }
+
+    void noteOff (int channelIndex, int note, double time)
+    {
+        if (! isValid (channelIndex, note))
+            return;
+
+        auto& c = channels[(size_t) channelIndex];
+        lastTime = jmax (lastTime, time);
+        c.keyDown.clear (note);
+
+        if (! c.sustain && ! c.latched.test (note))
+            endVoice (c, note, time);
+    }
+
+    /** Credits a sounding note to another pitch class from 'time' on, for per-note pitch
+        that moves while the note sounds. Does nothing if the note isn't sounding.
+    */
+    void setPitchClass (int channelIndex, int note, int pitchClass, double time)
+    {
+        if (! isValid (channelIndex, note) || pitchClass < 0)
+            return;
+
+        auto& c = channels[(size_t) channelIndex];
+        lastTime = jmax (lastTime, time);
+
+        if (! c.sounding.test (note) || c.pitchClass[(size_t) note] == pitchClass % 12)
+            return;
+
+        endVoice (c, note, time);
+        c.sounding.set (note);
+        c.pitchClass[(size_t) note] = (uint8) (pitchClass % 12);
+        startVoice (c, note, time);
+    }
+
+    /** Only the pedals and the reset/all-notes-off controllers matter; value is 0-127. */
+    void controller (int channelIndex, int number, int value, double time)
+    {
+        if (! isPositiveAndBelow (channelIndex, 16))
+            return;
+
+        auto& c = channels[(size_t) channelIndex];
+        lastTime = jmax (lastTime, time);
+
+        const auto on = value >= 64;
+
+        switch (number)
+        {
+            case 64:
+                c.sustain = on;
+                break;
+
+            case 66:
+                // Pressing it catches whatever keys are down at that moment.
+                if (on && ! c.sostenuto)
+                    c.latched = c.keyDown;
+                else if (! on)
+                    c.latched = {};
+
+                c.sostenuto = on;
+                break;
+
+            case 121:   // reset all controllers
+                c.sustain = c.sostenuto = false;
+                c.latched = {};
+                break;
+
+            case 120:   // all sound off
+            case 123:   // all notes off
+                c.keyDown = {};
+                c.latched = {};
+                c.sustain = c.sostenuto = false;
+                break;
+
+            default:
+                return;
+        }
+
+        releaseUnheld (c, time);
+    }
+
+    /** Seconds each pitch class has sounded for, counting running voices up to 'now'
+        (or up to the latest event, if that is later).
+    */
+    Evidence getEvidence (double now = 0.0) const
+    {
+        now = jmax (now, lastTime);
+        Evidence e;
+
+        for (size_t pc = 0; pc < e.size(); ++pc)
+            e[pc] = (float) (finished[pc] + jmax (0.0, soundingWeight[pc] * now - soundingStartSum[pc]));
+
+        return e;
+    }
+
+    /** The time of the latest event. */
+    double getLastTime() const      { return lastTime; }
+
+    int getNumSoundingVoices() const
+    {
+        int total = 0;
+
+        for (auto count : soundingCount)
+            total += count;
+
+        return total;
+    }
+
+    /** Starts again from saved totals, with nothing sounding. */
+    void restore (const Evidence& e)
+    {
+        reset();
+
+        for (size_t pc = 0; pc < e.size(); ++pc)
+            finished[pc] = jmax (0.0, (double) e[pc]);
+    }
+
+    void reset()
+    {
+        channels = {};
+        finished.fill (0.0);
+        soundingCount.fill (0);
+        soundingWeight.fill (0.0);
+        soundingStartSum.fill (0.0);
+        lastTime = 0.0;
+    }
+
+private:
+    struct NoteMask
+    {
+        uint64 bits[2] {};
+
+        bool test (int n) const noexcept     { return ((bits[n >> 6] >> (n & 63)) & 1) != 0; }
+        void set (int n) noexcept            { bits[n >> 6] |= (uint64) 1 << (n & 63); }
+        void clear (int n) noexcept          { bits[n >> 6] &= ~((uint64) 1 << (n & 63)); }
+
+        template <typename Fn>
+        void forEach (Fn&& fn) const
+        {
+            for (int word = 0; word < 2; ++word)
+            {
+                for (auto b = bits[word]; b != 0; b &= b - 1)
+                    fn (word * 64 + countNumberOfBits ((b & (~b + 1)) - 1));
+            }
+        }
+    };
+
+    // Weights are kept in 16 bits per voice; fullWeight is exactly 1.
+    static constexpr int fullWeight = 0xffff;
+
+    struct Channel
+    {
+        std::array<double, 128> start {};
+        std::array<uint16, 128> weight {};
+        std::array<uint8, 128> pitchClass {};
+        NoteMask keyDown, sounding, latched;
+        bool sustain = false, sostenuto = false;
+    };
+
+    static bool isValid (int channelIndex, int note) noexcept
+    {
+        return isPositiveAndBelow (channelIndex, 16) && isPositiveAndBelow (note, 128);
+    }
+
+    static double getWeight (const Channel& c, int note) noexcept
+    {
+        return c.weight[(size_t) note] / (double) fullWeight;
+    }
+
+    void startVoice (Channel& c, int note, double time)
+    {
+        const auto pc = (size_t) c.pitchClass[(size_t) note];
+        const auto weight = getWeight (c, note);
+        c.start[(size_t) note] = time;
+        ++soundingCount[pc];
+        soundingWeight[pc] += weight;
+        soundingStartSum[pc] += weight * time;
+    }
+
+    void endVoice (Channel& c, int note, double time)
+    {
+        if (! c.sounding.test (note))
+            return;
+
+        c.sounding.clear (note);
+
+        const auto pc = (size_t) c.pitchClass[(size_t) note];
+        const auto weight = getWeight (c, note);
+        const auto start = c.start[(size_t) note];
+        finished[pc] += weight * jmax (0.0, time - start);
+        --soundingCount[pc];
+        soundingWeight[pc] -= weight;
+        soundingStartSum[pc] -= weight * start;
+    }
+
+    // Ends every voice that neither a key nor a pedal is holding any more.
+    void releaseUnheld (Channel& c, double time)
+    {
+        if (c.sustain)
+            return;
+
+        const auto sounding = c.sounding;
+
+        sounding.forEach ([&] (int note)
+        {
+            if (! c.keyDown.test (note) && ! c.latched.test (note))
+                endVoice (c, note, time);
+        });
+    }
+
+    std::array<Channel, 16> channels;
+    std::array<double, 12> finished {}, soundingWeight {}, soundingStartSum {};
+    std::array<int, 12> soundingCount {};
+    double lastTime = 0.0;
+};